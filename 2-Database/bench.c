@@ -0,0 +1,481 @@
+#define _GNU_SOURCE     //mkdtemp() and other Linux extensions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  sdbbench
+ *
+ *  Times the operations of sdbsc on generated databases and reports them as
+ *  CSV, one line per dataset and operation:
+ *
+ *      dist,records,op,ops,seconds,ops_per_s,p50_us,p99_us,io_syscalls
+ *
+ *  The datasets are deterministic (a fixed seed), so two runs of the same
+ *  build only differ by noise.  For each distribution and size every student
+ *  is added, looked up, counted, printed, half of them deleted and the file
+ *  compressed, through the same functions sdbsc runs.  io_syscalls is the
+ *  number of read and write family system calls (syscr + syscw of
+ *  /proc/self/io) the operation made.
+ *
+ *  The database is built in a fresh directory under /tmp, which is removed
+ *  afterwards, so student.db of the working directory is left alone.  The
+ *  console output of the operations is sent to /dev/null, the report goes
+ *  to the original stdout.
+ *
+ *  With -b baseline.csv (a report of an earlier run) two columns are added:
+ *  the ops_per_s of the same line of the baseline and the change from it in
+ *  percent.
+ */
+#define BENCH_SEED          0x5DB5DB5DBULL
+#define BENCH_CLUSTER       256     // ids per cluster of the clustered dataset
+#define BENCH_COUNT_REPS    1000    // -c is timed this many times
+#define BENCH_PRINT_REPS    5       // -p is timed this many times
+#define BENCH_MAX_LINES     256     // lines kept from a baseline
+
+static const char *const bench_dists[] = { "uniform", "clustered", "sparse" };
+static const int bench_sizes[] = { 1000, 10000, 100000 };
+
+typedef struct bench_line{
+    char key[64];           // dist,records,op
+    double ops_per_s;
+} bench_line_t;
+
+static FILE *report;                        // the original stdout
+static bench_line_t baseline[BENCH_MAX_LINES];
+static int nbaseline = 0;
+static bool use_wal = false;
+static uint64_t rng_state = BENCH_SEED;
+
+// xorshift64*, so datasets do not depend on the C library
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void shuffle(int *a, int n)
+{
+    for (int i = n - 1; i > 0; i--)
+    {
+        int j = (int)(rng_next() % (uint64_t)(i + 1));
+        int t = a[i];
+
+        a[i] = a[j];
+        a[j] = t;
+    }
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// read and write family system calls made by this process so far
+static long io_syscalls(void)
+{
+    char line[64];
+    long n, total = 0;
+    FILE *io = fopen("/proc/self/io", "r");
+
+    if (io == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), io) != NULL)
+    {
+        if (sscanf(line, "syscr: %ld", &n) == 1 || sscanf(line, "syscw: %ld", &n) == 1)
+            total += n;
+    }
+    fclose(io);
+    return total;
+}
+
+/*
+ *  make_ids
+ *      dist:   "uniform", "clustered" or "sparse"
+ *      n:      number of ids
+ *      space:  ids are taken from 1 to space
+ *
+ *  uniform ids are drawn at random from the whole space and added in random
+ *  order, clustered ids come in runs of BENCH_CLUSTER consecutive ids at
+ *  random places, added run by run, and sparse ids are spread evenly over
+ *  the space and added in ascending order.
+ *
+ *  returns:  the ids in the order they are added, NULL if out of memory
+ */
+static int *make_ids(const char *dist, int n, int space)
+{
+    int *ids = malloc(n * sizeof(int));
+    int *pool;
+    int nclusters = (space + BENCH_CLUSTER - 1) / BENCH_CLUSTER;
+
+    if (ids == NULL)
+        return NULL;
+
+    if (strcmp(dist, "sparse") == 0)
+    {
+        for (int i = 0; i < n; i++)
+            ids[i] = 1 + (int)((int64_t)i * space / n);
+        return ids;
+    }
+
+    // uniform picks from every id, clustered from the cluster numbers
+    if (strcmp(dist, "uniform") == 0)
+        nclusters = space;
+    pool = malloc(nclusters * sizeof(int));
+    if (pool == NULL)
+    {
+        free(ids);
+        return NULL;
+    }
+    for (int i = 0; i < nclusters; i++)
+        pool[i] = i;
+    shuffle(pool, nclusters);
+
+    if (nclusters == space)
+    {
+        for (int i = 0; i < n; i++)
+            ids[i] = pool[i] + 1;
+    }
+    else
+    {
+        // the last cluster may be cut short by the end of the space
+        for (int c = 0, i = 0; i < n; c++)
+        {
+            for (int k = 1; k <= BENCH_CLUSTER && i < n; k++)
+            {
+                if (pool[c] * BENCH_CLUSTER + k <= space)
+                    ids[i++] = pool[c] * BENCH_CLUSTER + k;
+            }
+        }
+    }
+    free(pool);
+    return ids;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  report_op
+ *      dist, n:   the dataset
+ *      op:        the operation
+ *      lat:       latency of each run in microseconds, sorted in place
+ *      nops:      number of runs
+ *      syscalls:  io_syscalls() made by all of them
+ *
+ *  Prints the CSV line of the operation, see sdbbench.
+ */
+static void report_op(const char *dist, int n, const char *op, double *lat,
+                      int nops, long syscalls)
+{
+    char key[64];
+    double total = 0;
+    double ops_per_s;
+
+    for (int i = 0; i < nops; i++)
+        total += lat[i];
+    qsort(lat, nops, sizeof(double), cmp_double);
+    ops_per_s = total > 0 ? nops / (total / 1e6) : 0;
+
+    snprintf(key, sizeof(key), "%s,%d,%s", dist, n, op);
+    fprintf(report, "%s,%d,%.6f,%.0f,%.2f,%.2f,%ld", key, nops, total / 1e6,
+            ops_per_s, lat[nops / 2], lat[(int)((nops - 1) * 0.99)], syscalls);
+
+    if (nbaseline > 0)
+    {
+        int i = 0;
+
+        while (i < nbaseline && strcmp(baseline[i].key, key) != 0)
+            i++;
+        if (i < nbaseline && baseline[i].ops_per_s > 0)
+            fprintf(report, ",%.0f,%+.1f", baseline[i].ops_per_s,
+                    (ops_per_s / baseline[i].ops_per_s - 1) * 100);
+        else
+            fprintf(report, ",,");
+    }
+    fprintf(report, "\n");
+}
+
+// runs the write-ahead log batch of one operation, like sdbsc does per process
+static void commit_op(int fd)
+{
+    if (use_wal)
+        commit_wal(fd);
+}
+
+/*
+ *  bench_dataset
+ *      dist:   "uniform", "clustered" or "sparse"
+ *      n:      number of students
+ *      space:  ids are taken from 1 to space
+ *      paged:  convert the database to the paged layout first (-P)
+ *
+ *  Builds the dataset in an empty database and times every operation on
+ *  it, see sdbbench.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int bench_dataset(const char *dist, int n, int space, bool paged)
+{
+    int *ids = make_ids(dist, n, space);
+    double *lat = malloc((n > BENCH_COUNT_REPS ? n : BENCH_COUNT_REPS) * sizeof(double));
+    student_t s;
+    long sys;
+    int fd;
+
+    if (ids == NULL || lat == NULL || (fd = open_db(DB_FILE, true)) < 0)
+    {
+        free(ids);
+        free(lat);
+        return ERR_DB_FILE;
+    }
+    if (paged && (fd = convert_db(fd)) < 0)
+    {
+        free(ids);
+        free(lat);
+        return ERR_DB_FILE;
+    }
+
+    sys = io_syscalls();
+    for (int i = 0; i < n; i++)
+    {
+        double t = now_us();
+        char fname[24];
+
+        snprintf(fname, sizeof(fname), "first%d", ids[i]);
+        add_student(fd, ids[i], fname, "benchmark", (int)(rng_next() % (MAX_STD_GPA + 1)));
+        commit_op(fd);
+        lat[i] = now_us() - t;
+    }
+    report_op(dist, n, "add", lat, n, io_syscalls() - sys);
+
+    // lookups in an order unrelated to the adds
+    shuffle(ids, n);
+    sys = io_syscalls();
+    for (int i = 0; i < n; i++)
+    {
+        double t = now_us();
+
+        get_student(fd, ids[i], &s);
+        lat[i] = now_us() - t;
+    }
+    report_op(dist, n, "get", lat, n, io_syscalls() - sys);
+
+    sys = io_syscalls();
+    for (int i = 0; i < BENCH_COUNT_REPS; i++)
+    {
+        double t = now_us();
+
+        count_db_records(fd);
+        lat[i] = now_us() - t;
+    }
+    report_op(dist, n, "count", lat, BENCH_COUNT_REPS, io_syscalls() - sys);
+
+    sys = io_syscalls();
+    for (int i = 0; i < BENCH_PRINT_REPS; i++)
+    {
+        double t = now_us();
+
+        print_db(fd);
+        fflush(stdout);
+        lat[i] = now_us() - t;
+    }
+    report_op(dist, n, "print", lat, BENCH_PRINT_REPS, io_syscalls() - sys);
+
+    // half of the students, so compress has holes to remove
+    sys = io_syscalls();
+    for (int i = 0; i < n / 2; i++)
+    {
+        double t = now_us();
+
+        del_student(fd, ids[i]);
+        commit_op(fd);
+        lat[i] = now_us() - t;
+    }
+    report_op(dist, n, "del", lat, n / 2, io_syscalls() - sys);
+
+    sys = io_syscalls();
+    lat[0] = now_us();
+    fd = compress_db(fd);
+    lat[0] = now_us() - lat[0];
+    report_op(dist, n, "compress", lat, 1, io_syscalls() - sys);
+
+    if (fd >= 0)
+        close_db(fd);
+    free(ids);
+    free(lat);
+    return fd < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+// keeps dist,records,op and ops_per_s of every line of an earlier report
+static int load_baseline(const char *path)
+{
+    char line[256];
+    FILE *in = fopen(path, "r");
+
+    if (in == NULL)
+        return ERR_DB_FILE;
+
+    while (fgets(line, sizeof(line), in) != NULL && nbaseline < BENCH_MAX_LINES)
+    {
+        char dist[16], op[16];
+        int n, nops;
+        double seconds, ops_per_s;
+
+        if (sscanf(line, "%15[^,],%d,%15[^,],%d,%lf,%lf", dist, &n, op, &nops,
+                   &seconds, &ops_per_s) != 6)
+            continue;
+        snprintf(baseline[nbaseline].key, sizeof(baseline[nbaseline].key),
+                 "%s,%d,%s", dist, n, op);
+        baseline[nbaseline++].ops_per_s = ops_per_s;
+    }
+    fclose(in);
+    return NO_ERROR;
+}
+
+static void bench_usage(char *exename)
+{
+    printf("usage: %s [-m] [-w] [-j threads] [-P] [-d dist] [-n records] [-b baseline.csv]\n", exename);
+    printf("\t-m:  use the memory-mapped backend\n");
+    printf("\t-w:  log adds and deletes to %s, one sync per operation\n", DB_WAL_FILE);
+    printf("\t-j threads:  scan with this many threads\n");
+    printf("\t-P:  use the paged layout, ids spread over 16 times the records\n");
+    printf("\t-d dist:  only the uniform, clustered or sparse dataset\n");
+    printf("\t-n records:  only this many students (at most %d unless -P)\n", MAX_STD_ID);
+    printf("\t-b baseline.csv:  compare with the report of an earlier run\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/sdbbench.XXXXXX";
+    const char *only_dist = NULL;
+    int only_n = 0;
+    bool paged = false;
+    int exit_code = EXIT_OK;
+    int opt, null_fd;
+
+    while ((opt = getopt(argc, argv, "mwj:Pd:n:b:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            enable_mmap(true);
+            break;
+        case 'w':
+            enable_wal(true);
+            use_wal = true;
+            break;
+        case 'j':
+            if (set_scan_threads(atoi(optarg)) != NO_ERROR)
+            {
+                bench_usage(argv[0]);
+                exit(EXIT_FAIL_ARGS);
+            }
+            break;
+        case 'P':
+            paged = true;
+            break;
+        case 'd':
+            only_dist = optarg;
+            break;
+        case 'n':
+            only_n = atoi(optarg);
+            break;
+        case 'b':
+            if (load_baseline(optarg) != NO_ERROR)
+            {
+                printf("Error opening baseline %s, exiting!\n", optarg);
+                exit(EXIT_FAIL_ARGS);
+            }
+            break;
+        case 'h':
+            bench_usage(argv[0]);
+            exit(EXIT_OK);
+        default:
+            bench_usage(argv[0]);
+            exit(EXIT_FAIL_ARGS);
+        }
+    }
+
+    if (optind != argc || only_n < 0 ||
+        only_n > (paged ? DB_PAGED_MAX_ID / 16 : MAX_STD_ID))
+    {
+        bench_usage(argv[0]);
+        exit(EXIT_FAIL_ARGS);
+    }
+
+    // the report keeps the original stdout, the operations print to
+    // /dev/null in a directory of their own
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    null_fd = open("/dev/null", O_WRONLY);
+    if (report == NULL || null_fd == -1 || mkdtemp(dir) == NULL || chdir(dir) == -1)
+    {
+        printf("Error setting up the benchmark, exiting!\n");
+        exit(EXIT_FAIL_DB);
+    }
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    fprintf(report, "dist,records,op,ops,seconds,ops_per_s,p50_us,p99_us,io_syscalls%s\n",
+            nbaseline > 0 ? ",baseline_ops_per_s,change_pct" : "");
+
+    for (size_t d = 0; d < sizeof(bench_dists) / sizeof(bench_dists[0]); d++)
+    {
+        if (only_dist != NULL && strcmp(only_dist, bench_dists[d]) != 0)
+            continue;
+
+        for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+        {
+            int n = only_n > 0 ? only_n : bench_sizes[i];
+            int space = paged ? n * 16 : MAX_STD_ID;
+
+            // every dataset starts from the same seed
+            rng_state = BENCH_SEED;
+            if (bench_dataset(bench_dists[d], n, space, paged) != NO_ERROR)
+            {
+                fprintf(report, "Error running %s with %d records, exiting!\n", bench_dists[d], n);
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+            fflush(report);
+            if (only_n > 0)
+                break;
+        }
+    }
+
+    // leave nothing behind in /tmp
+    unlink(DB_FILE);
+    unlink(TMP_DB_FILE);
+    unlink(DB_MAP_FILE);
+    unlink(DB_IDX_FILE);
+    unlink(DB_WAL_FILE);
+    unlink(DB_NAME_FILE);
+    unlink(DB_GPA_FILE);
+    unlink(DB_COLS_FILE);
+    if (chdir("/") == 0)
+        rmdir(dir);
+
+    fclose(report);
+    exit(exit_code);
+}
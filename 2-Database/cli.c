@@ -0,0 +1,1276 @@
+#define _GNU_SOURCE     //getline() and other Linux extensions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h> //Unix domain sockets for -S and -u
+#include <sys/un.h>
+#include <time.h>   //clock_gettime() for -r -T
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  run_request
+ *      fd:   pointer to the linux file descriptor of the database, updated
+ *            by the operations that reopen it (-x and -z)
+ *      req:  the operation and its arguments, see parse_request()
+ *
+ *  Runs one add/count/delete/export/find/name/gpa/top/stats/print/
+ *  compress/reclaim/convert/zero operation.  main()
+ *  calls this for the command line and serve_db() for every request a
+ *  client sends, so both print exactly the same output.  With SDB_STATS
+ *  the operation is measured, see Operation statistics in sdbsc.c.
+ *
+ *  returns:  the exit code for the shell, see EXIT_* in sdbsc.h
+ *
+ *  console:  whatever the operation prints, see the functions above
+ *            M_ERR_SRV_REQ  req->op is not a known operation
+ */
+int run_request(int *fd, sdb_request_t *req)
+{
+    student_t student = {0};
+    student_t *s = &req->student;
+    int exit_code = EXIT_OK;
+    int rc;
+
+    stats_begin();
+    switch (req->op)
+    {
+    case 'a':
+        exit_code = validate_range(s->id, s->gpa);
+        if (exit_code == EXIT_FAIL_ARGS)
+        {
+            printf(M_ERR_STD_RNG);
+            break;
+        }
+
+        // the names may fill the request fields, add_student() copies at
+        // most sizeof - 1 characters of them
+        s->fname[sizeof(s->fname) - 1] = '\0';
+        s->lname[sizeof(s->lname) - 1] = '\0';
+        rc = add_student(*fd, s->id, s->fname, s->lname, s->gpa);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'c':
+        rc = count_db_records(*fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'd':
+        rc = del_student(*fd, s->id);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'e':
+        // the format name is carried in fname
+        s->fname[sizeof(s->fname) - 1] = '\0';
+        rc = export_db(*fd, s->fname);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'f':
+        rc = get_student(*fd, s->id, &student);
+
+        switch (rc)
+        {
+        case NO_ERROR:
+            print_student(&student);
+            break;
+        case SRCH_NOT_FOUND:
+            printf(M_STD_NOT_FND_MSG, s->id);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        default:
+            printf(M_ERR_DB_READ);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        break;
+
+    case 'g':
+        // the range is carried in id (min) and gpa (max)
+        if (s->id < MIN_STD_GPA || s->gpa > MAX_STD_GPA || s->id > s->gpa)
+        {
+            printf(M_ERR_GPA_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_gpa_range(*fd, s->id, s->gpa);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 's':
+        rc = stats_db(*fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 't':
+        if (s->id < 1)
+        {
+            printf(M_ERR_GPA_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_top_gpa(*fd, s->id);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'n':
+        s->fname[sizeof(s->fname) - 1] = '\0';
+        s->lname[sizeof(s->lname) - 1] = '\0';
+        rc = find_by_name(*fd, s->lname, s->fname);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'p':
+        rc = print_db(*fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'x':
+        // compress_db returns the fd of the compressed database, the old one
+        // is closed either way
+        *fd = compress_db(*fd);
+        if (*fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'P':
+        // like compress_db, convert_db returns the fd of the new file
+        *fd = convert_db(*fd);
+        if (*fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'X':
+        rc = reclaim_db(*fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'z':
+        // close the db file and reopen it indicating truncate=true
+        close_db(*fd);
+        *fd = open_db(DB_FILE, true);
+        if (*fd < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_DB_ZERO_OK);
+        break;
+
+    default:
+        printf(M_ERR_SRV_REQ, req->op);
+        exit_code = EXIT_FAIL_ARGS;
+    }
+    stats_end(req->op);
+
+    return exit_code;
+}
+
+/*
+ *  Server mode
+ *
+ *  sdbsc -S path keeps the database open (and with -m mapped) in one
+ *  long-lived process and serves requests from sdbsc -u path clients over
+ *  a Unix domain socket, so a lookup costs a round trip instead of a
+ *  process start, open_db() and header/bitmap load.  Each request is a
+ *  fixed size sdb_request_t and is answered with an sdb_reply_t followed by
+ *  the console output of the operation, see sdbsc.h.  A connection may carry
+ *  any number of requests.
+ *
+ *  Requests are served one at a time from a poll() loop, so they never run
+ *  concurrently and need no locking.  Clients are read without blocking:
+ *  a request that arrives in pieces is kept per connection until it is
+ *  whole, so a client that stalls part way never holds up the others or
+ *  the compaction below.  The output is captured by pointing
+ *  stdout at a memory stream for the duration of run_request().  The
+ *  replies to all requests that arrived in one round of the loop are held
+ *  back until the round is committed to the write-ahead log, so with -w the
+ *  adds and deletes of concurrent clients share one sync.  SIGINT and
+ *  SIGTERM stop the server, which then removes its socket.
+ *
+ *  While no request is waiting the server compacts a packed database a
+ *  step at a time, see Incremental compaction in sdbsc.c, so a request
+ *  waits for at most one step of COMPACT_STEP_US.
+ */
+#define SRV_MAX_CLIENTS     64      // connections served at the same time
+
+typedef struct srv_reply{
+    sdb_reply_t reply;
+    char *text;                 // console output of the request
+} srv_reply_t;
+
+typedef struct srv_client{
+    sdb_request_t req;          // request being received
+    size_t got;                 // bytes of it received so far
+} srv_client_t;
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_signal(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+/*
+ *  read_full / write_full
+ *      fd:    socket
+ *      buf:   data
+ *      len:   number of bytes to transfer
+ *
+ *  Transfer exactly len bytes, retrying short reads and writes.
+ *
+ *  returns:  1      all len bytes were transferred
+ *            0      read_full() only, the peer closed before sending any
+ *            -1     error, or the peer closed part way
+ */
+static int read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len)
+    {
+        n = read(fd, (char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return (n == 0 && done == 0) ? 0 : -1;
+        done += n;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len)
+    {
+        n = write(fd, (const char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        done += n;
+    }
+    return 1;
+}
+
+/*
+ *  server_address
+ *      path:  file system path of the socket
+ *      addr:  filled in with the address of path
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_OP if path is too long
+ */
+static int server_address(char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return ERR_DB_OP;
+    strcpy(addr->sun_path, path);
+    return NO_ERROR;
+}
+
+/*
+ *  open_server_socket
+ *      path:  file system path of the socket
+ *
+ *  Binds and listens on path.  A socket file left behind by a server that
+ *  is no longer running is replaced, a live one is not.
+ *
+ *  returns:  the listening socket, or ERR_DB_FILE on failure
+ *
+ *  console:  M_ERR_SRV_RUNNING  another server answers on path
+ *            M_ERR_SRV_SOCKET   the socket could not be created
+ */
+static int open_server_socket(char *path)
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    if (server_address(path, &addr) != NO_ERROR ||
+        (sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        printf(M_ERR_SRV_SOCKET, path);
+        return ERR_DB_FILE;
+    }
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        close(sock);
+        printf(M_ERR_SRV_RUNNING, path);
+        return ERR_DB_FILE;
+    }
+    close(sock);
+    unlink(path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1 ||
+        bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(sock, SOMAXCONN) == -1)
+    {
+        if (sock != -1)
+            close(sock);
+        printf(M_ERR_SRV_SOCKET, path);
+        return ERR_DB_FILE;
+    }
+    return sock;
+}
+
+/*
+ *  serve_request
+ *      fd:      pointer to the database fd, see run_request()
+ *      client:  connected client socket
+ *      in:      the part of a request received from client so far
+ *      out:     where the reply and the output it carries are kept
+ *
+ *  Reads what client has sent of its next request, without waiting for
+ *  more, and runs the request once it is whole.  The reply is only sent by
+ *  send_reply() once the round of requests it belongs to is committed, see
+ *  serve_db().
+ *
+ *  returns:  1      request served, *out holds the reply
+ *            2      the request is not complete yet, nothing to reply
+ *            0      client closed the connection
+ *            -1     client error, the connection should be dropped
+ */
+static int serve_request(int *fd, int client, srv_client_t *in, srv_reply_t *out)
+{
+    FILE *console = stdout;
+    size_t len = 0;
+    ssize_t n;
+
+    out->text = NULL;
+    n = recv(client, (char *)&in->req + in->got, sizeof(in->req) - in->got, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 2;
+    if (n <= 0)
+        return (n == 0 && in->got == 0) ? 0 : -1;
+
+    in->got += n;
+    if (in->got < sizeof(in->req))
+        return 2;
+    in->got = 0;
+
+    fflush(stdout);
+    stdout = open_memstream(&out->text, &len);
+    if (stdout == NULL)
+    {
+        stdout = console;
+        return -1;
+    }
+    out->reply.exit_code = run_request(fd, &in->req);
+    fclose(stdout);
+    stdout = console;
+
+    out->reply.len = len;
+    return 1;
+}
+
+/*
+ *  fail_reply
+ *      out:  a reply that has not been sent yet
+ *
+ *  Turns out into an M_ERR_DB_WRITE failure, for a round whose write-ahead
+ *  log batch could not be committed.
+ */
+static void fail_reply(srv_reply_t *out)
+{
+    size_t len = strlen(M_ERR_DB_WRITE);
+    char *text = realloc(out->text, out->reply.len + len);
+
+    out->reply.exit_code = EXIT_FAIL_DB;
+    if (text == NULL)
+        return;
+    memcpy(text + out->reply.len, M_ERR_DB_WRITE, len);
+    out->text = text;
+    out->reply.len += len;
+}
+
+/*
+ *  send_reply
+ *      client:  connected client socket
+ *      out:     reply filled in by serve_request(), freed here
+ *
+ *  returns:  1 if the reply was sent, -1 if the connection should be dropped
+ */
+static int send_reply(int client, srv_reply_t *out)
+{
+    int rc = write_full(client, &out->reply, sizeof(out->reply));
+
+    if (rc > 0 && out->reply.len > 0)
+        rc = write_full(client, out->text, out->reply.len);
+    free(out->text);
+    out->text = NULL;
+    return rc;
+}
+
+/*
+ *  serve_db
+ *      fd:    pointer to the linux file descriptor of the open database
+ *      path:  file system path of the socket to listen on
+ *
+ *  Serves requests on path until SIGINT or SIGTERM, see Server mode above.
+ *  If an operation leaves the database closed (a failed -x or -z) it is
+ *  reopened before the next request.
+ *
+ *  returns:  EXIT_OK        the server was stopped by a signal
+ *            EXIT_FAIL_DB   the socket or the database could not be opened
+ *
+ *  console:  M_SRV_STARTED and M_SRV_STOPPED, or the errors of
+ *            open_server_socket() and open_db()
+ */
+int serve_db(int *fd, char *path)
+{
+    struct pollfd pfd[1 + SRV_MAX_CLIENTS];
+    srv_reply_t replies[1 + SRV_MAX_CLIENTS];
+    srv_client_t clients[1 + SRV_MAX_CLIENTS];
+    int served[1 + SRV_MAX_CLIENTS];
+    bool committed;
+    bool idle_work = true;      // compact_db() may have something to do
+    struct sigaction sa;
+    int nfds = 1;
+    int nready;
+    int exit_code = EXIT_OK;
+    int client;
+
+    pfd[0].fd = open_server_socket(path);
+    if (pfd[0].fd < 0)
+        return EXIT_FAIL_DB;
+    pfd[0].events = POLLIN;
+
+    // no SA_RESTART, poll() has to return so the loop sees server_stop
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf(M_SRV_STARTED, path);
+    fflush(stdout);
+
+    while (!server_stop)
+    {
+        nready = poll(pfd, nfds, idle_work ? 0 : -1);
+        if (nready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (nready == 0)
+        {
+            idle_work = *fd >= 0 && compact_db(*fd, COMPACT_STEP_US) > 0;
+            continue;
+        }
+        idle_work = true;
+
+        if (pfd[0].revents & POLLIN)
+        {
+            client = accept(pfd[0].fd, NULL, NULL);
+            if (client >= 0 && nfds <= SRV_MAX_CLIENTS)
+            {
+                pfd[nfds].fd = client;
+                pfd[nfds].events = POLLIN;
+                pfd[nfds].revents = 0;
+                clients[nfds].got = 0;
+                nfds++;
+            }
+            else if (client >= 0)
+            {
+                close(client);
+            }
+        }
+
+        for (int i = 1; i < nfds; i++)
+        {
+            served[i] = 0;
+            if (pfd[i].revents != 0)
+                served[i] = serve_request(fd, pfd[i].fd, &clients[i], &replies[i]);
+        }
+
+        // the whole round is one batch of the write-ahead log, nobody hears
+        // about an add or delete before it is durable
+        committed = *fd < 0 || commit_wal(*fd) == NO_ERROR;
+
+        // walk backwards so a closed connection can be replaced by the last
+        // one, which has already been handled
+        for (int i = nfds - 1; i >= 1; i--)
+        {
+            if (pfd[i].revents == 0 || served[i] == 2)
+                continue;
+            if (served[i] > 0 && !committed)
+                fail_reply(&replies[i]);
+            if (served[i] <= 0 || send_reply(pfd[i].fd, &replies[i]) <= 0)
+            {
+                close(pfd[i].fd);
+                nfds--;
+                pfd[i] = pfd[nfds];
+                clients[i] = clients[nfds];
+            }
+        }
+
+        if (*fd < 0 && (*fd = open_db(DB_FILE, false)) < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+    }
+
+    for (int i = 0; i < nfds; i++)
+        close(pfd[i].fd);
+    unlink(path);
+
+    printf(M_SRV_STOPPED, path);
+    return exit_code;
+}
+
+/*
+ *  send_request
+ *      path:  file system path of the server socket
+ *      req:   the operation to run, see parse_request()
+ *
+ *  Runs req in the server listening on path and copies its output to
+ *  stdout.
+ *
+ *  returns:  the exit code of the operation, or EXIT_FAIL_DB if the server
+ *            could not be reached
+ *
+ *  console:  the output of the operation
+ *            M_ERR_SRV_CONNECT  no server answers on path or it went away
+ */
+int send_request(char *path, sdb_request_t *req)
+{
+    struct sockaddr_un addr;
+    sdb_reply_t reply;
+    char buf[65536];
+    size_t chunk;
+    int sock;
+
+    sock = -1;
+    if (server_address(path, &addr) == NO_ERROR)
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        write_full(sock, req, sizeof(*req)) <= 0 ||
+        read_full(sock, &reply, sizeof(reply)) <= 0)
+    {
+        if (sock != -1)
+            close(sock);
+        printf(M_ERR_SRV_CONNECT, path);
+        return EXIT_FAIL_DB;
+    }
+
+    while (reply.len > 0)
+    {
+        chunk = reply.len < sizeof(buf) ? reply.len : sizeof(buf);
+        if (read_full(sock, buf, chunk) <= 0)
+        {
+            close(sock);
+            printf(M_ERR_SRV_CONNECT, path);
+            return EXIT_FAIL_DB;
+        }
+        fwrite(buf, 1, chunk, stdout);
+        reply.len -= chunk;
+    }
+
+    close(sock);
+    return reply.exit_code;
+}
+
+/*
+ *  parse_request
+ *      argc, argv:  the command line, with -m, -j and -u shifted off
+ *      req:         filled in with the operation
+ *
+ *  Turns the -a/-c/-d/-e/-f/-g/-n/-p/-s/-t/-x/-X/-P/-z command lines into a
+ *  request.  The ranges
+ *  of the values are checked when it runs, see run_request().
+ *
+ *  returns:  NO_ERROR on success, EXIT_FAIL_ARGS for an unknown option or a
+ *            wrong number of arguments
+ *
+ *  console:  This function does not produce any output
+ */
+static int parse_request(int argc, char *argv[], sdb_request_t *req)
+{
+    memset(req, 0, sizeof(*req));
+    req->op = argv[1][1];
+
+    switch (req->op)
+    {
+    case 'a':
+        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
+        // prog_name     -a      id  first_name last_name     gpa
+        //-------------------------------------------------------
+        // example:  prog_name -a 1 John Doe 341
+        if (argc != 6)
+            return EXIT_FAIL_ARGS;
+
+        // convert id and gpa to ints from argv.  For this assignment assume
+        // they are valid numbers
+        req->student.id = atoi(argv[2]);
+        req->student.gpa = atoi(argv[5]);
+        strncpy(req->student.fname, argv[3], sizeof(req->student.fname) - 1);
+        strncpy(req->student.lname, argv[4], sizeof(req->student.lname) - 1);
+        break;
+
+    case 'd':
+    case 'f':
+        //   arv[0]  arv[1]  arv[2]
+        // prog_name  -d|-f      id
+        //-------------------------
+        // example:  prog_name -d 100
+        if (argc != 3)
+            return EXIT_FAIL_ARGS;
+        req->student.id = atoi(argv[2]);
+        break;
+
+    case 'e':
+        //   arv[0] arv[1]  arv[2]
+        // prog_name     -e  format
+        //-------------------------
+        // example:  prog_name -e csv
+        if (argc != 3)
+            return EXIT_FAIL_ARGS;
+        strncpy(req->student.fname, argv[2], sizeof(req->student.fname) - 1);
+        break;
+
+    case 'g':
+        //   arv[0] arv[1]  arv[2]  arv[3]
+        // prog_name     -g     min     max
+        //---------------------------------
+        // example:  prog_name -g 300 350
+        if (argc != 4)
+            return EXIT_FAIL_ARGS;
+        req->student.id = atoi(argv[2]);
+        req->student.gpa = atoi(argv[3]);
+        break;
+
+    case 't':
+        //   arv[0] arv[1]  arv[2]
+        // prog_name     -t       k
+        //-------------------------
+        // example:  prog_name -t 100
+        if (argc != 3)
+            return EXIT_FAIL_ARGS;
+        req->student.id = atoi(argv[2]);
+        break;
+
+    case 'n':
+        //   arv[0] arv[1]     arv[2]      arv[3]
+        // prog_name     -n  last_name [first_name]
+        //-----------------------------------------
+        // example:  prog_name -n Doe John
+        if (argc != 3 && argc != 4)
+            return EXIT_FAIL_ARGS;
+        strncpy(req->student.lname, argv[2], sizeof(req->student.lname) - 1);
+        if (argc == 4)
+            strncpy(req->student.fname, argv[3], sizeof(req->student.fname) - 1);
+        break;
+
+    case 'c':
+    case 'p':
+    case 's':
+    case 'x':
+    case 'X':
+    case 'P':
+    case 'z':
+        //    arv[0] arv[1]
+        // prog_name     -c
+        //-----------------
+        // example:  prog_name -c
+        break;
+
+    default:
+        return EXIT_FAIL_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  Scripts
+ *
+ *  sdbsc -r script runs every operation of script against one open
+ *  database, so a sequence of operations pays for one process and one
+ *  open_db() instead of one per operation.  A script has one operation per
+ *  line, written like the sdbsc command line without the program name:
+ *
+ *      -a 1 john doe 345
+ *      -f 1
+ *      -b students.csv
+ *
+ *  Empty lines and lines starting with # are skipped, arguments holding
+ *  spaces can be put in double quotes.  Every operation prints what it
+ *  prints on its own, and the script exits with the exit code of the first
+ *  one that failed, after running the rest.  A line that is not a valid
+ *  operation fails like bad arguments would.  -h, -r, -S and the options
+ *  that must come first are not allowed in a script.
+ *
+ *  With -w the adds and deletes are committed to the log in batches of
+ *  SCRIPT_WAL_BATCH operations rather than one by one, and with -u every
+ *  operation is sent to the server instead.  -T adds a line per kind of
+ *  operation with its count and time, and a total.  Every
+ *  SCRIPT_COMPACT_OPS operations a packed database is compacted for up to
+ *  COMPACT_STEP_US, see Incremental compaction in sdbsc.c, which is not
+ *  part of the time of any operation.
+ */
+#define SCRIPT_MAX_ARGS     8
+#define SCRIPT_WAL_BATCH    1024
+#define SCRIPT_COMPACT_OPS  64
+
+typedef struct script_timing{
+    int count;
+    double ms;
+} script_timing_t;
+
+/*
+ *  script_args
+ *      line:  the line, modified in place
+ *      argv:  set to the arguments, argv[0] is left alone
+ *
+ *  returns:  the number of arguments plus one for argv[0], -1 if there are
+ *            more than SCRIPT_MAX_ARGS - 2 or a quote is not closed
+ */
+static int script_args(char *line, char *argv[SCRIPT_MAX_ARGS])
+{
+    char *p = line;
+    int argc = 1;
+
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        if (*p == '\0')
+            break;
+        if (argc == SCRIPT_MAX_ARGS - 1)
+            return -1;
+
+        if (*p == '"')
+        {
+            argv[argc++] = ++p;
+            p = strchr(p, '"');
+            if (p == NULL)
+                return -1;
+        }
+        else
+        {
+            argv[argc++] = p;
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                p++;
+        }
+        if (*p == '\0')
+            break;
+        *p++ = '\0';
+    }
+
+    argv[argc] = NULL;
+    return argc;
+}
+
+/*
+ *  load_exit_code
+ *      opt:  'b' or 'i'
+ *      rc:   what bulk_load() or import_db() returned
+ *
+ *  returns:  the exit code of -b or -i.  An -i file that import_db() does
+ *            not accept (ERR_DB_OP, an unknown format) is an argument
+ *            error like an unknown -e format
+ */
+static int load_exit_code(int opt, int rc)
+{
+    if (opt == 'i' && rc == ERR_DB_OP)
+        return EXIT_FAIL_ARGS;
+    return rc < 0 ? EXIT_FAIL_DB : EXIT_OK;
+}
+
+/*
+ *  script_op
+ *      fd:           pointer to the linux file descriptor of the database,
+ *                    unused with server_path
+ *      argc, argv:   the operation, argv[0] is the program name
+ *      server_path:  socket given with -u, or NULL
+ *
+ *  Runs one line of a script, see Scripts.
+ *
+ *  returns:  the exit code of the operation, see EXIT_* in sdbsc.h
+ */
+static int script_op(int *fd, int argc, char *argv[], char *server_path)
+{
+    sdb_request_t req;
+    char opt;
+    int rc;
+
+    if (argc < 2 || argv[1][0] != '-')
+        return EXIT_FAIL_ARGS;
+    opt = argv[1][1];
+
+    // -b and -i take a path and always run in this process
+    if (opt == 'b' || opt == 'i')
+    {
+        if (argc != (opt == 'i' ? 4 : 3))
+            return EXIT_FAIL_ARGS;
+        if (*fd < 0)
+            return EXIT_FAIL_DB;
+
+        stats_begin();
+        rc = opt == 'b' ? bulk_load(*fd, argv[2]) : import_db(*fd, argv[2], argv[3]);
+        stats_end(opt);
+        return load_exit_code(opt, rc);
+    }
+
+    if (parse_request(argc, argv, &req) != NO_ERROR)
+        return EXIT_FAIL_ARGS;
+
+    if (server_path != NULL)
+    {
+        // the server output is written straight to stdout
+        fflush(stdout);
+        return send_request(server_path, &req);
+    }
+    return run_request(fd, &req);
+}
+
+// milliseconds since start
+static double script_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ *  run_script
+ *      fd:           pointer to the linux file descriptor of the database,
+ *                    reopened if an operation closed it.  Unused with
+ *                    server_path
+ *      path:         the script, - for stdin
+ *      server_path:  socket given with -u, or NULL
+ *      timed:        true to print the timings (-T)
+ *
+ *  Runs every operation of the script, see Scripts.
+ *
+ *  returns:  the exit code of the first operation that failed, EXIT_OK if
+ *            none did
+ *
+ *  console:  the output of every operation
+ *            M_ERR_SCRIPT_OPEN   the script could not be opened
+ *            M_ERR_SCRIPT_LINE   a line is not a valid operation
+ *            M_ERR_DB_WRITE      a batch could not be committed to the log
+ *            M_SCRIPT_TIMING     the count and time of each kind of
+ *                                operation, with -T
+ *            M_SCRIPT_TOTAL      the count and time of all of them, with -T
+ */
+int run_script(int *fd, char *path, char *server_path, bool timed)
+{
+    script_timing_t timing[128] = {{0}};
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    int line_no = 0, batched = 0, nops = 0;
+    int exit_code = EXIT_OK;
+    struct timespec script_start;
+    double total_ms;
+
+    if (in == NULL)
+    {
+        printf(M_ERR_SCRIPT_OPEN, path);
+        return EXIT_FAIL_DB;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &script_start);
+    while (getline(&line, &cap, in) != -1)
+    {
+        char *argv[SCRIPT_MAX_ARGS] = { "sdbsc" };
+        struct timespec start;
+        int argc, rc;
+
+        line_no++;
+        if (line[strspn(line, " \t")] == '#')
+            continue;
+        argc = script_args(line, argv);
+        if (argc == 1)
+            continue;
+
+        if (argc < 2 || strchr("abcdefginpstxXPz", argv[1][1]) == NULL ||
+            argv[1][1] == '\0' || argv[1][2] != '\0')
+        {
+            printf(M_ERR_SCRIPT_LINE, line_no);
+            if (exit_code == EXIT_OK)
+                exit_code = EXIT_FAIL_ARGS;
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rc = script_op(fd, argc, argv, server_path);
+        if (rc == EXIT_FAIL_ARGS)
+            printf(M_ERR_SCRIPT_LINE, line_no);
+        if (exit_code == EXIT_OK)
+            exit_code = rc;
+
+        // -x and -z reopen the database and may have failed to
+        if (server_path == NULL && *fd < 0 && (*fd = open_db(DB_FILE, false)) < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+
+        if (server_path == NULL && ++batched == SCRIPT_WAL_BATCH)
+        {
+            batched = 0;
+            if (commit_wal(*fd) != NO_ERROR)
+            {
+                printf(M_ERR_DB_WRITE);
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+        }
+
+        timing[(unsigned char)argv[1][1]].count++;
+        timing[(unsigned char)argv[1][1]].ms += script_ms(&start);
+        nops++;
+
+        // the database keeps working, a failed step is left for the next
+        if (server_path == NULL && nops % SCRIPT_COMPACT_OPS == 0)
+            compact_db(*fd, COMPACT_STEP_US);
+    }
+    total_ms = script_ms(&script_start);
+
+    free(line);
+    if (in != stdin)
+        fclose(in);
+
+    if (timed)
+    {
+        for (int op = 0; op < 128; op++)
+        {
+            if (timing[op].count > 0)
+                printf(M_SCRIPT_TIMING, timing[op].count, op, timing[op].ms,
+                       timing[op].ms * 1e3 / timing[op].count);
+        }
+        printf(M_SCRIPT_TOTAL, nops, total_ms);
+    }
+
+    // the last batch is committed by main()
+    return exit_code;
+}
+
+/*
+ *  parse_ids
+ *      list:  the argument of -F, ids separated by commas
+ *      ids:   set to a malloc()ed array of the ids
+ *
+ *  returns:  the number of ids, -1 if list is not a list of numbers
+ *
+ *  console:  This function does not produce any output
+ */
+static int parse_ids(char *list, int **ids)
+{
+    int n = 1;
+    char *end;
+
+    for (char *p = list; *p != '\0'; p++)
+        n += *p == ',';
+
+    *ids = malloc(n * sizeof(int));
+    if (*ids == NULL)
+        return -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        long id = strtol(list, &end, 10);
+
+        if (end == list || (*end != ',' && *end != '\0') || id < 0 || id > DB_PAGED_MAX_ID)
+        {
+            free(*ids);
+            return -1;
+        }
+        (*ids)[i] = (int)id;
+        list = end + 1;
+    }
+    return n;
+}
+
+/*
+ *  usage
+ *      exename:  the name of the executable from argv[0]
+ *
+ *  Prints this programs expected usage
+ *
+ *  returns:    nothing, this is a void function
+ *
+ *  console:  This function prints the usage information
+ *
+ */
+void usage(char *exename)
+{
+    printf("usage: %s [-m] [-q] [-w] [-j threads] [-u socket] -[h|a|b|c|d|e|f|F|g|i|n|p|r|s|t|x|X|P|z|S] options.  Where:\n", exename);
+    printf("\t-m:  use the memory-mapped backend (must come first)\n");
+    printf("\t-q:  submit batches of reads and writes through io_uring (must come first)\n");
+    printf("\t-w:  log adds and deletes to %s, one sync per batch (must come first)\n", DB_WAL_FILE);
+    printf("\t-j threads:  scan with this many threads for -c, -p and -x (must come first)\n");
+    printf("\t-u socket:  send the operation to the server on socket (must come first)\n");
+    printf("\t-h:  prints help\n");
+    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-b file:  adds every student in a csv/tsv file, - for stdin\n");
+    printf("\t-c:  counts the records in the database\n");
+    printf("\t-d id:  deletes a student\n");
+    printf("\t-e format:  writes every student to stdout as csv, jsonl or bin\n");
+    printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-F id,id,...:  finds and prints all those students at once\n");
+    printf("\t-g min max:  prints the students with a gpa from min to max (as 3 digit ints)\n");
+    printf("\t-i format file:  adds every student in a file written by -e, - for stdin\n");
+    printf("\t-n last_name [first_name]:  finds and prints the students with that name\n");
+    printf("\t-p:  prints all records in the student database\n");
+    printf("\t-r script [-T]:  runs every operation in script, - for stdin, -T prints timings\n");
+    printf("\t-s:  prints the number of students and gpa statistics\n");
+    printf("\t-t k:  prints the k students with the highest gpa\n");
+    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-X:  free the storage of empty pages in place\n");
+    printf("\t-P:  convert the database to the paged layout (ids up to %d)\n", DB_PAGED_MAX_ID);
+    printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-S socket:  serve the database to -u clients on socket until stopped\n");
+}
+
+// Welcome to main()
+int main(int argc, char *argv[])
+{
+    char opt;      // user selected option
+    int fd;        // file descriptor of database files
+    int rc;        // return code from various operations
+    int exit_code; // exit code to shell
+    char *server_path = NULL;  // socket given with -u
+    sdb_request_t req;         // the operation, see parse_request()
+
+    // This function must have at least one arg, and the arg must start
+    // with a dash
+    if ((argc < 2) || (*argv[1] != '-'))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // SDB_STATS=1 measures every operation and prints them all on exit
+    if (getenv("SDB_STATS") != NULL && strcmp(getenv("SDB_STATS"), "1") == 0)
+    {
+        enable_stats(true);
+        atexit(print_stats_line);
+    }
+
+    // SDB_COMPACT=ratio sets the share of tombstones at which -S and -r
+    // start compacting a packed database, 0 turns it off
+    if (getenv("SDB_COMPACT") != NULL)
+        set_compact_ratio(atof(getenv("SDB_COMPACT")));
+
+    // SDB_CACHE=KiB caches that much of the database in memory for lookups
+    if (getenv("SDB_CACHE") != NULL &&
+        set_page_cache((size_t)atol(getenv("SDB_CACHE")) * 1024) != NO_ERROR)
+    {
+        printf(M_ERR_DB_OPEN);
+        exit(EXIT_FAIL_DB);
+    }
+
+    // -m selects the memory-mapped backend, -q io_uring, -w the write-ahead
+    // log and -j N the number of scan threads for the operation that follows
+    // them, -u path sends it to the server listening on path instead, shift
+    // them off so the rest of main sees the usual argument layout
+    while (strcmp(argv[1], "-m") == 0 || strcmp(argv[1], "-j") == 0 ||
+           strcmp(argv[1], "-w") == 0 || strcmp(argv[1], "-u") == 0 ||
+           strcmp(argv[1], "-q") == 0)
+    {
+        int shift = 1;
+
+        if (argv[1][1] == 'm')
+        {
+            enable_mmap(true);
+        }
+        else if (argv[1][1] == 'q')
+        {
+            enable_uring(true);
+        }
+        else if (argv[1][1] == 'w')
+        {
+            enable_wal(true);
+        }
+        else if (argv[1][1] == 'u')
+        {
+            if (argc < 3)
+            {
+                usage(argv[0]);
+                exit(EXIT_FAIL_ARGS);
+            }
+            server_path = argv[2];
+            shift = 2;
+        }
+        else
+        {
+            if (argc < 3 || set_scan_threads(atoi(argv[2])) != NO_ERROR)
+            {
+                usage(argv[0]);
+                exit(EXIT_FAIL_ARGS);
+            }
+            shift = 2;
+        }
+
+        argv[shift] = argv[0];
+        argv += shift;
+        argc -= shift;
+        if ((argc < 2) || (*argv[1] != '-'))
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    // The option is the first character after the dash for example
+    //-h -a -b -c -d -e -f -F -g -i -n -p -r -s -t -x -X -P -z
+    opt = (char)*(argv[1] + 1); // get the option flag
+
+    // handle the help flag and then exit normally
+    if (opt == 'h')
+    {
+        usage(argv[0]);
+        exit(EXIT_OK);
+    }
+
+    // -b, -i and -S take a path and -F a list of ids, they always run in
+    // this process, everything else is described by a request that is
+    // either run here or, with -u, sent to a server
+    if (opt == 'b' || opt == 'i' || opt == 'S' || opt == 'F')
+    {
+        //   arv[0] arv[1]  arv[2] arv[3]
+        // prog_name     -b    file
+        // prog_name     -i  format   file
+        // prog_name     -F     ids
+        //--------------------------------
+        // example:  prog_name -b students.csv
+        //           prog_name -i jsonl students.jsonl
+        //           prog_name -S /tmp/sdbsc.sock
+        //           prog_name -F 1,5,42
+        if (argc != (opt == 'i' ? 4 : 3) || server_path != NULL)
+        {
+            usage(argv[0]);
+            exit(EXIT_FAIL_ARGS);
+        }
+    }
+    else if (opt == 'r')
+    {
+        //   arv[0] arv[1]  arv[2] arv[3]
+        // prog_name     -r  script    -T
+        //-------------------------------
+        // example:  prog_name -r ops.txt
+        //           prog_name -r - -T
+        if (argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "-T") != 0))
+        {
+            usage(argv[0]);
+            exit(EXIT_FAIL_ARGS);
+        }
+        if (server_path != NULL)
+            exit(run_script(NULL, argv[2], server_path, argc == 4));
+    }
+    else if (parse_request(argc, argv, &req) != NO_ERROR)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAIL_ARGS);
+    }
+    else if (server_path != NULL)
+    {
+        exit(send_request(server_path, &req));
+    }
+
+    // now lets open the file and continue if there is no error
+    // note we are not truncating the file using the second
+    // parameter
+    fd = open_db(DB_FILE, false);
+    if (fd < 0)
+    {
+        exit(EXIT_FAIL_DB);
+    }
+
+    // set rc to the return code of the operation to ensure the program
+    // use that to determine the proper exit_code.  Look at the header
+    // sdbsc.h for expected values.
+
+    exit_code = EXIT_OK;
+    switch (opt)
+    {
+    case 'b':
+    case 'i':
+        stats_begin();
+        rc = opt == 'b' ? bulk_load(fd, argv[2]) : import_db(fd, argv[2], argv[3]);
+        stats_end(opt);
+        exit_code = load_exit_code(opt, rc);
+        break;
+
+    case 'F':
+    {
+        int *ids;
+        int n = parse_ids(argv[2], &ids);
+
+        if (n < 0)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        stats_begin();
+        rc = find_students(fd, ids, n);
+        stats_end(opt);
+        free(ids);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+    }
+
+    case 'r':
+        exit_code = run_script(&fd, argv[2], NULL, argc == 4);
+        break;
+
+    case 'S':
+        exit_code = serve_db(&fd, argv[2]);
+        break;
+
+    default:
+        exit_code = run_request(&fd, &req);
+    }
+
+    // the whole operation is one batch of the write-ahead log
+    if (fd >= 0 && commit_wal(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        exit_code = EXIT_FAIL_DB;
+    }
+
+    // dont forget to close the file before exiting, and setting the
+    // proper exit code - see the header file for expected values
+    if (fd >= 0)
+        close_db(fd);
+    exit(exit_code);
+}
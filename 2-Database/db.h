@@ -31,5 +31,203 @@ static const int DELETED_STUDENT_ID = 0;
 
 #define DB_FILE     "student.db"            //name of database file
 #define TMP_DB_FILE ".tmp_student.db"       //for extra credit
+#define DB_MAP_FILE "student.db.map"        //occupancy bitmap, see below
+#define DB_IDX_FILE "student.db.idx"        //id to slot index, see below
+#define DB_WAL_FILE "student.db.wal"        //write-ahead log, see below
+#define DB_NAME_FILE "student.db.names"     //last name index, see below
+#define DB_GPA_FILE "student.db.gpa"        //gpa index, see below
+#define DB_COLS_FILE "student.db.cols"      //id and gpa columns, see below
+
+// Database header.  Slot 0 can never hold a student because ids start at
+// MIN_STD_ID, so it is used to describe the file instead.  Notes:
+//  1. zero is always 0 so that slot 0 still reads as an empty record for any
+//     code that simply walks the file looking for non-zero ids
+//  2. layout tells how records are placed.  DB_LAYOUT_FLAT files keep every
+//     student at id * STUDENT_RECORD_SIZE, DB_LAYOUT_PACKED files were
+//     written by compress_db() and hold the live records back to back
+//     starting at slot 1, with students added later appended at the end.
+//     DB_IDX_FILE maps their ids to slots.  DB_LAYOUT_PAGED files are
+//     described below
+//  3. generation must match the one stored in DB_MAP_FILE (and for packed
+//     files DB_IDX_FILE), otherwise they are stale and get rebuilt from the
+//     records.  Paged files use neither
+//  4. tombstones counts the slots of a packed file that were emptied by a
+//     delete and not yet compacted away, see compact_db().  Flat and paged
+//     files keep it at 0
+//  5. changes goes up with every write of the header, so a process caching
+//     records can tell when another one changed the database
+//  6. like student_t the header is exactly 64 bytes
+typedef struct db_header{
+    int zero;
+    char magic[8];
+    int version;
+    int layout;
+    int record_count;
+    unsigned int generation;
+    int tombstones;
+    unsigned int changes;
+    char reserved[28];
+} db_header_t;
+
+#define DB_HDR_MAGIC        "SDBHDR1"
+#define DB_HDR_VERSION      1
+#define DB_LAYOUT_FLAT      0
+#define DB_LAYOUT_PACKED    1
+#define DB_LAYOUT_PAGED     2
+
+// DB_LAYOUT_PAGED files lift the MAX_STD_ID limit to DB_PAGED_MAX_ID without
+// a file of DB_PAGED_MAX_ID slots.  The file is made of DB_PAGE_SIZE pages:
+//  1. page 0 holds the header in slot 0, the rest of it is unused
+//  2. pages 1 to DB_ROOT_PAGES hold the root directory, which maps
+//     (id / DB_PAGE_RECS) / DB_DIR_FANOUT to the page number of a directory
+//     page
+//  3. a directory page maps (id / DB_PAGE_RECS) % DB_DIR_FANOUT to the page
+//     number of a data page
+//  4. a data page holds the DB_PAGE_RECS students with ids from
+//     n * DB_PAGE_RECS to n * DB_PAGE_RECS + DB_PAGE_RECS - 1, each in slot
+//     id % DB_PAGE_RECS
+// Directory and data pages are appended to the file when first needed, page
+// number 0 means not allocated yet.  Page numbers are stored as unsigned
+// ints, DB_DIR_SLOTS of them in the last 60 bytes of every 64 byte entry of
+// a directory page, so that like the header every directory entry still
+// reads as an empty record to code that walks the file.
+#define DB_PAGED_MAX_ID     2147483647
+#define DB_PAGE_SIZE        4096
+#define DB_PAGE_RECS        64
+#define DB_DIR_SLOTS        15
+#define DB_DIR_FANOUT       (DB_PAGE_RECS * DB_DIR_SLOTS)
+#define DB_ROOT_PAGES       37      // DB_PAGED_MAX_ID / DB_PAGE_RECS / DB_DIR_FANOUT / DB_DIR_FANOUT, rounded up
+
+// DB_MAP_FILE holds one bit per possible student id (bit id is set if the
+// student is in the database), 12.5 KB for MAX_STD_ID, behind a small
+// preamble carrying the generation of the header it belongs to.
+typedef struct db_map_hdr{
+    char magic[8];
+    unsigned int generation;
+    unsigned int nbits;
+} db_map_hdr_t;
+
+#define DB_MAP_MAGIC        "SDBMAP1"
+#define DB_MAP_BYTES        (MAX_STD_ID / 8 + 1)
+
+// DB_IDX_FILE tells where each student of a DB_LAYOUT_PACKED file is.  It
+// is a hash table of nbuckets (a power of two) db_idx_entry_t, using linear
+// probing, behind a preamble that carries the generation of the header it
+// belongs to.  Notes:
+//  1. a bucket with id 0 is free
+//  2. a bucket with slot 0 belongs to a student that was deleted.  It stays
+//     in use so the students probed past it can still be found
+//  3. used counts the buckets that are not free, the table is grown when
+//     it would become more than 3/4 full
+typedef struct db_idx_hdr{
+    char magic[8];
+    unsigned int generation;
+    unsigned int nbuckets;
+    unsigned int used;
+    char reserved[12];
+} db_idx_hdr_t;
+
+typedef struct db_idx_entry{
+    int id;
+    int slot;
+} db_idx_entry_t;
+
+#define DB_IDX_MAGIC        "SDBIDX1"
+
+// DB_WAL_FILE logs the adds and deletes made with -w that may not have
+// reached the database file yet.  It is a preamble followed by one
+// db_wal_entry_t per operation.  Notes:
+//  1. generation is the one of the database header the entries apply to,
+//     a log with another generation is stale and ignored
+//  2. boot_id is the kernel boot id (/proc/sys/kernel/random/boot_id) of
+//     the machine that wrote the log.  While it is unchanged every logged
+//     operation is at least in the page cache, so the log is only replayed
+//     after a reboot
+//  3. op is 'a' or 'd' and student the record that was added or deleted.
+//     check is a hash of both, the log ends at the first entry whose check
+//     does not match (a batch that was being written when the system went
+//     down)
+typedef struct db_wal_hdr{
+    char magic[8];
+    unsigned int generation;
+    char boot_id[40];
+    char reserved[12];
+} db_wal_hdr_t;
+
+typedef struct db_wal_entry{
+    int op;
+    unsigned int check;
+    student_t student;
+} db_wal_entry_t;
+
+#define DB_WAL_MAGIC        "SDBWAL1"
+
+// DB_NAME_FILE finds students by last name.  It is laid out like
+// DB_IDX_FILE, a db_idx_hdr_t preamble followed by nbuckets buckets probed
+// linearly, but it can hold many students per key.  Notes:
+//  1. hash is a hash of lname that is never 0, a bucket with hash 0 is free
+//  2. there is one bucket per student, all students with the same last name
+//     are found by probing from its home bucket to the next free bucket
+//  3. a bucket with id 0 belonged to a student that was deleted, it may be
+//     reused by any student added later
+typedef struct db_name_entry{
+    unsigned int hash;
+    int id;
+} db_name_entry_t;
+
+#define DB_NAME_MAGIC       "SDBNAM1"
+
+// DB_GPA_FILE lists the ids of the students with each gpa.  A preamble
+// carrying the generation of the header it belongs to is followed by
+// MAX_STD_GPA + 1 db_gpa_list_t, one per gpa, and from offset DB_GPA_BLOCKS
+// on by 64 byte blocks of ids, numbered from 1.  Notes:
+//  1. the students with a gpa are in the chain of blocks starting at head,
+//     next 0 ends it.  Only the head block may hold fewer than
+//     DB_GPA_BLOCK_IDS ids, so a delete moves the last id of the head block
+//     into the hole it leaves
+//  2. count is the number of students with that gpa
+//  3. blocks emptied by deletes are chained from free_block and reused
+typedef struct db_gpa_hdr{
+    char magic[8];
+    unsigned int generation;
+    unsigned int nblocks;
+    int free_block;
+    char reserved[44];
+} db_gpa_hdr_t;
+
+typedef struct db_gpa_list{
+    int count;
+    int head;
+} db_gpa_list_t;
+
+#define DB_GPA_BLOCK_IDS    14
+
+typedef struct db_gpa_block{
+    int next;
+    int n;
+    int ids[DB_GPA_BLOCK_IDS];
+} db_gpa_block_t;
+
+#define DB_GPA_MAGIC        "SDBGPA1"
+#define DB_GPA_BLOCKS       4096
+
+// DB_COLS_FILE copies the id and gpa of every record slot of the database
+// into dense int columns, so aggregates over them read 8 bytes per slot
+// instead of 64.  A preamble carrying the generation of the header it
+// belongs to is followed, from offset DB_COLS_SEGS on, by segments of
+// DB_COLS_SEG_SLOTS slots: first their ids, then their gpas.  Notes:
+//  1. slot n of the database (file offset n * STUDENT_RECORD_SIZE) is entry
+//     n % DB_COLS_SEG_SLOTS of segment n / DB_COLS_SEG_SLOTS
+//  2. like the database the file is sparse, segments without students may
+//     be holes that read as empty (id 0) slots
+typedef struct db_cols_hdr{
+    char magic[8];
+    unsigned int generation;
+    char reserved[52];
+} db_cols_hdr_t;
+
+#define DB_COLS_MAGIC       "SDBCOL1"
+#define DB_COLS_SEGS        4096
+#define DB_COLS_SEG_SLOTS   1024
 
 #endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef __LIBSDB_H__
+    #define __LIBSDB_H__
+
+#include <stdbool.h>
+#include "sdbsc.h"  //student_t and the error codes
+
+//libsdb.a: the student database without the command line.  A program opens
+//the database once, keeps the handle for as long as it likes and gets
+//NO_ERROR or an error code of sdbsc.h back from every call, nothing is
+//printed.  See Library interface in sdbsc.c for the rules the handle
+//follows.
+typedef struct db db_t;
+typedef struct db_cursor db_cursor_t;
+
+//flags of db_open(), the same as the -z, -m and -w options
+#define DB_OPEN_TRUNCATE    0x1
+#define DB_OPEN_MMAP        0x2
+#define DB_OPEN_WAL         0x4
+
+int db_open(db_t **dbp, int flags);
+int db_close(db_t *db);
+
+int db_get(db_t *db, int id, student_t *s);
+int db_add(db_t *db, const student_t *s);
+int db_del(db_t *db, int id);
+int db_count(db_t *db);
+
+//batches share one write-ahead log commit, results may be NULL
+int db_add_batch(db_t *db, const student_t *s, int n, int *results);
+int db_del_batch(db_t *db, const int *ids, int n, int *results);
+
+//walks every student in file order
+int db_cursor_open(db_t *db, db_cursor_t **cp);
+int db_cursor_next(db_cursor_t *c, student_t *s);
+void db_cursor_close(db_cursor_t *c);
+
+#endif
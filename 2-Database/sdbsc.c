@@ -1,354 +1,7577 @@
+#define _GNU_SOURCE     //SEEK_DATA/SEEK_HOLE and other Linux extensions
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h> //c library for system call file routines
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h> //mmap(), msync() for the memory-mapped backend
+#include <sys/uio.h>  //pwritev() for bulk loading
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h> //worker threads for -j
+#include <time.h>   //clock_gettime() for SDB_STATS
+#include <sys/syscall.h>    //io_uring for -q, see Asynchronous I/O
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "sdb.h"    //db_t, see Library interface
 
 /*
- *  open_db
- *      dbFile:  name of the database file
- *      should_truncate:  indicates if opening the file also empties it
+ *  Memory-mapped backend
  *
- *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *  When enabled (see the -m option in main) the database file is mapped
+ *  with mmap() and add/get/del/count/print work directly on the mapped
+ *  student_t array instead of issuing one lseek()+read() per record.  The
+ *  mapping is created lazily by the first operation that needs it.  If the
+ *  file cannot be mapped (for example it is still empty) the functions
+ *  quietly fall back to the normal per-record syscall path.
  *
- *  console:  Does not produce any console I/O on success
- *            M_ERR_DB_OPEN on error
+ *  Writes through the mapping are made durable with msync() on the page(s)
+ *  holding the modified record.
+ */
+static bool mmap_enabled = false;   // -m was given on the command line
+static student_t *db_map = NULL;    // the mapped file, NULL if not mapped
+static size_t db_map_len = 0;       // length of the mapping in bytes
+static int db_map_fd = -1;          // the fd the mapping belongs to
+
+/*
+ *  enable_mmap
+ *      enable:  true to use the memory-mapped backend
+ *
+ *  returns:  nothing, this is a void function
  *
+ *  console:  This function does not produce any output
  */
-int open_db(char *dbFile, bool should_truncate)
+void enable_mmap(bool enable)
 {
-    // Set permissions: rw-rw----
-    // see sys/stat.h for constants
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-
-    // open the file if it exists for Read and Write,
-    // create it if it does not exist
-    int flags = O_RDWR | O_CREAT;
-
-    if (should_truncate)
-        flags += O_TRUNC;
-
-    // Now open file
-    int fd = open(dbFile, flags, mode);
-
-    if (fd == -1)
-    {
-        // Handle the error
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
-    }
-
-    return fd;
+    mmap_enabled = enable;
 }
 
 /*
- *  get_student
- *      fd:  linux file descriptor
- *      id:  the student id we are looking forname of the
- *      *s:  a pointer where the located (if found) student data will be
- *           copied
+ *  unmap_db
  *
- *  returns:  NO_ERROR       student located and copied into *s
- *            ERR_DB_FILE    database file I/O issue
- *            SRCH_NOT_FOUND student was not located in the database
+ *  Releases the current mapping, if there is one.  This must be called
+ *  before the mapped fd is closed or the file is replaced (see compress_db).
  *
- *  console:  Does not produce any console I/O used by other functions
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  This function does not produce any output
  */
-int get_student(int fd, int id, student_t *s)
+void unmap_db(void)
 {
-    student_t student;
-
-    if(lseek(fd,0,SEEK_SET)==-1){
-        return ERR_DB_FILE;
-    }
-
-    while(read(fd,&student,sizeof(student)) > 0){
-        if(student.id == id){
-            *s = student;
-            return NO_ERROR;
-        }
-    }
-
-    if(read(fd,&student,sizeof(student)) == -1){
-        return ERR_DB_FILE;
-    }
+    if (db_map != NULL)
+        munmap(db_map, db_map_len);
 
-    return SRCH_NOT_FOUND;
+    db_map = NULL;
+    db_map_len = 0;
+    db_map_fd = -1;
 }
 
 /*
- *  add_student
- *      fd:     linux file descriptor
- *      id:     student id (range is defined in db.h )
- *      fname:  student first name
- *      lname:  student last name
- *      gpa:    GPA as an integer (range defined in db.h)
- *
- *  Adds a new student to the database.  After calculating the index for the
- *  student, check if there is another student already at that location.  A good
- *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty.
- *
- *  returns:  NO_ERROR       student added to database
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           already exists)
+ *  map_db
+ *      fd:    linux file descriptor
+ *      need:  minimum number of bytes the file must hold, 0 to map the file
+ *             at its current size.  The file is extended (sparsely, with
+ *             ftruncate) if it is smaller than this.
  *
+ *  The mapping always covers the whole file as it is now.  It is made
+ *  again when the file changed size since it was mapped, for example
+ *  because another process appended records to it (a long-lived -m
+ *  server would otherwise never see them).
  *
- *  console:  M_STD_ADDED       on success
- *            M_ERR_DB_ADD_DUP  student already exists
- *            M_ERR_DB_READ     error reading or seeking the database file
- *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *  returns:  pointer to the mapped student_t array, or NULL if the memory
+ *            mapped backend is disabled or the file could not be mapped.
+ *            NULL means the caller should use the syscall path.
  *
+ *  console:  This function does not produce any output
  */
-int add_student(int fd, int id, char *fname, char *lname, int gpa)
+static student_t *map_db(int fd, off_t need)
 {
-    student_t newStudent;
-    student_t existingStudent;
-    off_t pos;
-    ssize_t bytesRead;
-    ssize_t bytesWritten;
+    struct stat st;
+    void *p;
 
-    if(validate_range(id,gpa)== EXIT_FAIL_ARGS){   
-        printf(M_ERR_STD_RNG);
-        return EXIT_FAIL_DB;
-    }
+    if (!mmap_enabled)
+        return NULL;
 
-    
-    
-    pos = id * STUDENT_RECORD_SIZE;
+    if (fstat(fd, &st) == -1)
+        return NULL;
 
-    if (lseek(fd, MAX_STD_ID * STUDENT_RECORD_SIZE - 1, SEEK_SET) != -1) {
-        char nullByte = 0;
-        write(fd, &nullByte, 1);
+    if (st.st_size < need)
+    {
+        if (ftruncate(fd, need) == -1)
+            return NULL;
+        st.st_size = need;
     }
 
-    if(lseek(fd,pos,SEEK_SET) == -1){
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
+    if (db_map != NULL && db_map_fd == fd && (off_t)db_map_len == st.st_size)
+        return db_map;
 
-    bytesRead = read(fd, &existingStudent, STUDENT_RECORD_SIZE);
-    if (bytesRead == STUDENT_RECORD_SIZE && existingStudent.id != 0) {
-        printf(M_ERR_DB_ADD_DUP, id);
-        return ERR_DB_OP; 
-    }
+    if (st.st_size == 0)
+        return NULL;
 
-    memset(&newStudent, 0, STUDENT_RECORD_SIZE);
-    newStudent.id = id;
-    strncpy(newStudent.fname,fname,sizeof(newStudent.fname)-1);
-    strncpy(newStudent.lname,lname,sizeof(newStudent.lname)-1);
-    newStudent.gpa = gpa;
+    unmap_db();
+    p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return NULL;
 
-    if(lseek(fd,pos,SEEK_SET)==-1){
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
+    db_map = p;
+    db_map_len = st.st_size;
+    db_map_fd = fd;
+    return db_map;
+}
 
-    bytesWritten = write(fd,&newStudent,STUDENT_RECORD_SIZE);
-    if(bytesWritten != STUDENT_RECORD_SIZE){
-        printf(M_ERR_DB_WRITE);
+/*
+ *  sync_record
+ *      rec:  pointer to a record inside the current mapping
+ *
+ *  Flushes the page(s) that contain rec back to the database file.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if msync() failed
+ *
+ *  console:  This function does not produce any output
+ */
+static int sync_record(student_t *rec)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)rec & ~(uintptr_t)(page - 1);
+    uintptr_t end = (uintptr_t)rec + STUDENT_RECORD_SIZE;
+
+    if (msync((void *)start, end - start, MS_SYNC) == -1)
         return ERR_DB_FILE;
-    }
 
-    printf(M_STD_ADDED,id);
     return NO_ERROR;
 }
 
 /*
- *  del_student
- *      fd:     linux file descriptor
- *      id:     student id to be deleted
+ *  Asynchronous I/O
  *
- *  Removes a student to the database.  Use the get_student() function to
- *  locate the student to be deleted. If there is a student at that location
- *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
- *
- *  returns:  NO_ERROR       student deleted from database
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)
+ *  With -q, batches of reads and writes at scattered offsets are handed to
+ *  the kernel through an io_uring instead of one pread() or pwrite() each:
+ *  the runs of slots a bulk load or import writes (see Bulk loading) and
+ *  the slots -F reads (see find_students()) go out URING_DEPTH at a time
+ *  with a single io_uring_enter() per batch.  The ring is set up with the
+ *  raw system calls, so liburing is not needed.  Where the kernel has no
+ *  io_uring, or it is disabled, every operation of the batch is done with
+ *  preadv() or pwritev() instead, just like without -q.
  *
+ *  The full scans of -c, -p and -x keep using pread().  They read whole
+ *  extents of the file in large blocks (see Record scanner), which leaves
+ *  nothing for a deeper queue to overlap.
+ */
+#define URING_DEPTH     256     // entries of the submission queue
+
+typedef struct uring_io{
+    struct iovec *iov;          // buffers of the operation
+    int iovcnt;
+    off_t off;                  // file offset
+    ssize_t res;                // bytes transferred, -1 on errors
+} uring_io_t;
+
+static bool uring_enabled = false;  // -q was given on the command line
+
+#ifdef __NR_io_uring_setup
+static int uring_fd = -1;           // -1 if not set up yet, -2 if not available
+static unsigned uring_entries;      // entries of the submission queue
+static unsigned *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_sqe *sq_entries;
+static struct io_uring_cqe *cq_entries;
+
+/*
+ *  uring_setup
  *
- *  console:  M_STD_DEL_MSG      on success
- *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
- *            M_ERR_DB_READ      error reading or seeking the database file
- *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *  Creates the ring and maps its queues, the first time -q needs it.
  *
+ *  returns:  true if the ring can be used
  */
-int del_student(int fd, int id)
+static bool uring_setup(void)
 {
-    student_t student;
-    off_t pos;
-    ssize_t bytesWritten;
-    int result = get_student(fd,id,&student);
+    struct io_uring_params p;
+    size_t sq_len, cq_len;
+    char *sq, *cq;
+    void *sqes;
+
+    if (uring_fd != -1)
+        return uring_fd >= 0;
 
-    if (result == SRCH_NOT_FOUND)
+    memset(&p, 0, sizeof(p));
+    uring_fd = (int)syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (uring_fd < 0)
     {
-        printf(M_STD_NOT_FND_MSG,id);
-        return ERR_DB_FILE;
-    } else if (result == ERR_DB_FILE){
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
+        uring_fd = -2;
+        return false;
     }
 
-    pos = id * STUDENT_RECORD_SIZE;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
 
-    if(lseek(fd,pos,SEEK_SET)==-1){
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
+    sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              uring_fd, IORING_OFF_SQ_RING);
+    cq = sq;
+    if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP))
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  uring_fd, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQES);
 
-    bytesWritten = write(fd,&EMPTY_STUDENT_RECORD,STUDENT_RECORD_SIZE);
-    if(bytesWritten != STUDENT_RECORD_SIZE){
-        printf(M_ERR_DB_WRITE);
-        return ERR_DB_FILE;
+    // the ring is kept for the life of the process once it works
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        close(uring_fd);
+        uring_fd = -2;
+        return false;
     }
-    printf(M_STD_DEL_MSG,id);
-    return NO_ERROR;
-    //return NOT_IMPLEMENTED_YET;
+
+    uring_entries = p.sq_entries;
+    sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq_head = (unsigned *)(cq + p.cq_off.head);
+    cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    sq_entries = sqes;
+    cq_entries = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
 }
 
 /*
- *  count_db_records
+ *  uring_submit
  *      fd:     linux file descriptor
+ *      ios:    the operations, at most uring_entries
+ *      n:      number of operations
+ *      write:  true to write, false to read
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
- *
- *  returns:  <number>       returns the number of records in db on success
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)
- *
- *
- *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
- *            M_DB_EMPTY       on success if the record count in db is zero
- *            M_ERR_DB_READ    error reading or seeking the database file
- *            M_ERR_DB_WRITE   error writing to db file (adding student)
+ *  Queues every operation, submits them with one io_uring_enter() and
+ *  waits until all of them completed.
  *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the ring failed
  */
-int count_db_records(int fd)
+static int uring_submit(int fd, uring_io_t *ios, int n, bool write)
 {
-    student_t student;
-    int record_count = 0;
-    ssize_t bytesRead;
+    unsigned tail = *sq_tail;
+    unsigned head;
+    int submitted = 0, reaped = 0;
 
-    if(lseek(fd,0,SEEK_SET)== -1){
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-    
-    while((bytesRead = read(fd,&student,STUDENT_RECORD_SIZE)) == STUDENT_RECORD_SIZE){
-        if(student.id != DELETED_STUDENT_ID){
-            record_count++;
-        }
-    }
+    for (int i = 0; i < n; i++)
+    {
+        unsigned idx = tail++ & *sq_mask;
+        struct io_uring_sqe *sqe = &sq_entries[idx];
 
-    if (bytesRead > 0 && bytesRead < STUDENT_RECORD_SIZE) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)ios[i].iov;
+        sqe->len = ios[i].iovcnt;
+        sqe->off = ios[i].off;
+        sqe->user_data = i;
+        sq_array[idx] = idx;
     }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
 
-    if(record_count == 0){
-        printf(M_DB_EMPTY);
-    } else {
-        printf(M_DB_RECORD_CNT, record_count);
+    while (reaped < n)
+    {
+        int rc = (int)syscall(__NR_io_uring_enter, uring_fd, n - submitted, n - reaped,
+                              IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (rc < 0 && errno != EINTR)
+            return ERR_DB_FILE;
+        if (rc > 0)
+            submitted += rc;
+
+        head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &cq_entries[head++ & *cq_mask];
+
+            ios[cqe->user_data].res = cqe->res < 0 ? -1 : cqe->res;
+            reaped++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
     }
 
-    return record_count;
+    return NO_ERROR;
 }
+#endif
 
 /*
- *  print_db
- *      fd:     linux file descriptor
- *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
- *
- *     printf(STUDENT_PRINT_HDR_STRING, "ID",
- *                  "FIRST_NAME", "LAST_NAME", "GPA");
- *
- *  then for each valid record encountered print the required output:
- *
- *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
- *                    student.lname, calculated_gpa_from_student);
- *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
+ *  enable_uring
+ *      enable:  true to use io_uring for batches of reads and writes
  *
- *  returns:  NO_ERROR       on success
- *            ERR_DB_FILE    database file I/O issue
+ *  returns:  nothing, this is a void function
  *
+ *  console:  This function does not produce any output
+ */
+void enable_uring(bool enable)
+{
+    uring_enabled = enable;
+}
+
+/*
+ *  uring_rw
+ *      fd:     linux file descriptor
+ *      ios:    the operations, their res is set
+ *      n:      number of operations
+ *      write:  true to write, false to read
  *
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_DB_READ    error reading or seeking the database file
+ *  Does every operation, through the ring if -q was given and the kernel
+ *  has io_uring, see Asynchronous I/O.  A short transfer is not an error
+ *  here, the caller checks res.
  *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the ring failed
  */
-int print_db(int fd)
+static int uring_rw(int fd, uring_io_t *ios, int n, bool write)
 {
-    student_t student;
-    ssize_t bytesRead;
-    int header = 0;
-    float newGPA;
-
-    if(lseek(fd,0,SEEK_SET) == -1){
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    bytesRead = read(fd,&student,STUDENT_RECORD_SIZE);
-    if(bytesRead == 0){
-        printf(M_DB_EMPTY);
-        return NO_ERROR;
-    }
-
-    if(lseek(fd,0,SEEK_SET) == -1){
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
+#ifdef __NR_io_uring_setup
+    if (uring_enabled && uring_setup())
+    {
+        for (int i = 0; i < n; i += uring_entries)
+        {
+            int batch = n - i < (int)uring_entries ? n - i : (int)uring_entries;
 
-    while((bytesRead = read(fd,&student,STUDENT_RECORD_SIZE)) == STUDENT_RECORD_SIZE){
-        if(student.id != DELETED_STUDENT_ID){
-            if(!header){
-               printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-               header = 1;
-            }
-            newGPA = student.gpa/100.0;
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, newGPA);
+            if (uring_submit(fd, &ios[i], batch, write) != NO_ERROR)
+                return ERR_DB_FILE;
         }
+        return NO_ERROR;
     }
+#endif
 
-    if (!header) {
-        printf(M_DB_EMPTY);
-    }
-
+    for (int i = 0; i < n; i++)
+        ios[i].res = write ? pwritev(fd, ios[i].iov, ios[i].iovcnt, ios[i].off)
+                           : preadv(fd, ios[i].iov, ios[i].iovcnt, ios[i].off);
     return NO_ERROR;
 }
 
 /*
- *  print_student
- *      *s:   a pointer to a student_t structure that should
- *            contain a valid student to be printed
+ *  Database header and occupancy bitmap
+ *
+ *  Slot 0 of the database holds a db_header_t (see db.h) with the format
+ *  version, the layout of the file and the number of live students, and
+ *  DB_MAP_FILE holds a bitmap with one bit per possible id.  add_student,
+ *  del_student and compress_db keep both up to date, which lets
+ *  count_db_records() answer from the header and print_db() visit only
+ *  the occupied slots.
+ *
+ *  Files written before the header existed are migrated the first time they
+ *  are opened: the records are scanned to rebuild the bitmap and the count,
+ *  and files packed by an older compress_db() are shifted up one slot to
+ *  make room for the header.  A missing or stale bitmap is rebuilt the same
+ *  way.
+ */
+static db_header_t db_hdr;                      // header of the open database
+static unsigned char db_bits[DB_MAP_BYTES];     // bit id set if student id exists
+static int db_hdr_fd = -1;                      // fd db_hdr describes, -1 if none
+static int db_bits_fd = -1;                     // fd of DB_MAP_FILE
+
+static bool have_header(int fd)
+{
+    return db_hdr_fd != -1 && db_hdr_fd == fd;
+}
+
+static bool bit_test(int id)
+{
+    return (db_bits[id / 8] >> (id % 8)) & 1;
+}
+
+static void bit_assign(int id, bool on)
+{
+    if (on)
+        db_bits[id / 8] |= (unsigned char)(1 << (id % 8));
+    else
+        db_bits[id / 8] &= (unsigned char)~(1 << (id % 8));
+}
+
+/*
+ *  next_bit
+ *      id:  first id to look at
+ *
+ *  returns:  the first id >= id that is set in the bitmap, or -1 if none
+ */
+static int next_bit(int id)
+{
+    int byte = id / 8;
+
+    if (id < 0 || byte >= (int)sizeof(db_bits))
+        return -1;
+
+    // finish the byte id is in, then skip zero bytes 8 at a time
+    for (int b = id % 8; b < 8; b++)
+        if ((db_bits[byte] >> b) & 1)
+            return byte * 8 + b;
+
+    for (byte++; byte < (int)sizeof(db_bits); byte++)
+    {
+        uint64_t word = 0;
+
+        if (byte + 8 <= (int)sizeof(db_bits))
+        {
+            memcpy(&word, &db_bits[byte], 8);
+            if (word == 0)
+            {
+                byte += 7;
+                continue;
+            }
+        }
+        if (db_bits[byte] != 0)
+            return byte * 8 + __builtin_ctz(db_bits[byte]);
+    }
+
+    return -1;
+}
+
+/*
+ *  Page cache
+ *
+ *  With SDB_CACHE, or set_page_cache() in a program using libsdb, lookups
+ *  read the whole 4 KiB page of the record they need into a cache of the
+ *  given size, and later lookups in the same page are served from it.  In
+ *  a long-lived process (-r, -S or a program using libsdb) the hot students
+ *  then cost no system call at all.  A full cache drops pages with the
+ *  CLOCK algorithm: a page used since the hand last passed it gets a second
+ *  chance.  locate_student() and the duplicate check of store_student()
+ *  read through the cache.  The memory-mapped backend (-m) and the scans
+ *  do not.
+ *
+ *  Writes still go straight to the file and are copied into the cached
+ *  page too (write-through).  Nothing is ever left to write back, and
+ *  other processes see every add and delete at once.  To notice the writes
+ *  of other processes, the header counts its own writes (changes, see
+ *  db.h).  Page 0 is mapped read-only so the count is checked without a
+ *  system call.  The whole cache is dropped when the count moved without
+ *  this process knowing.  compress_db() and convert_db() move the count of
+ *  the old file one last time once the new file is in place (see
+ *  publish_replacement()), so a moved count is also when the cache checks
+ *  whether DB_FILE was replaced and moves on to the new file.  Lookups
+ *  served from the cache can then skip that check, see follow_db().
+ */
+#define CACHE_PAGE          4096
+#define CACHE_PAGE_RECS     (CACHE_PAGE / sizeof(student_t))
+#define CACHE_MAX_PAGES     (1 << 20)       // 4 GiB
+
+typedef struct cache_frame{
+    off_t page;             // page number in the file, -1 if the frame is free
+    int next;               // next frame in the same bucket, -1 ends the chain
+    int len;                // bytes of the page that are inside the file
+    bool ref;               // used since the clock hand last passed
+    student_t recs[CACHE_PAGE_RECS];
+} cache_frame_t;
+
+static cache_frame_t *cache_frames = NULL;
+static int cache_nframes = 0;                   // 0 if the cache is off
+static int *cache_buckets = NULL;               // first frame of each bucket, -1 if none
+static int cache_nbuckets = 0;                  // a power of two
+static int cache_hand = 0;                      // next frame the clock looks at
+static const volatile db_header_t *cache_hdr = NULL;   // page 0 of the file, read-only
+static int cache_hdr_fd = -1;                   // fd cache_hdr belongs to
+static unsigned int cache_gen = 0;              // the pages are up to date with
+static unsigned int cache_changes = 0;          // this header generation and changes
+static long cache_hits = 0;
+static long cache_misses = 0;
+static long cache_evictions = 0;
+
+static void cache_drop(void)
+{
+    for (int i = 0; i < cache_nframes; i++)
+        cache_frames[i].page = -1;
+    for (int b = 0; b < cache_nbuckets; b++)
+        cache_buckets[b] = -1;
+    cache_hand = 0;
+}
+
+/*
+ *  cache_release
+ *
+ *  Drops every cached page and the mapping of the header.  Must be called
+ *  before the fd the cache belongs to is closed or replaced.
+ */
+static void cache_release(void)
+{
+    if (cache_hdr != NULL)
+        munmap((void *)cache_hdr, CACHE_PAGE);
+    cache_hdr = NULL;
+    cache_hdr_fd = -1;
+    cache_drop();
+}
+
+/*
+ *  set_page_cache
+ *      bytes:  memory to use for cached pages, 0 to turn the cache off
+ *
+ *  Sets up an empty cache of bytes / CACHE_PAGE pages, see Page cache.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the memory could not be
+ *            allocated, the cache is then off
+ *
+ *  console:  This function does not produce any output
+ */
+int set_page_cache(size_t bytes)
+{
+    cache_release();
+    free(cache_frames);
+    free(cache_buckets);
+    cache_frames = NULL;
+    cache_buckets = NULL;
+    cache_nframes = 0;
+    cache_nbuckets = 0;
+
+    if (bytes / CACHE_PAGE == 0)
+        return NO_ERROR;
+    if (bytes / CACHE_PAGE > CACHE_MAX_PAGES)
+        bytes = (size_t)CACHE_MAX_PAGES * CACHE_PAGE;
+
+    cache_nbuckets = 1;
+    while (cache_nbuckets < (int)(bytes / CACHE_PAGE))
+        cache_nbuckets *= 2;
+    cache_frames = malloc(bytes / CACHE_PAGE * sizeof(cache_frame_t));
+    cache_buckets = malloc(cache_nbuckets * sizeof(int));
+    if (cache_frames == NULL || cache_buckets == NULL)
+    {
+        free(cache_frames);
+        free(cache_buckets);
+        cache_frames = NULL;
+        cache_buckets = NULL;
+        cache_nbuckets = 0;
+        return ERR_DB_FILE;
+    }
+
+    cache_nframes = (int)(bytes / CACHE_PAGE);
+    cache_drop();
+    return NO_ERROR;
+}
+
+/*
+ *  page_cache_counts
+ *      hits:       set to the number of lookups served from the cache
+ *      misses:     set to the number of pages read into the cache
+ *      evictions:  set to the number of pages dropped to make room
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  This function does not produce any output
+ */
+void page_cache_counts(long *hits, long *misses, long *evictions)
+{
+    *hits = cache_hits;
+    *misses = cache_misses;
+    *evictions = cache_evictions;
+}
+
+static int replaced_db(int fd);
+static int reopen_db(int fd);
+
+/*
+ *  cache_valid
+ *      fd:  linux file descriptor
+ *
+ *  Drops the cached pages if another process changed the database since
+ *  they were read, and reopens DB_FILE on fd if that process replaced it,
+ *  see Page cache.
+ *
+ *  returns:  true if the cache can be used for fd
+ */
+static bool cache_valid(int fd)
+{
+    void *p;
+
+    if (cache_nframes == 0 || !have_header(fd))
+        return false;
+
+    if (cache_hdr_fd != fd)
+    {
+        cache_release();
+        p = mmap(NULL, CACHE_PAGE, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            return false;
+        cache_hdr = p;
+        cache_hdr_fd = fd;
+        cache_gen = cache_hdr->generation;
+        cache_changes = cache_hdr->changes;
+    }
+
+    if (cache_hdr->generation != cache_gen || cache_hdr->changes != cache_changes)
+    {
+        cache_drop();
+        if (replaced_db(fd) != 0)
+            return reopen_db(fd) == NO_ERROR && cache_valid(fd);
+        cache_gen = cache_hdr->generation;
+        cache_changes = cache_hdr->changes;
+    }
+    return true;
+}
+
+// Fibonacci hashing like the packed index, see idx_home()
+static int *cache_bucket(off_t page)
+{
+    return &cache_buckets[((uint64_t)page * 0x9E3779B97F4A7C15ull >> 32) & (cache_nbuckets - 1)];
+}
+
+static int cache_find(off_t page)
+{
+    int f = *cache_bucket(page);
+
+    while (f != -1 && cache_frames[f].page != page)
+        f = cache_frames[f].next;
+    return f;
+}
+
+/*
+ *  cache_frame
+ *      page:  page number to put in the frame
+ *
+ *  Takes a free frame, or the one the clock picks, for page.
+ *
+ *  returns:  the frame
+ */
+static int cache_frame(off_t page)
+{
+    int *b;
+    int f;
+
+    for (;;)
+    {
+        f = cache_hand;
+        cache_hand = (cache_hand + 1) % cache_nframes;
+        if (cache_frames[f].page == -1)
+            break;
+        if (cache_frames[f].ref)
+        {
+            cache_frames[f].ref = false;
+            continue;
+        }
+
+        // unlink it from its bucket
+        b = cache_bucket(cache_frames[f].page);
+        while (*b != f)
+            b = &cache_frames[*b].next;
+        *b = cache_frames[f].next;
+        cache_evictions++;
+        break;
+    }
+
+    b = cache_bucket(page);
+    cache_frames[f].page = page;
+    cache_frames[f].next = *b;
+    cache_frames[f].ref = true;
+    *b = f;
+    return f;
+}
+
+/*
+ *  cache_read
+ *      fd:   linux file descriptor
+ *      rec:  where the record is copied
+ *      pos:  file offset of the record
+ *
+ *  Reads one record like pread() would, through the cache if it is on.
+ *
+ *  returns:  STUDENT_RECORD_SIZE, 0 if the record is past the end of the
+ *            file, -1 on read errors
+ */
+static ssize_t cache_read(int fd, student_t *rec, off_t pos)
+{
+    off_t page = pos / CACHE_PAGE;
+    int off = (int)(pos % CACHE_PAGE);
+    ssize_t got;
+    int f;
+
+    if (!cache_valid(fd))
+        return pread(fd, rec, STUDENT_RECORD_SIZE, pos);
+
+    f = cache_find(page);
+    if (f != -1)
+    {
+        cache_hits++;
+        cache_frames[f].ref = true;
+    }
+    else
+    {
+        cache_misses++;
+        f = cache_frame(page);
+        got = pread(fd, cache_frames[f].recs, CACHE_PAGE, page * CACHE_PAGE);
+        if (got == -1)
+        {
+            cache_drop();
+            return -1;
+        }
+        cache_frames[f].len = (int)got;
+    }
+
+    if (off + STUDENT_RECORD_SIZE > cache_frames[f].len)
+        return 0;
+    *rec = cache_frames[f].recs[off / STUDENT_RECORD_SIZE];
+    return STUDENT_RECORD_SIZE;
+}
+
+/*
+ *  cache_write
+ *      rec:  the record that was written to the file
+ *      pos:  file offset of the record
+ *
+ *  Copies the record into its page, if that is cached.
+ */
+static void cache_write(const student_t *rec, off_t pos)
+{
+    int f = cache_nframes == 0 ? -1 : cache_find(pos / CACHE_PAGE);
+    int off = (int)(pos % CACHE_PAGE);
+
+    if (f == -1)
+        return;
+
+    cache_frames[f].recs[off / STUDENT_RECORD_SIZE] = *rec;
+    if (cache_frames[f].len < off + STUDENT_RECORD_SIZE)
+    {
+        // the page may have grown past a part that is not cached
+        if (cache_frames[f].len < off)
+            memset(&cache_frames[f].recs[cache_frames[f].len / STUDENT_RECORD_SIZE], 0,
+                   off - cache_frames[f].len);
+        cache_frames[f].len = off + STUDENT_RECORD_SIZE;
+    }
+}
+
+/*
+ *  Operation statistics
+ *
+ *  With SDB_STATS=1 in the environment sdbsc measures every operation it
+ *  runs (one per process, per script line or per server request) and
+ *  prints a summary to stderr on exit, as one line of JSON:
+ *
+ *      {"sdb_stats":{"a":{"ops":3,"wall_us":...,"hist_us":{"16":2,"32":1}},...}}
+ *
+ *  keyed by option letter.  For each kind of operation it has the number
+ *  run, wall and CPU time (of all threads), the read and write family
+ *  system calls and bytes (the syscr, syscw, rchar and wchar counters of
+ *  /proc/self/io, which include console output), the lseek() calls, the
+ *  records read by scans and lookups or written by adds, deletes, bulk
+ *  loads and compress, and the latencies.  Latencies go into a histogram
+ *  with power of two buckets, the bucket of key n (microseconds) holds
+ *  those from n / 2 up to n, and p50_us and p99_us are the keys of the
+ *  buckets holding those percentiles.  Nothing is measured without
+ *  SDB_STATS.
+ */
+#define OP_STATS_BUCKETS       32
+
+typedef struct op_stats{
+    long ops;
+    double wall_us;
+    double cpu_us;
+    long reads;
+    long writes;
+    long read_bytes;
+    long write_bytes;
+    long lseeks;
+    long records;
+    double max_us;
+    long hist[OP_STATS_BUCKETS];
+} op_stats_t;
+
+// what /proc/self/io and the counters below said when an operation began
+typedef struct stats_mark{
+    long syscr, syscw, rchar, wchar;
+    long lseeks, records;
+    double wall_us, cpu_us;
+} stats_mark_t;
+
+static bool stats_enabled = false;
+static op_stats_t *op_stats = NULL;     // one per option letter
+static stats_mark_t stats_start;
+static long stats_lseeks = 0;
+static long stats_records = 0;
+static int stats_io_fd = -1;            // /proc/self/io
+
+// adds n to the records touched, from any thread
+static void count_records_touched(long n)
+{
+    if (stats_enabled)
+        __atomic_fetch_add(&stats_records, n, __ATOMIC_RELAXED);
+}
+
+// lseek() counted for the statistics
+static off_t seek_db(int fd, off_t offset, int whence)
+{
+    if (stats_enabled)
+        __atomic_fetch_add(&stats_lseeks, 1, __ATOMIC_RELAXED);
+    return lseek(fd, offset, whence);
+}
+
+static double clock_us(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ *  stats_sample
+ *      m:  filled in with the counters as they are now
+ *
+ *  The read of /proc/self/io itself shows up in the next sample, its call
+ *  and bytes are taken off the counters of that one.
+ */
+static void stats_sample(stats_mark_t *m)
+{
+    static long own_calls = 0, own_bytes = 0;   // reads of /proc/self/io
+    char buf[512];
+    ssize_t n = -1;
+    char *p;
+
+    memset(m, 0, sizeof(*m));
+    if (stats_io_fd != -1)
+        n = pread(stats_io_fd, buf, sizeof(buf) - 1, 0);
+    if (n > 0)
+    {
+        buf[n] = '\0';
+        if ((p = strstr(buf, "rchar: ")) != NULL)
+            m->rchar = atol(p + 7) - own_bytes;
+        if ((p = strstr(buf, "wchar: ")) != NULL)
+            m->wchar = atol(p + 7);
+        if ((p = strstr(buf, "syscr: ")) != NULL)
+            m->syscr = atol(p + 7) - own_calls;
+        if ((p = strstr(buf, "syscw: ")) != NULL)
+            m->syscw = atol(p + 7);
+        own_calls++;
+        own_bytes += n;
+    }
+
+    m->lseeks = __atomic_load_n(&stats_lseeks, __ATOMIC_RELAXED);
+    m->records = __atomic_load_n(&stats_records, __ATOMIC_RELAXED);
+    m->wall_us = clock_us(CLOCK_MONOTONIC);
+    m->cpu_us = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/*
+ *  enable_stats
+ *      enable:  true to measure every operation, see Operation statistics
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  This function does not produce any output
+ */
+void enable_stats(bool enable)
+{
+    if (enable && op_stats == NULL)
+    {
+        op_stats = calloc(128, sizeof(op_stats_t));
+        stats_io_fd = open("/proc/self/io", O_RDONLY);
+    }
+    stats_enabled = enable && op_stats != NULL;
+}
+
+/*
+ *  stats_begin
+ *
+ *  Marks the start of an operation, see stats_end().
+ *
+ *  returns:  nothing, this is a void function
+ */
+void stats_begin(void)
+{
+    if (stats_enabled)
+        stats_sample(&stats_start);
+}
+
+/*
+ *  stats_end
+ *      op:  option letter of the operation that stats_begin() started
+ *
+ *  Adds what the operation did to the statistics of op.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void stats_end(int op)
+{
+    stats_mark_t end;
+    op_stats_t *st;
+    double us;
+    int b = 0;
+
+    if (!stats_enabled || op <= 0 || op >= 128)
+        return;
+
+    // everything printed so far belongs to this operation
+    fflush(stdout);
+    stats_sample(&end);
+    st = &op_stats[op];
+    us = end.wall_us - stats_start.wall_us;
+
+    st->ops++;
+    st->wall_us += us;
+    st->cpu_us += end.cpu_us - stats_start.cpu_us;
+    st->reads += end.syscr - stats_start.syscr;
+    st->writes += end.syscw - stats_start.syscw;
+    st->read_bytes += end.rchar - stats_start.rchar;
+    st->write_bytes += end.wchar - stats_start.wchar;
+    st->lseeks += end.lseeks - stats_start.lseeks;
+    st->records += end.records - stats_start.records;
+    if (us > st->max_us)
+        st->max_us = us;
+
+    while (b < OP_STATS_BUCKETS - 1 && us > (double)(1L << b))
+        b++;
+    st->hist[b]++;
+}
+
+// the key of the histogram bucket holding the pct percentile
+static long stats_percentile(const op_stats_t *st, double pct)
+{
+    long seen = 0;
+    int b = 0;
+
+    for (b = 0; b < OP_STATS_BUCKETS - 1; b++)
+    {
+        seen += st->hist[b];
+        if (seen >= st->ops * pct)
+            break;
+    }
+    return 1L << b;
+}
+
+/*
+ *  print_stats_line
+ *
+ *  Prints the statistics of every kind of operation that ran, see
+ *  Operation statistics.  Does nothing if none did or SDB_STATS is not set.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  one line of JSON on stderr
+ */
+void print_stats_line(void)
+{
+    const char *sep = "";
+    long ops = 0;
+
+    for (int op = 0; op < 128 && stats_enabled; op++)
+        ops += op_stats[op].ops;
+    if (ops == 0)
+        return;
+
+    fprintf(stderr, "{\"sdb_stats\":{");
+    for (int op = 0; op < 128; op++)
+    {
+        const op_stats_t *st = &op_stats[op];
+        const char *hsep = "";
+
+        if (st->ops == 0)
+            continue;
+
+        fprintf(stderr, "%s\"%c\":{\"ops\":%ld,\"wall_us\":%.0f,\"cpu_us\":%.0f,"
+                "\"reads\":%ld,\"writes\":%ld,\"read_bytes\":%ld,\"write_bytes\":%ld,"
+                "\"lseeks\":%ld,\"records\":%ld,\"p50_us\":%ld,\"p99_us\":%ld,"
+                "\"max_us\":%.0f,\"hist_us\":{",
+                sep, op, st->ops, st->wall_us, st->cpu_us, st->reads, st->writes,
+                st->read_bytes, st->write_bytes, st->lseeks, st->records,
+                stats_percentile(st, 0.5), stats_percentile(st, 0.99), st->max_us);
+        for (int b = 0; b < OP_STATS_BUCKETS; b++)
+        {
+            if (st->hist[b] == 0)
+                continue;
+            fprintf(stderr, "%s\"%ld\":%ld", hsep, 1L << b, st->hist[b]);
+            hsep = ",";
+        }
+        fprintf(stderr, "}}");
+        sep = ",";
+    }
+    if (cache_nframes > 0)
+        fprintf(stderr, ",\"page_cache\":{\"hits\":%ld,\"misses\":%ld,\"evictions\":%ld}",
+                cache_hits, cache_misses, cache_evictions);
+    fprintf(stderr, "}}\n");
+}
+
+/*
+ *  Record scanner
+ *
+ *  count_db_records(), print_db(), compress_db() and the other full scans
+ *  all go through scan_begin()/scan_next().  The scanner reads the file in
+ *  blocks of up to SCAN_BLOCK_RECS records with one pread() each (or uses
+ *  the mapping, see map_db()) and builds a bit mask of the live records in
+ *  the block by testing the id of every record, so callers never look at
+ *  empty slots.
+ *
+ *  The database is a sparse file (see compress_db()), so most of a flat
+ *  file is holes that read back as zeros.  Only the allocated extents
+ *  reported by lseek(SEEK_DATA/SEEK_HOLE) are read, and for flat files with
+ *  a header each block starts at the next id set in the occupancy bitmap.
+ *  Where SEEK_DATA is not available the whole file is treated as a single
+ *  extent.
+ *
+ *  Paged files are read a data page at a time in the order of their
+ *  directory instead, which is id order (runs of data pages that follow
+ *  each other in the file still make one block), so -p, -e and -x list
+ *  their students by id like a flat file whatever order the pages were
+ *  allocated in.  The directory is walked once, the first time a block is
+ *  needed, see paged_data_pages().
+ *
+ *  The id test is done with AVX2 or SSE2 when the CPU has them, chosen at
+ *  runtime, with a plain loop everywhere else.  SDB_SIMD=avx2|sse2|scalar
+ *  in the environment forces one of them.
+ */
+#define SCAN_BLOCK_RECS     16384       // 1 MiB of records per block
+#define SCAN_MASK_WORDS     (SCAN_BLOCK_RECS / 64)
+
+typedef struct scan{
+    int fd;
+    student_t *map;     // mapped file (see map_db()), NULL to use pread()
+    student_t *buf;     // block buffer when reading with pread()
+    bool use_bits;      // skip to ids set in the occupancy bitmap
+    off_t size;         // size of the file when the scan started
+    off_t pos;          // offset of the next block to read
+    off_t end;          // end of the current data extent
+    bool paged;         // read the data pages of a paged file in id order
+    uint32_t *pages;    // those data pages, NULL until listed
+    int page_next;      // index in pages of the next page to read
+    int page_end;       // index in pages the scan stops at
+    bool own_pages;     // pages is freed by scan_end()
+    student_t *blk;     // records of the current block
+    off_t blk_off;      // file offset of blk[0]
+    int nrecs;          // number of records in blk
+    int live;           // number of live records in blk
+    int next;           // index in blk scan_next() continues from
+    uint64_t mask[SCAN_MASK_WORDS];  // bit i set if blk[i] is live
+} scan_t;
+
+typedef int (*live_mask_fn)(const student_t *recs, int nrecs, uint64_t *mask);
+
+static int live_mask_scalar(const student_t *recs, int nrecs, uint64_t *mask)
+{
+    int live = 0;
+
+    memset(mask, 0, ((nrecs + 63) / 64) * sizeof(uint64_t));
+    for (int i = 0; i < nrecs; i++)
+    {
+        if (recs[i].id != DELETED_STUDENT_ID)
+        {
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+            live++;
+        }
+    }
+    return live;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+static int live_mask_sse2(const student_t *recs, int nrecs, uint64_t *mask)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int live = 0;
+    int i;
+
+    memset(mask, 0, ((nrecs + 63) / 64) * sizeof(uint64_t));
+    for (i = 0; i + 4 <= nrecs; i += 4)
+    {
+        __m128i ids = _mm_set_epi32(recs[i + 3].id, recs[i + 2].id,
+                                    recs[i + 1].id, recs[i].id);
+        int empty = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ids, zero)));
+        uint64_t bits = ~empty & 0xF;
+
+        mask[i / 64] |= bits << (i % 64);
+        live += __builtin_popcountll(bits);
+    }
+    for (; i < nrecs; i++)
+    {
+        if (recs[i].id != DELETED_STUDENT_ID)
+        {
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+            live++;
+        }
+    }
+    return live;
+}
+
+__attribute__((target("avx2")))
+static int live_mask_avx2(const student_t *recs, int nrecs, uint64_t *mask)
+{
+    // the id is the first int of every 64 byte record, 16 ints apart
+    const __m256i stride = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+    const __m256i zero = _mm256_setzero_si256();
+    int live = 0;
+    int i;
+
+    memset(mask, 0, ((nrecs + 63) / 64) * sizeof(uint64_t));
+    for (i = 0; i + 8 <= nrecs; i += 8)
+    {
+        __m256i ids = _mm256_i32gather_epi32((const int *)&recs[i], stride, 4);
+        int empty = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(ids, zero)));
+        uint64_t bits = ~empty & 0xFF;
+
+        mask[i / 64] |= bits << (i % 64);
+        live += __builtin_popcountll(bits);
+    }
+    for (; i < nrecs; i++)
+    {
+        if (recs[i].id != DELETED_STUDENT_ID)
+        {
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+            live++;
+        }
+    }
+    return live;
+}
+#endif
+
+/*
+ *  pick_live_mask
+ *
+ *  returns:  the fastest live mask function this CPU supports
+ */
+static live_mask_fn pick_live_mask(void)
+{
+    const char *force = getenv("SDB_SIMD");
+
+    if (force != NULL && strcmp(force, "scalar") == 0)
+        return live_mask_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "avx2") == 0))
+        return live_mask_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return live_mask_sse2;
+#endif
+
+    return live_mask_scalar;
+}
+
+static live_mask_fn live_mask = NULL;
+
+static bool is_paged(int fd);
+static uint32_t *paged_data_pages(int fd, int *n);
+
+/*
+ *  scan_begin
+ *      sc:  scan to set up
+ *      fd:  linux file descriptor
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure.  On success the
+ *            scan must be released with scan_end().
+ */
+static int scan_begin(scan_t *sc, int fd)
+{
+    struct stat st;
+
+    if (live_mask == NULL)
+        live_mask = pick_live_mask();
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    sc->fd = fd;
+    sc->map = map_db(fd, 0);
+    sc->buf = NULL;
+    sc->use_bits = have_header(fd) && db_hdr.layout == DB_LAYOUT_FLAT;
+    sc->paged = is_paged(fd);
+    sc->pages = NULL;
+    sc->page_next = 0;
+    sc->page_end = 0;
+    sc->own_pages = false;
+    sc->size = st.st_size;
+    if (sc->map != NULL && (off_t)db_map_len < sc->size)
+        sc->size = db_map_len;
+    sc->pos = 0;
+    sc->end = 0;
+    sc->blk = NULL;
+    sc->nrecs = 0;
+    sc->live = 0;
+    sc->next = 0;
+
+    if (sc->map == NULL)
+    {
+        sc->buf = malloc((size_t)SCAN_BLOCK_RECS * STUDENT_RECORD_SIZE);
+        if (sc->buf == NULL)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  scan_end
+ *      sc:  scan started with scan_begin()
+ */
+static void scan_end(scan_t *sc)
+{
+    free(sc->buf);
+    sc->buf = NULL;
+    if (sc->own_pages)
+        free(sc->pages);
+    sc->pages = NULL;
+    sc->own_pages = false;
+}
+
+/*
+ *  scan_pages
+ *      sc:  scan of a paged file
+ *
+ *  Lists the data pages of the file in id order for the scan, see Record
+ *  scanner.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int scan_pages(scan_t *sc)
+{
+    int n;
+
+    if (sc->pages != NULL)
+        return NO_ERROR;
+
+    sc->pages = paged_data_pages(sc->fd, &n);
+    if (sc->pages == NULL)
+        return ERR_DB_FILE;
+
+    sc->own_pages = true;
+    sc->page_next = 0;
+    sc->page_end = n;
+    return NO_ERROR;
+}
+
+/*
+ *  next_pages
+ *      sc:    scan of a paged file
+ *      *len:  set to the length of the block
+ *
+ *  Moves the scan to the next run of data pages that follow each other in
+ *  the file, up to SCAN_BLOCK_RECS records.  Pages past the size of the
+ *  file when the scan started (allocated since) are left out.
+ *
+ *  returns:  1 if there is another block, 0 at the end, ERR_DB_FILE on
+ *            failure
+ */
+static int next_pages(scan_t *sc, off_t *len)
+{
+    int n;
+
+    if (scan_pages(sc) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (;;)
+    {
+        if (sc->page_next >= sc->page_end)
+            return 0;
+
+        sc->pos = (off_t)sc->pages[sc->page_next] * DB_PAGE_SIZE;
+        n = 1;
+        while (sc->page_next + n < sc->page_end && n < SCAN_BLOCK_RECS / DB_PAGE_RECS &&
+               sc->pages[sc->page_next + n] == sc->pages[sc->page_next] + n)
+            n++;
+        sc->page_next += n;
+
+        *len = (off_t)n * DB_PAGE_SIZE;
+        if (sc->pos + *len > sc->size)
+            *len = sc->size - sc->pos;
+        *len -= *len % STUDENT_RECORD_SIZE;
+        if (*len > 0)
+            return 1;
+    }
+}
+
+/*
+ *  next_extent
+ *      sc:  scan in progress
+ *
+ *  Moves the scan to the next extent of the file that holds data, rounded
+ *  out to whole records.
+ *
+ *  returns:  true if there is another extent, false at the end of the file
+ */
+static bool next_extent(scan_t *sc)
+{
+    off_t data = sc->pos;
+    off_t hole = sc->size;
+
+    if (sc->pos >= sc->size)
+        return false;
+
+#ifdef SEEK_DATA
+    data = seek_db(sc->fd, sc->pos, SEEK_DATA);
+    if (data == -1)
+    {
+        // ENXIO means only holes are left, anything else means the
+        // filesystem can't tell us so the rest is treated as data
+        if (errno == ENXIO)
+            return false;
+        data = sc->pos;
+    }
+    else if (data >= sc->size)
+    {
+        // the rest of this scan's range is a hole, see parallel_scan()
+        return false;
+    }
+    else
+    {
+        hole = seek_db(sc->fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > sc->size)
+            hole = sc->size;
+    }
+#endif
+
+    sc->pos = data - data % STUDENT_RECORD_SIZE;
+    sc->end = hole + (STUDENT_RECORD_SIZE - hole % STUDENT_RECORD_SIZE) % STUDENT_RECORD_SIZE;
+    if (sc->end > sc->size)
+        sc->end = sc->size;
+    return true;
+}
+
+/*
+ *  next_block
+ *      sc:    scan of a flat or packed file
+ *      *len:  set to the length of the block
+ *
+ *  Moves the scan to the next block of up to SCAN_BLOCK_RECS records that
+ *  holds data, skipping holes and, with the bitmap, empty slots.
+ *
+ *  returns:  1 if there is another block, 0 at the end, ERR_DB_FILE if
+ *            the file ends in a partial record
+ */
+static int next_block(scan_t *sc, off_t *len)
+{
+    for (;;)
+    {
+        if (sc->use_bits)
+        {
+            int id = next_bit((int)(sc->pos / STUDENT_RECORD_SIZE));
+            off_t at = (off_t)id * STUDENT_RECORD_SIZE;
+
+            if (id < 0)
+                return 0;
+            if (at > sc->pos)
+            {
+                sc->pos = at;
+                if (sc->pos >= sc->end)
+                    sc->end = 0;
+            }
+        }
+
+        if (sc->pos < sc->end || next_extent(sc))
+            break;
+        return 0;
+    }
+
+    *len = sc->end - sc->pos;
+    if (*len < STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+    if (*len > (off_t)SCAN_BLOCK_RECS * STUDENT_RECORD_SIZE)
+        *len = (off_t)SCAN_BLOCK_RECS * STUDENT_RECORD_SIZE;
+    *len -= *len % STUDENT_RECORD_SIZE;
+    return 1;
+}
+
+/*
+ *  scan_block
+ *      sc:  scan in progress
+ *
+ *  Reads the next block of records and computes its live mask.  sc->blk,
+ *  sc->nrecs, sc->live and sc->mask describe the block afterwards.
+ *
+ *  returns:  1              a block was read
+ *            0              no more blocks
+ *            ERR_DB_FILE    I/O error, or the file ends in a partial record
+ */
+static int scan_block(scan_t *sc)
+{
+    off_t len;
+    int rc;
+
+    rc = sc->paged ? next_pages(sc, &len) : next_block(sc, &len);
+    if (rc <= 0)
+        return rc;
+
+    if (sc->map != NULL)
+    {
+        sc->blk = sc->map + sc->pos / STUDENT_RECORD_SIZE;
+    }
+    else
+    {
+        ssize_t got = pread(sc->fd, sc->buf, len, sc->pos);
+        if (got < STUDENT_RECORD_SIZE)
+            return ERR_DB_FILE;
+        len = got - got % STUDENT_RECORD_SIZE;
+        sc->blk = sc->buf;
+    }
+
+    sc->blk_off = sc->pos;
+    sc->nrecs = (int)(len / STUDENT_RECORD_SIZE);
+    sc->live = live_mask(sc->blk, sc->nrecs, sc->mask);
+    count_records_touched(sc->nrecs);
+    sc->next = 0;
+    sc->pos += len;
+    return 1;
+}
+
+/*
+ *  scan_next
+ *      sc:    scan in progress
+ *      *s:    where the next live record is copied
+ *      *pos:  where the file offset of that record is stored
+ *
+ *  returns:  1              a record was returned
+ *            0              no more records
+ *            ERR_DB_FILE    I/O error, or the file ends in a partial record
+ */
+static int scan_next(scan_t *sc, student_t *s, off_t *pos)
+{
+    int rc;
+
+    for (;;)
+    {
+        while (sc->next < sc->nrecs)
+        {
+            int w = sc->next / 64;
+            uint64_t bits = sc->mask[w] & (~(uint64_t)0 << (sc->next % 64));
+
+            if (bits == 0)
+            {
+                sc->next = (w + 1) * 64;
+                continue;
+            }
+
+            int i = w * 64 + __builtin_ctzll(bits);
+            if (i >= sc->nrecs)
+                break;
+            *s = sc->blk[i];
+            *pos = sc->blk_off + (off_t)i * STUDENT_RECORD_SIZE;
+            sc->next = i + 1;
+            return 1;
+        }
+
+        if ((rc = scan_block(sc)) <= 0)
+            return rc;
+    }
+}
+
+/*
+ *  Parallel scans
+ *
+ *  With -j N, count_db_records(), print_db() and compress_db() split the
+ *  file into N ranges of whole records and scan them on N threads, each with
+ *  its own scan_t and its own pread() offsets.  Every thread keeps its
+ *  results to itself (a count, the formatted print_db() lines or the live
+ *  records compress_db() copies) and the caller combines them in range
+ *  order, so the result is exactly what a single threaded scan produces.
+ */
+#define SCAN_MAX_THREADS    64
+#define PSCAN_LINE_MAX      128     // longest line STUDENT_PRINT_FMT_STRING makes
+
+enum { PSCAN_COUNT, PSCAN_PRINT, PSCAN_COPY };
+
+typedef struct pscan{
+    scan_t sc;
+    pthread_t tid;
+    int kind;           // PSCAN_COUNT, PSCAN_PRINT or PSCAN_COPY
+    int count;          // live records in the range
+    char *text;         // PSCAN_PRINT: formatted lines
+    size_t text_len;
+    size_t text_cap;
+    student_t *recs;    // PSCAN_COPY: the live records, count of them
+    size_t recs_cap;
+    int rc;             // NO_ERROR or ERR_DB_FILE
+} pscan_t;
+
+static int scan_threads = 1;
+
+/*
+ *  set_scan_threads
+ *      n:  number of threads used by full scans
+ *
+ *  returns:  NO_ERROR       on success
+ *            EXIT_FAIL_ARGS if n is not between 1 and SCAN_MAX_THREADS
+ *
+ *  console:  This function does not produce any output
+ */
+int set_scan_threads(int n)
+{
+    if (n < 1 || n > SCAN_MAX_THREADS)
+        return EXIT_FAIL_ARGS;
+
+    scan_threads = n;
+    return NO_ERROR;
+}
+
+static void *pscan_worker(void *arg)
+{
+    pscan_t *ps = arg;
+    int rc;
+
+    while ((rc = scan_block(&ps->sc)) > 0)
+    {
+        if (ps->kind == PSCAN_COUNT)
+        {
+            ps->count += ps->sc.live;
+            continue;
+        }
+
+        for (int i = 0; i < ps->sc.nrecs; i++)
+        {
+            student_t *s = &ps->sc.blk[i];
+
+            if (((ps->sc.mask[i / 64] >> (i % 64)) & 1) == 0)
+                continue;
+
+            if (ps->kind == PSCAN_PRINT)
+            {
+                if (ps->text_cap - ps->text_len < PSCAN_LINE_MAX)
+                {
+                    size_t cap = ps->text_cap ? ps->text_cap * 2 : 1 << 16;
+                    char *bigger = realloc(ps->text, cap);
+                    if (bigger == NULL)
+                    {
+                        ps->rc = ERR_DB_FILE;
+                        return NULL;
+                    }
+                    ps->text = bigger;
+                    ps->text_cap = cap;
+                }
+                ps->text_len += snprintf(ps->text + ps->text_len,
+                                         ps->text_cap - ps->text_len,
+                                         STUDENT_PRINT_FMT_STRING, s->id, s->fname,
+                                         s->lname, s->gpa / 100.0);
+            }
+            else
+            {
+                if ((size_t)ps->count == ps->recs_cap)
+                {
+                    size_t cap = ps->recs_cap ? ps->recs_cap * 2 : 4096;
+                    student_t *bigger = realloc(ps->recs, cap * sizeof(student_t));
+                    if (bigger == NULL)
+                    {
+                        ps->rc = ERR_DB_FILE;
+                        return NULL;
+                    }
+                    ps->recs = bigger;
+                    ps->recs_cap = cap;
+                }
+                ps->recs[ps->count] = *s;
+            }
+            ps->count++;
+        }
+    }
+
+    ps->rc = rc < 0 ? ERR_DB_FILE : NO_ERROR;
+    return NULL;
+}
+
+/*
+ *  pscan_free
+ *      parts:   ranges returned by parallel_scan()
+ *      nparts:  number of ranges
+ */
+static void pscan_free(pscan_t *parts, int nparts)
+{
+    for (int i = 0; i < nparts; i++)
+    {
+        scan_end(&parts[i].sc);
+        free(parts[i].text);
+        free(parts[i].recs);
+    }
+    free(parts);
+}
+
+/*
+ *  parallel_scan
+ *      fd:      linux file descriptor
+ *      kind:    PSCAN_COUNT, PSCAN_PRINT or PSCAN_COPY
+ *      *parts:  set to the scanned ranges, in file order.  Release them
+ *               with pscan_free()
+ *
+ *  Scans the database on scan_threads threads.  The scans are set up here,
+ *  before any thread starts, so map_db() is only ever called from the
+ *  calling thread.
+ *
+ *  returns:  number of ranges on success, ERR_DB_FILE on failure
+ */
+static int parallel_scan(int fd, int kind, pscan_t **parts)
+{
+    int nparts = scan_threads;
+    int started = 0;
+    int rc = NO_ERROR;
+    off_t size, chunk;
+    pscan_t *ps;
+
+    ps = calloc(nparts, sizeof(*ps));
+    if (ps == NULL)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < nparts; i++)
+    {
+        if (scan_begin(&ps[i].sc, fd) != NO_ERROR)
+        {
+            pscan_free(ps, i);
+            return ERR_DB_FILE;
+        }
+        ps[i].kind = kind;
+    }
+
+    // the data pages of a paged file are listed once and shared out in id
+    // order, see Record scanner, other files are split into byte ranges
+    if (ps[0].sc.paged)
+    {
+        if (scan_pages(&ps[0].sc) != NO_ERROR)
+        {
+            pscan_free(ps, nparts);
+            return ERR_DB_FILE;
+        }
+        chunk = (ps[0].sc.page_end + nparts - 1) / nparts;
+        for (int i = nparts - 1; i >= 0; i--)
+        {
+            off_t start = chunk * i;
+            off_t stop = start + chunk;
+
+            ps[i].sc.pages = ps[0].sc.pages;
+            ps[i].sc.own_pages = i == 0;
+            ps[i].sc.page_end = stop < ps[0].sc.page_end ? stop : ps[0].sc.page_end;
+            ps[i].sc.page_next = start < ps[i].sc.page_end ? start : ps[i].sc.page_end;
+        }
+    }
+    else
+    {
+        // whole 4K pages of records per thread
+        size = ps[0].sc.size;
+        chunk = (size + nparts - 1) / nparts;
+        chunk += (64 * STUDENT_RECORD_SIZE - chunk % (64 * STUDENT_RECORD_SIZE)) %
+                 (64 * STUDENT_RECORD_SIZE);
+        for (int i = 0; i < nparts; i++)
+        {
+            off_t start = chunk * i;
+            off_t stop = start + chunk;
+
+            ps[i].sc.pos = start < size ? start : size;
+            ps[i].sc.size = stop < size ? stop : size;
+        }
+    }
+
+    for (; started < nparts; started++)
+        if (pthread_create(&ps[started].tid, NULL, pscan_worker, &ps[started]) != 0)
+            break;
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(ps[i].tid, NULL);
+        if (ps[i].rc != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+
+    if (started < nparts || rc != NO_ERROR)
+    {
+        pscan_free(ps, nparts);
+        return ERR_DB_FILE;
+    }
+
+    *parts = ps;
+    return nparts;
+}
+
+/*
+ *  Packed index
+ *
+ *  compress_db() packs the live records starting at slot 1, so a student is
+ *  no longer at id * STUDENT_RECORD_SIZE.  DB_IDX_FILE (see db.h) maps each
+ *  id of a packed file to its slot so get/add/del still find a student with
+ *  one or two pread() calls instead of a scan.  Students added to a packed
+ *  file are appended after the last record and entered in the index,
+ *  deleted ones keep their bucket with slot 0.  The table is only read a
+ *  few buckets at a time, so opening a packed database does not load it.
+ */
+#define IDX_MIN_BUCKETS     64
+#define IDX_PROBE_RUN       8       // buckets read per pread() while probing
+
+static db_idx_hdr_t db_idx;         // preamble of DB_IDX_FILE, nbuckets 0 if not loaded
+static int db_idx_fd = -1;          // fd of DB_IDX_FILE
+
+static bool have_index(int fd)
+{
+    return have_header(fd) && db_hdr.layout == DB_LAYOUT_PACKED &&
+           db_idx.nbuckets != 0;
+}
+
+// Fibonacci hashing, the top bits of id * 2^32 / phi pick the home bucket
+static uint32_t idx_home(int id, uint32_t nbuckets)
+{
+    return ((uint32_t)id * 2654435761u) >> (32 - __builtin_ctz(nbuckets));
+}
+
+static off_t idx_offset(uint32_t bucket)
+{
+    return sizeof(db_idx_hdr_t) + (off_t)bucket * sizeof(db_idx_entry_t);
+}
+
+/*
+ *  open_index
+ *
+ *  Opens (creating if needed) DB_IDX_FILE and loads its preamble into
+ *  db_idx if it belongs to the header in db_hdr.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure.  db_idx.nbuckets
+ *            is 0 if the index is missing or stale
+ */
+static int open_index(void)
+{
+    db_idx_hdr_t ih;
+    struct stat st;
+
+    memset(&db_idx, 0, sizeof(db_idx));
+    if (db_idx_fd == -1)
+    {
+        db_idx_fd = open(DB_IDX_FILE, O_RDWR | O_CREAT,
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (db_idx_fd == -1)
+            return ERR_DB_FILE;
+    }
+
+    if (pread(db_idx_fd, &ih, sizeof(ih), 0) != sizeof(ih) ||
+        fstat(db_idx_fd, &st) == -1)
+        return NO_ERROR;
+
+    if (memcmp(ih.magic, DB_IDX_MAGIC, sizeof(ih.magic)) == 0 &&
+        ih.generation == db_hdr.generation &&
+        ih.nbuckets >= IDX_MIN_BUCKETS && (ih.nbuckets & (ih.nbuckets - 1)) == 0 &&
+        ih.used < ih.nbuckets && st.st_size >= idx_offset(ih.nbuckets))
+        db_idx = ih;
+
+    return NO_ERROR;
+}
+
+/*
+ *  write_index
+ *      slots:  MAX_STD_ID + 1 entries, slots[id] is the slot of student id
+ *              or 0 if the student is not in the database
+ *
+ *  Writes a new DB_IDX_FILE holding every student in slots, sized to be at
+ *  most half full, tagged with the generation of db_hdr.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_index(const int *slots)
+{
+    db_idx_hdr_t ih = {0};
+    db_idx_entry_t *table;
+    size_t len;
+    int n = 0;
+    bool ok;
+
+    if (db_idx_fd == -1 && open_index() != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID; id++)
+        n += slots[id] != 0;
+
+    memcpy(ih.magic, DB_IDX_MAGIC, sizeof(ih.magic));
+    ih.generation = db_hdr.generation;
+    ih.nbuckets = IDX_MIN_BUCKETS;
+    while (ih.nbuckets < 2 * (unsigned int)n)
+        ih.nbuckets *= 2;
+    ih.used = n;
+
+    len = (size_t)ih.nbuckets * sizeof(db_idx_entry_t);
+    table = calloc(ih.nbuckets, sizeof(db_idx_entry_t));
+    if (table == NULL)
+        return ERR_DB_FILE;
+
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID; id++)
+    {
+        uint32_t b;
+
+        if (slots[id] == 0)
+            continue;
+        for (b = idx_home(id, ih.nbuckets); table[b].id != 0; b = (b + 1) & (ih.nbuckets - 1))
+            ;
+        table[b].id = id;
+        table[b].slot = slots[id];
+    }
+
+    ok = pwrite(db_idx_fd, &ih, sizeof(ih), 0) == sizeof(ih) &&
+         pwrite(db_idx_fd, table, len, sizeof(ih)) == (ssize_t)len &&
+         ftruncate(db_idx_fd, idx_offset(ih.nbuckets)) == 0;
+    free(table);
+    if (!ok)
+        return ERR_DB_FILE;
+
+    db_idx = ih;
+    return NO_ERROR;
+}
+
+/*
+ *  idx_find
+ *      id:       student id to look up
+ *      *bucket:  set to the bucket holding id, or to the free bucket that
+ *                ends its probe sequence if id is not in the index
+ *      *e:       set to the contents of that bucket
+ *
+ *  returns:  1 if id has a bucket, 0 if not, ERR_DB_FILE on read errors
+ */
+static int idx_find(int id, uint32_t *bucket, db_idx_entry_t *e)
+{
+    db_idx_entry_t run[IDX_PROBE_RUN];
+    uint32_t b = idx_home(id, db_idx.nbuckets);
+
+    // the table is never full, so a free bucket always ends the probing
+    for (;;)
+    {
+        uint32_t n = db_idx.nbuckets - b < IDX_PROBE_RUN ? db_idx.nbuckets - b : IDX_PROBE_RUN;
+        ssize_t len = (ssize_t)n * sizeof(db_idx_entry_t);
+
+        if (pread(db_idx_fd, run, len, idx_offset(b)) != len)
+            return ERR_DB_FILE;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (run[i].id == id || run[i].id == 0)
+            {
+                *bucket = b + i;
+                *e = run[i];
+                return run[i].id == id;
+            }
+        }
+        b = (b + n) & (db_idx.nbuckets - 1);
+    }
+}
+
+/*
+ *  idx_lookup
+ *      id:  student id
+ *
+ *  returns:  the slot of student id, 0 if it is not in the index, or
+ *            ERR_DB_FILE on read errors
+ */
+static int idx_lookup(int id)
+{
+    db_idx_entry_t e;
+    uint32_t b;
+    int rc = idx_find(id, &b, &e);
+
+    if (rc <= 0)
+        return rc;
+    return e.slot;
+}
+
+/*
+ *  refresh_index
+ *
+ *  Rereads the preamble of DB_IDX_FILE, which another process may have
+ *  rewritten with more buckets since it was loaded (see idx_merge()).
+ *  Lookups that do not hold the metadata lock call this when they miss.
+ *
+ *  returns:  true if the table changed size and the lookup should be
+ *            repeated
+ */
+static bool refresh_index(void)
+{
+    uint32_t nbuckets = db_idx.nbuckets;
+
+    return open_index() == NO_ERROR && db_idx.nbuckets != 0 &&
+           db_idx.nbuckets != nbuckets;
+}
+
+/*
+ *  idx_merge
+ *      add:  entries to enter into the index
+ *      n:    number of entries
+ *
+ *  Rewrites the index with the current entries plus add, see write_index(),
+ *  which also drops the buckets of deleted students.  Used to grow the
+ *  table and to enter many students at once.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int idx_merge(const db_idx_entry_t *add, int n)
+{
+    size_t len = (size_t)db_idx.nbuckets * sizeof(db_idx_entry_t);
+    db_idx_entry_t *table = malloc(len);
+    int *slots = calloc(MAX_STD_ID + 1, sizeof(int));
+    int rc = ERR_DB_FILE;
+
+    if (table != NULL && slots != NULL &&
+        pread(db_idx_fd, table, len, sizeof(db_idx_hdr_t)) == (ssize_t)len)
+    {
+        for (uint32_t b = 0; b < db_idx.nbuckets; b++)
+        {
+            if (table[b].id >= MIN_STD_ID && table[b].id <= MAX_STD_ID)
+                slots[table[b].id] = table[b].slot;
+        }
+        for (int i = 0; i < n; i++)
+            slots[add[i].id] = add[i].slot;
+        rc = write_index(slots);
+    }
+
+    free(table);
+    free(slots);
+    return rc;
+}
+
+/*
+ *  idx_put
+ *      id:    student id
+ *      slot:  slot the student now lives in, 0 if it was deleted
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int idx_put(int id, int slot)
+{
+    db_idx_entry_t e;
+    uint32_t b;
+    int rc = idx_find(id, &b, &e);
+
+    if (rc < 0)
+        return ERR_DB_FILE;
+
+    if (rc == 0)
+    {
+        if (slot == 0)
+            return NO_ERROR;
+        if ((db_idx.used + 1) * 4 > db_idx.nbuckets * 3)
+        {
+            e.id = id;
+            e.slot = slot;
+            return idx_merge(&e, 1);
+        }
+
+        db_idx.used++;
+        if (pwrite(db_idx_fd, &db_idx, sizeof(db_idx), 0) != sizeof(db_idx))
+            return ERR_DB_FILE;
+    }
+
+    e.id = id;
+    e.slot = slot;
+    if (pwrite(db_idx_fd, &e, sizeof(e), idx_offset(b)) != sizeof(e))
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  Name index
+ *
+ *  -n finds students by last name through DB_NAME_FILE (see db.h), a hash
+ *  table like the packed index but keyed on a hash of lname.  Students that
+ *  share a last name each have a bucket in the probe sequence of its hash,
+ *  so a lookup reads IDX_PROBE_RUN buckets at a time up to the next free
+ *  bucket and then the records of the candidates.  Their names are compared
+ *  there, so a hash collision costs a pread() but never a wrong answer.
+ *
+ *  The first -n builds the index with one scan.  From then on note_student()
+ *  keeps it current on every add and delete and compress_db() carries it
+ *  over to the new file.  A bulk load drops it, rebuilding it with the next
+ *  -n is cheaper than an insert per student.
+ */
+static db_idx_hdr_t db_names;       // preamble of DB_NAME_FILE, nbuckets 0 if not in use
+static int db_names_fd = -1;        // fd of DB_NAME_FILE, -1 if it does not exist
+
+// FNV-1a of the last name, 0 is kept for free buckets
+static uint32_t name_hash(const student_t *s)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(s->lname) && s->lname[i] != '\0'; i++)
+    {
+        h ^= (unsigned char)s->lname[i];
+        h *= 16777619u;
+    }
+    return h != 0 ? h : 1;
+}
+
+/*
+ *  open_names
+ *      create:  true to create DB_NAME_FILE if it does not exist
+ *
+ *  Opens DB_NAME_FILE and loads its preamble into db_names if it belongs to
+ *  the header in db_hdr.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure.  db_names.nbuckets
+ *            is 0 if the index is missing or stale
+ */
+static int open_names(bool create)
+{
+    db_idx_hdr_t nh;
+    struct stat st;
+
+    memset(&db_names, 0, sizeof(db_names));
+    if (db_names_fd == -1)
+    {
+        db_names_fd = open(DB_NAME_FILE, O_RDWR | (create ? O_CREAT : 0),
+                           S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (db_names_fd == -1)
+            return create || errno != ENOENT ? ERR_DB_FILE : NO_ERROR;
+    }
+
+    if (pread(db_names_fd, &nh, sizeof(nh), 0) != sizeof(nh) ||
+        fstat(db_names_fd, &st) == -1)
+        return NO_ERROR;
+
+    if (memcmp(nh.magic, DB_NAME_MAGIC, sizeof(nh.magic)) == 0 &&
+        nh.generation == db_hdr.generation &&
+        nh.nbuckets >= IDX_MIN_BUCKETS && (nh.nbuckets & (nh.nbuckets - 1)) == 0 &&
+        nh.used < nh.nbuckets && st.st_size >= idx_offset(nh.nbuckets))
+        db_names = nh;
+
+    return NO_ERROR;
+}
+
+/*
+ *  write_names
+ *      ents:  the students to enter, id 0 entries are skipped
+ *      n:     number of entries
+ *
+ *  Writes a new DB_NAME_FILE holding ents, sized to be at most half full,
+ *  tagged with the generation of db_hdr.  The old preamble is cleared
+ *  first so a table that was only partly written is never used.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_names(const db_name_entry_t *ents, int n)
+{
+    db_idx_hdr_t nh = {0};
+    db_name_entry_t *table;
+    size_t len;
+    bool ok;
+
+    if (db_names_fd == -1 && open_names(true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    memcpy(nh.magic, DB_NAME_MAGIC, sizeof(nh.magic));
+    nh.generation = db_hdr.generation;
+    nh.nbuckets = IDX_MIN_BUCKETS;
+    while (nh.nbuckets < 2 * (unsigned int)n)
+        nh.nbuckets *= 2;
+
+    len = (size_t)nh.nbuckets * sizeof(db_name_entry_t);
+    table = calloc(nh.nbuckets, sizeof(db_name_entry_t));
+    if (table == NULL)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t b;
+
+        if (ents[i].id == 0)
+            continue;
+        for (b = idx_home((int)ents[i].hash, nh.nbuckets); table[b].hash != 0;
+             b = (b + 1) & (nh.nbuckets - 1))
+            ;
+        table[b] = ents[i];
+        nh.used++;
+    }
+
+    memset(&db_names, 0, sizeof(db_names));
+    ok = pwrite(db_names_fd, &db_names, sizeof(db_names), 0) == sizeof(db_names) &&
+         pwrite(db_names_fd, table, len, sizeof(nh)) == (ssize_t)len &&
+         ftruncate(db_names_fd, idx_offset(nh.nbuckets)) == 0 &&
+         pwrite(db_names_fd, &nh, sizeof(nh), 0) == sizeof(nh);
+    free(table);
+    if (!ok)
+        return ERR_DB_FILE;
+
+    db_names = nh;
+    return NO_ERROR;
+}
+
+/*
+ *  read_names
+ *      *ents:  set to the live entries of the loaded index, free() them
+ *      extra:  number of entries to leave room for after them
+ *
+ *  returns:  the number of live entries, ERR_DB_FILE on failure
+ */
+static int read_names(db_name_entry_t **ents, int extra)
+{
+    size_t len = (size_t)db_names.nbuckets * sizeof(db_name_entry_t);
+    db_name_entry_t *table = malloc(len + extra * sizeof(db_name_entry_t));
+    int n = 0;
+
+    if (table == NULL ||
+        pread(db_names_fd, table, len, sizeof(db_idx_hdr_t)) != (ssize_t)len)
+    {
+        free(table);
+        return ERR_DB_FILE;
+    }
+
+    for (uint32_t b = 0; b < db_names.nbuckets; b++)
+    {
+        if (table[b].id != 0)
+            table[n++] = table[b];
+    }
+    *ents = table;
+    return n;
+}
+
+/*
+ *  build_names
+ *      fd:  linux file descriptor
+ *
+ *  Scans the database and writes a new DB_NAME_FILE for its students.  The
+ *  caller holds a lock that keeps writers out, see find_by_name().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int build_names(int fd)
+{
+    db_name_entry_t *ents = NULL;
+    int n = 0, cap = 0;
+    student_t s;
+    off_t pos;
+    scan_t sc;
+    int rc;
+
+    if (scan_begin(&sc, fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    while ((rc = scan_next(&sc, &s, &pos)) > 0)
+    {
+        if (n == cap)
+        {
+            db_name_entry_t *grown;
+
+            cap = cap == 0 ? 1024 : cap * 2;
+            grown = realloc(ents, cap * sizeof(*ents));
+            if (grown == NULL)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            ents = grown;
+        }
+        ents[n].hash = name_hash(&s);
+        ents[n].id = s.id;
+        n++;
+    }
+    scan_end(&sc);
+
+    if (rc == 0)
+        rc = write_names(ents, n);
+    free(ents);
+    return rc == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  names_put
+ *      s:      the student that was added or deleted
+ *      added:  true if s was added
+ *
+ *  Enters s in the index or marks its bucket deleted.  Does nothing if the
+ *  index is not in use.  Called with slot 0 locked, see note_student().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int names_put(const student_t *s, bool added)
+{
+    db_name_entry_t run[IDX_PROBE_RUN];
+    db_name_entry_t e = { name_hash(s), s->id };
+    db_name_entry_t cur;
+    uint32_t b;
+
+    // another process may have grown, dropped or created the index
+    if (open_names(false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_names.nbuckets == 0)
+        return NO_ERROR;
+
+    // an add takes the first free or deleted bucket, a delete looks for
+    // the bucket of s up to the first free one
+    b = idx_home((int)e.hash, db_names.nbuckets);
+    for (;;)
+    {
+        uint32_t n = db_names.nbuckets - b < IDX_PROBE_RUN ? db_names.nbuckets - b : IDX_PROBE_RUN;
+        ssize_t len = (ssize_t)n * sizeof(db_name_entry_t);
+        uint32_t i;
+
+        if (pread(db_names_fd, run, len, idx_offset(b)) != len)
+            return ERR_DB_FILE;
+
+        for (i = 0; i < n; i++)
+        {
+            if (run[i].hash == 0 || (added && run[i].id == 0) ||
+                (!added && run[i].hash == e.hash && run[i].id == e.id))
+                break;
+        }
+        if (i < n)
+        {
+            b += i;
+            cur = run[i];
+            break;
+        }
+        b = (b + n) & (db_names.nbuckets - 1);
+    }
+
+    if (!added)
+    {
+        if (cur.hash == 0)
+            return NO_ERROR;
+        e.id = 0;
+    }
+    else if (cur.hash == 0)
+    {
+        if ((db_names.used + 1) * 4 > db_names.nbuckets * 3)
+        {
+            db_name_entry_t *ents;
+            int n = read_names(&ents, 1);
+            int rc;
+
+            if (n < 0)
+                return ERR_DB_FILE;
+            ents[n++] = e;
+            rc = write_names(ents, n);
+            free(ents);
+            return rc;
+        }
+
+        db_names.used++;
+        if (pwrite(db_names_fd, &db_names, sizeof(db_names), 0) != sizeof(db_names))
+            return ERR_DB_FILE;
+    }
+
+    if (pwrite(db_names_fd, &e, sizeof(e), idx_offset(b)) != sizeof(e))
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  carry_names
+ *
+ *  Rewrites the index loaded by open_names() for the generation now in
+ *  db_hdr, dropping its deleted buckets.  Used by compress_db() and
+ *  convert_db(), which keep the ids of every student.  Does nothing if the
+ *  index was not in use.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int carry_names(void)
+{
+    db_name_entry_t *ents;
+    int n;
+    int rc;
+
+    if (db_names.nbuckets == 0)
+        return NO_ERROR;
+
+    n = read_names(&ents, 0);
+    if (n < 0)
+        return ERR_DB_FILE;
+    rc = write_names(ents, n);
+    free(ents);
+    return rc;
+}
+
+/*
+ *  drop_names
+ *
+ *  Empties DB_NAME_FILE so every process stops maintaining it, until the
+ *  next -n builds it again.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int drop_names(void)
+{
+    if (open_names(false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_names_fd != -1 && ftruncate(db_names_fd, 0) == -1)
+        return ERR_DB_FILE;
+
+    memset(&db_names, 0, sizeof(db_names));
+    return NO_ERROR;
+}
+
+/*
+ *  GPA index
+ *
+ *  -g and -t find students by gpa through DB_GPA_FILE (see db.h), which
+ *  keeps the ids of the students with each of the MAX_STD_GPA + 1 gpas in
+ *  a chain of blocks.  A query reads the lists of all gpas with one pread()
+ *  and then only the blocks and records of the gpas it asks for, so it
+ *  costs about one read per student printed however large the file is.
+ *
+ *  The index has the same life as the name index: the first query builds
+ *  it with one scan, with every block of a gpa next to each other, and from
+ *  then on note_student() keeps it current.  The ids and gpas do not change
+ *  when compress_db() or convert_db() rewrite the file, so they only tag
+ *  the index with the new generation.  A bulk load drops it.
+ */
+static db_gpa_hdr_t db_gpa;         // preamble of DB_GPA_FILE, nblocks 0 if not in use
+static int db_gpa_fd = -1;          // fd of DB_GPA_FILE, -1 if it does not exist
+
+static off_t gpa_list_offset(int gpa)
+{
+    return sizeof(db_gpa_hdr_t) + (off_t)gpa * sizeof(db_gpa_list_t);
+}
+
+static off_t gpa_block_offset(int block)
+{
+    return DB_GPA_BLOCKS + (off_t)(block - 1) * sizeof(db_gpa_block_t);
+}
+
+/*
+ *  open_gpa
+ *      create:  true to create DB_GPA_FILE if it does not exist
+ *
+ *  Opens DB_GPA_FILE and loads its preamble into db_gpa if it belongs to
+ *  the header in db_hdr.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure.  db_gpa.nblocks
+ *            is 0 if the index is missing or stale
+ */
+static int open_gpa(bool create)
+{
+    db_gpa_hdr_t gh;
+    struct stat st;
+
+    memset(&db_gpa, 0, sizeof(db_gpa));
+    if (db_gpa_fd == -1)
+    {
+        db_gpa_fd = open(DB_GPA_FILE, O_RDWR | (create ? O_CREAT : 0),
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (db_gpa_fd == -1)
+            return create || errno != ENOENT ? ERR_DB_FILE : NO_ERROR;
+    }
+
+    if (pread(db_gpa_fd, &gh, sizeof(gh), 0) != sizeof(gh) ||
+        fstat(db_gpa_fd, &st) == -1)
+        return NO_ERROR;
+
+    // nblocks counts block 0 too, so an index without students is in use
+    if (memcmp(gh.magic, DB_GPA_MAGIC, sizeof(gh.magic)) == 0 &&
+        gh.generation == db_hdr.generation && gh.nblocks > 0 &&
+        gh.free_block >= 0 && (unsigned int)gh.free_block < gh.nblocks &&
+        st.st_size >= gpa_block_offset(gh.nblocks))
+        db_gpa = gh;
+
+    return NO_ERROR;
+}
+
+/*
+ *  build_gpa
+ *      fd:  linux file descriptor
+ *
+ *  Scans the database and writes a new DB_GPA_FILE for its students, tagged
+ *  with the generation of db_hdr.  The caller holds a lock that keeps
+ *  writers out, see find_by_gpa().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int build_gpa(int fd)
+{
+    db_gpa_list_t lists[MAX_STD_GPA + 1] = {{0}};
+    db_gpa_hdr_t gh = {0};
+    db_gpa_block_t *blocks = NULL;
+    int *next_id = NULL;        // where the next id of each gpa goes, from the end
+    int *ids = NULL;
+    int n = 0, cap = 0, nblocks = 0;
+    student_t s;
+    off_t pos;
+    scan_t sc;
+    size_t len;
+    bool ok;
+    int rc;
+
+    if (scan_begin(&sc, fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // two passes over the ids found: count them per gpa, then fill the
+    // blocks, full ones first so the head block is the partial one
+    while ((rc = scan_next(&sc, &s, &pos)) > 0)
+    {
+        if (s.gpa < MIN_STD_GPA || s.gpa > MAX_STD_GPA)
+            continue;
+        if (n == cap)
+        {
+            int *grown;
+
+            cap = cap == 0 ? 2048 : cap * 2;
+            grown = realloc(ids, cap * 2 * sizeof(int));
+            if (grown == NULL)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            ids = grown;
+        }
+        ids[2 * n] = s.gpa;
+        ids[2 * n + 1] = s.id;
+        lists[s.gpa].count++;
+        n++;
+    }
+    scan_end(&sc);
+    if (rc != 0)
+    {
+        free(ids);
+        return ERR_DB_FILE;
+    }
+
+    for (int g = MIN_STD_GPA; g <= MAX_STD_GPA; g++)
+    {
+        if (lists[g].count > 0)
+        {
+            lists[g].head = nblocks + 1;
+            nblocks += (lists[g].count + DB_GPA_BLOCK_IDS - 1) / DB_GPA_BLOCK_IDS;
+        }
+    }
+
+    blocks = calloc(nblocks > 0 ? nblocks : 1, sizeof(db_gpa_block_t));
+    next_id = calloc(MAX_STD_GPA + 1, sizeof(int));
+    if (blocks == NULL || next_id == NULL)
+    {
+        free(ids);
+        free(blocks);
+        free(next_id);
+        return ERR_DB_FILE;
+    }
+
+    for (int g = MIN_STD_GPA; g <= MAX_STD_GPA; g++)
+    {
+        int nb = (lists[g].count + DB_GPA_BLOCK_IDS - 1) / DB_GPA_BLOCK_IDS;
+
+        for (int b = 0; b < nb; b++)
+        {
+            db_gpa_block_t *blk = &blocks[lists[g].head - 1 + b];
+
+            blk->next = b + 1 < nb ? lists[g].head + b + 1 : 0;
+            blk->n = b == 0 ? lists[g].count - (nb - 1) * DB_GPA_BLOCK_IDS : DB_GPA_BLOCK_IDS;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int g = ids[2 * i];
+        int k = next_id[g]++;
+        int nb = (lists[g].count + DB_GPA_BLOCK_IDS - 1) / DB_GPA_BLOCK_IDS;
+        int head_n = lists[g].count - (nb - 1) * DB_GPA_BLOCK_IDS;
+        int b = k < head_n ? 0 : 1 + (k - head_n) / DB_GPA_BLOCK_IDS;
+        int slot = k < head_n ? k : (k - head_n) % DB_GPA_BLOCK_IDS;
+
+        blocks[lists[g].head - 1 + b].ids[slot] = ids[2 * i + 1];
+    }
+    free(ids);
+    free(next_id);
+
+    if (db_gpa_fd == -1 && open_gpa(true) != NO_ERROR)
+    {
+        free(blocks);
+        return ERR_DB_FILE;
+    }
+
+    memcpy(gh.magic, DB_GPA_MAGIC, sizeof(gh.magic));
+    gh.generation = db_hdr.generation;
+    gh.nblocks = nblocks + 1;
+
+    // the old preamble is cleared first so a partly written index is
+    // never used
+    memset(&db_gpa, 0, sizeof(db_gpa));
+    len = (size_t)nblocks * sizeof(db_gpa_block_t);
+    ok = pwrite(db_gpa_fd, &db_gpa, sizeof(db_gpa), 0) == sizeof(db_gpa) &&
+         pwrite(db_gpa_fd, lists, sizeof(lists), gpa_list_offset(0)) == sizeof(lists) &&
+         pwrite(db_gpa_fd, blocks, len, gpa_block_offset(1)) == (ssize_t)len &&
+         ftruncate(db_gpa_fd, gpa_block_offset(gh.nblocks)) == 0 &&
+         pwrite(db_gpa_fd, &gh, sizeof(gh), 0) == sizeof(gh);
+    free(blocks);
+    if (!ok)
+        return ERR_DB_FILE;
+
+    db_gpa = gh;
+    return NO_ERROR;
+}
+
+static int read_gpa_block(int block, db_gpa_block_t *blk)
+{
+    if (pread(db_gpa_fd, blk, sizeof(*blk), gpa_block_offset(block)) != sizeof(*blk) ||
+        blk->n < 0 || blk->n > DB_GPA_BLOCK_IDS)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_gpa_block(int block, const db_gpa_block_t *blk)
+{
+    if (pwrite(db_gpa_fd, blk, sizeof(*blk), gpa_block_offset(block)) != sizeof(*blk))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  gpa_put
+ *      s:      the student that was added or deleted
+ *      added:  true if s was added
+ *
+ *  Enters s in the list of its gpa or takes it out.  Does nothing if the
+ *  index is not in use.  Called with slot 0 locked, see note_student().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int gpa_put(const student_t *s, bool added)
+{
+    db_gpa_list_t list;
+    db_gpa_block_t head, blk;
+
+    // another process may have changed the preamble or dropped the index
+    if (open_gpa(false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_gpa.nblocks == 0 || s->gpa < MIN_STD_GPA || s->gpa > MAX_STD_GPA)
+        return NO_ERROR;
+
+    if (pread(db_gpa_fd, &list, sizeof(list), gpa_list_offset(s->gpa)) != sizeof(list) ||
+        (list.head != 0 && read_gpa_block(list.head, &head) != NO_ERROR))
+        return ERR_DB_FILE;
+
+    if (added)
+    {
+        if (list.head != 0 && head.n < DB_GPA_BLOCK_IDS)
+        {
+            head.ids[head.n++] = s->id;
+            if (write_gpa_block(list.head, &head) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+        else
+        {
+            int b = db_gpa.free_block;
+
+            // a new head block, from the free chain or the end of the file
+            if (b != 0)
+            {
+                if (read_gpa_block(b, &blk) != NO_ERROR)
+                    return ERR_DB_FILE;
+                db_gpa.free_block = blk.next;
+            }
+            else
+            {
+                b = db_gpa.nblocks++;
+            }
+
+            memset(&blk, 0, sizeof(blk));
+            blk.next = list.head;
+            blk.n = 1;
+            blk.ids[0] = s->id;
+            list.head = b;
+            if (write_gpa_block(b, &blk) != NO_ERROR ||
+                pwrite(db_gpa_fd, &db_gpa, sizeof(db_gpa), 0) != sizeof(db_gpa))
+                return ERR_DB_FILE;
+        }
+        list.count++;
+    }
+    else
+    {
+        int b = list.head;
+        int i = -1;
+
+        // find s, then fill its place with the last id of the head block
+        for (; b != 0; b = blk.next)
+        {
+            if (b == list.head)
+                blk = head;
+            else if (read_gpa_block(b, &blk) != NO_ERROR)
+                return ERR_DB_FILE;
+
+            for (i = 0; i < blk.n && blk.ids[i] != s->id; i++)
+                ;
+            if (i < blk.n)
+                break;
+        }
+        if (b == 0)
+            return NO_ERROR;
+
+        if (b == list.head)
+        {
+            head.ids[i] = head.ids[head.n - 1];
+        }
+        else
+        {
+            blk.ids[i] = head.ids[head.n - 1];
+            if (write_gpa_block(b, &blk) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+        head.ids[--head.n] = 0;
+
+        if (head.n == 0)
+        {
+            b = list.head;
+            list.head = head.next;
+            head.next = db_gpa.free_block;
+            db_gpa.free_block = b;
+            if (write_gpa_block(b, &head) != NO_ERROR ||
+                pwrite(db_gpa_fd, &db_gpa, sizeof(db_gpa), 0) != sizeof(db_gpa))
+                return ERR_DB_FILE;
+        }
+        else if (write_gpa_block(list.head, &head) != NO_ERROR)
+        {
+            return ERR_DB_FILE;
+        }
+        list.count--;
+    }
+
+    if (pwrite(db_gpa_fd, &list, sizeof(list), gpa_list_offset(s->gpa)) != sizeof(list))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  carry_gpa
+ *
+ *  Tags the index loaded by open_gpa() with the generation now in db_hdr.
+ *  Used by compress_db() and convert_db(), which keep the id and gpa of
+ *  every student.  Does nothing if the index was not in use.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int carry_gpa(void)
+{
+    if (db_gpa.nblocks == 0)
+        return NO_ERROR;
+
+    db_gpa.generation = db_hdr.generation;
+    if (pwrite(db_gpa_fd, &db_gpa, sizeof(db_gpa), 0) != sizeof(db_gpa))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  drop_gpa
+ *
+ *  Empties DB_GPA_FILE so every process stops maintaining it, until the
+ *  next -g or -t builds it again.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int drop_gpa(void)
+{
+    if (open_gpa(false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_gpa_fd != -1 && ftruncate(db_gpa_fd, 0) == -1)
+        return ERR_DB_FILE;
+
+    memset(&db_gpa, 0, sizeof(db_gpa));
+    return NO_ERROR;
+}
+
+/*
+ *  Column sidecar
+ *
+ *  -s sums up the students from DB_COLS_FILE (see db.h) instead of the
+ *  records, reading 8 of the 64 bytes a scan would read per slot.  The
+ *  columns are read COLS_READ_SEGS segments per pread() and reduced by
+ *  kernels that use AVX2 or SSE2 when the CPU has them, picked like the
+ *  live mask of the scanner (SDB_SIMD applies to both).
+ *
+ *  The first -s builds the file with one scan and note_student() keeps it
+ *  current from then on, with one or two 4 byte writes per add or delete.
+ *  The columns follow the record slots, which compress_db(), convert_db()
+ *  and bulk loads move or fill all at once, so those drop the file and the
+ *  next -s builds it again.
+ */
+#define COLS_READ_SEGS      64          // 512 KiB of columns per pread()
+#define STATS_BUCKETS       10          // gpa histogram, 50 points per bucket
+
+typedef struct cols_stats{
+    uint64_t count;
+    uint64_t sum;
+    int min;
+    int max;
+    uint64_t ge[STATS_BUCKETS];     // students with a gpa of at least 50 * i
+} cols_stats_t;
+
+typedef void (*cols_stats_fn)(const int *ids, const int *gpas, int n, cols_stats_t *st);
+
+static void cols_stats_scalar(const int *ids, const int *gpas, int n, cols_stats_t *st)
+{
+    for (int i = 0; i < n; i++)
+    {
+        int g = gpas[i];
+
+        if (ids[i] == DELETED_STUDENT_ID)
+            continue;
+        st->count++;
+        st->sum += g;
+        if (g < st->min)
+            st->min = g;
+        if (g > st->max)
+            st->max = g;
+        for (int b = 1; b < STATS_BUCKETS; b++)
+            st->ge[b] += g >= 50 * b;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// adds the per lane results of the kernels below to st
+static void cols_stats_lanes(cols_stats_t *st, int lanes, const int32_t *count,
+                             const int32_t *sum, const int32_t *lo,
+                             const int32_t *hi, const int32_t ge[][8])
+{
+    for (int k = 0; k < lanes; k++)
+    {
+        st->count += count[k];
+        st->sum += sum[k];
+        if (lo[k] < st->min)
+            st->min = lo[k];
+        if (hi[k] > st->max)
+            st->max = hi[k];
+        for (int b = 1; b < STATS_BUCKETS; b++)
+            st->ge[b] += ge[b][k];
+    }
+}
+
+static void cols_stats_sse2(const int *ids, const int *gpas, int n, cols_stats_t *st)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i top = _mm_set1_epi32(INT32_MAX);
+    __m128i count = zero, sum = zero, lo = top, hi = ones;
+    __m128i ge[STATS_BUCKETS];
+    int32_t c[8], s[8], l[8], h[8], gb[STATS_BUCKETS][8];
+    int i;
+
+    for (int b = 0; b < STATS_BUCKETS; b++)
+        ge[b] = zero;
+
+    // the lanes of empty slots count as 0 and take values that never win
+    // the min and max, SSE2 has no pminsd/pmaxsd so they are blended
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m128i id = _mm_loadu_si128((const __m128i *)&ids[i]);
+        __m128i g = _mm_loadu_si128((const __m128i *)&gpas[i]);
+        __m128i live = _mm_xor_si128(_mm_cmpeq_epi32(id, zero), ones);
+        __m128i gl = _mm_and_si128(g, live);
+        __m128i gmin = _mm_or_si128(gl, _mm_andnot_si128(live, top));
+        __m128i gmax = _mm_or_si128(gl, _mm_andnot_si128(live, ones));
+        __m128i lt = _mm_cmplt_epi32(gmin, lo);
+        __m128i gt = _mm_cmpgt_epi32(gmax, hi);
+
+        count = _mm_sub_epi32(count, live);
+        sum = _mm_add_epi32(sum, gl);
+        lo = _mm_or_si128(_mm_and_si128(lt, gmin), _mm_andnot_si128(lt, lo));
+        hi = _mm_or_si128(_mm_and_si128(gt, gmax), _mm_andnot_si128(gt, hi));
+        for (int b = 1; b < STATS_BUCKETS; b++)
+            ge[b] = _mm_sub_epi32(ge[b], _mm_and_si128(live,
+                        _mm_cmpgt_epi32(g, _mm_set1_epi32(50 * b - 1))));
+    }
+
+    _mm_storeu_si128((__m128i *)c, count);
+    _mm_storeu_si128((__m128i *)s, sum);
+    _mm_storeu_si128((__m128i *)l, lo);
+    _mm_storeu_si128((__m128i *)h, hi);
+    for (int b = 1; b < STATS_BUCKETS; b++)
+        _mm_storeu_si128((__m128i *)gb[b], ge[b]);
+    cols_stats_lanes(st, 4, c, s, l, h, gb);
+
+    cols_stats_scalar(&ids[i], &gpas[i], n - i, st);
+}
+
+__attribute__((target("avx2")))
+static void cols_stats_avx2(const int *ids, const int *gpas, int n, cols_stats_t *st)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i top = _mm256_set1_epi32(INT32_MAX);
+    __m256i count = zero, sum = zero, lo = top, hi = ones;
+    __m256i ge[STATS_BUCKETS];
+    int32_t c[8], s[8], l[8], h[8], gb[STATS_BUCKETS][8];
+    int i;
+
+    for (int b = 0; b < STATS_BUCKETS; b++)
+        ge[b] = zero;
+
+    // the lanes of empty slots count as 0 and take values that never win
+    // the min and max
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i id = _mm256_loadu_si256((const __m256i *)&ids[i]);
+        __m256i g = _mm256_loadu_si256((const __m256i *)&gpas[i]);
+        __m256i live = _mm256_xor_si256(_mm256_cmpeq_epi32(id, zero), ones);
+        __m256i gl = _mm256_and_si256(g, live);
+
+        count = _mm256_sub_epi32(count, live);
+        sum = _mm256_add_epi32(sum, gl);
+        lo = _mm256_min_epi32(lo, _mm256_or_si256(gl, _mm256_andnot_si256(live, top)));
+        hi = _mm256_max_epi32(hi, _mm256_or_si256(gl, _mm256_andnot_si256(live, ones)));
+        for (int b = 1; b < STATS_BUCKETS; b++)
+            ge[b] = _mm256_sub_epi32(ge[b], _mm256_and_si256(live,
+                        _mm256_cmpgt_epi32(g, _mm256_set1_epi32(50 * b - 1))));
+    }
+
+    _mm256_storeu_si256((__m256i *)c, count);
+    _mm256_storeu_si256((__m256i *)s, sum);
+    _mm256_storeu_si256((__m256i *)l, lo);
+    _mm256_storeu_si256((__m256i *)h, hi);
+    for (int b = 1; b < STATS_BUCKETS; b++)
+        _mm256_storeu_si256((__m256i *)gb[b], ge[b]);
+    cols_stats_lanes(st, 8, c, s, l, h, gb);
+
+    cols_stats_scalar(&ids[i], &gpas[i], n - i, st);
+}
+#endif
+
+/*
+ *  pick_cols_stats
+ *
+ *  returns:  the fastest stats kernel this CPU supports
+ */
+static cols_stats_fn pick_cols_stats(void)
+{
+    const char *force = getenv("SDB_SIMD");
+
+    if (force != NULL && strcmp(force, "scalar") == 0)
+        return cols_stats_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "avx2") == 0))
+        return cols_stats_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return cols_stats_sse2;
+#endif
+
+    return cols_stats_scalar;
+}
+
+static db_cols_hdr_t db_cols;       // preamble of DB_COLS_FILE, zero if not in use
+static int db_cols_fd = -1;         // fd of DB_COLS_FILE, -1 if it does not exist
+
+static off_t cols_seg_offset(off_t seg)
+{
+    return DB_COLS_SEGS + seg * 2 * DB_COLS_SEG_SLOTS * (off_t)sizeof(int);
+}
+
+static bool have_cols(void)
+{
+    return db_cols.magic[0] != '\0';
+}
+
+/*
+ *  open_cols
+ *      create:  true to create DB_COLS_FILE if it does not exist
+ *
+ *  Opens DB_COLS_FILE and loads its preamble into db_cols if it belongs to
+ *  the header in db_hdr.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure.  have_cols() is
+ *            false if the columns are missing or stale
+ */
+static int open_cols(bool create)
+{
+    db_cols_hdr_t ch;
+
+    memset(&db_cols, 0, sizeof(db_cols));
+    if (db_cols_fd == -1)
+    {
+        db_cols_fd = open(DB_COLS_FILE, O_RDWR | (create ? O_CREAT : 0),
+                          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (db_cols_fd == -1)
+            return create || errno != ENOENT ? ERR_DB_FILE : NO_ERROR;
+    }
+
+    if (pread(db_cols_fd, &ch, sizeof(ch), 0) == sizeof(ch) &&
+        memcmp(ch.magic, DB_COLS_MAGIC, sizeof(ch.magic)) == 0 &&
+        ch.generation == db_hdr.generation)
+        db_cols = ch;
+
+    return NO_ERROR;
+}
+
+/*
+ *  build_cols
+ *      fd:  linux file descriptor
+ *
+ *  Scans the database and writes a new DB_COLS_FILE for it, one segment at
+ *  a time.  The scan returns the slots of a paged file in id order rather
+ *  than file order, so a segment it comes back to is read back first.  The
+ *  caller holds a lock that keeps writers out, see stats_db().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int build_cols(int fd)
+{
+    static int seg[2 * DB_COLS_SEG_SLOTS];
+    db_cols_hdr_t ch = {0};
+    off_t cur = -1;
+    student_t s;
+    off_t pos;
+    scan_t sc;
+    ssize_t got;
+    int rc;
+
+    if (db_cols_fd == -1 && open_cols(true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // start from an empty file so no old slot survives
+    memset(&db_cols, 0, sizeof(db_cols));
+    if (ftruncate(db_cols_fd, 0) == -1 || scan_begin(&sc, fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    while ((rc = scan_next(&sc, &s, &pos)) > 0)
+    {
+        off_t slot = pos / STUDENT_RECORD_SIZE;
+
+        if (slot / DB_COLS_SEG_SLOTS != cur)
+        {
+            if (cur >= 0 && pwrite(db_cols_fd, seg, sizeof(seg), cols_seg_offset(cur)) != sizeof(seg))
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            cur = slot / DB_COLS_SEG_SLOTS;
+
+            // past the end of the file a segment reads as empty
+            got = pread(db_cols_fd, seg, sizeof(seg), cols_seg_offset(cur));
+            if (got < 0)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            memset((char *)seg + got, 0, sizeof(seg) - got);
+        }
+        seg[slot % DB_COLS_SEG_SLOTS] = s.id;
+        seg[DB_COLS_SEG_SLOTS + slot % DB_COLS_SEG_SLOTS] = s.gpa;
+    }
+    scan_end(&sc);
+
+    if (rc == 0 && cur >= 0 &&
+        pwrite(db_cols_fd, seg, sizeof(seg), cols_seg_offset(cur)) != sizeof(seg))
+        rc = ERR_DB_FILE;
+    if (rc != 0)
+        return ERR_DB_FILE;
+
+    memcpy(ch.magic, DB_COLS_MAGIC, sizeof(ch.magic));
+    ch.generation = db_hdr.generation;
+    if (pwrite(db_cols_fd, &ch, sizeof(ch), 0) != sizeof(ch))
+        return ERR_DB_FILE;
+
+    db_cols = ch;
+    return NO_ERROR;
+}
+
+/*
+ *  cols_put
+ *      s:      the student that was added or deleted
+ *      pos:    file offset of its record
+ *      added:  true if s was added
+ *
+ *  Copies the id and gpa of the slot at pos into the columns.  The gpa is
+ *  written first, so a slot whose id is set always has its gpa.  Does
+ *  nothing if the columns are not in use.  Called with slot 0 locked, see
+ *  note_student().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int cols_put(const student_t *s, off_t pos, bool added)
+{
+    off_t slot = pos / STUDENT_RECORD_SIZE;
+    off_t off = cols_seg_offset(slot / DB_COLS_SEG_SLOTS) +
+                (slot % DB_COLS_SEG_SLOTS) * (off_t)sizeof(int);
+    int id = added ? s->id : DELETED_STUDENT_ID;
+
+    // another process may have built or dropped the columns
+    if (open_cols(false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (!have_cols())
+        return NO_ERROR;
+
+    if (added &&
+        pwrite(db_cols_fd, &s->gpa, sizeof(int),
+               off + DB_COLS_SEG_SLOTS * (off_t)sizeof(int)) != sizeof(int))
+        return ERR_DB_FILE;
+    if (pwrite(db_cols_fd, &id, sizeof(int), off) != sizeof(int))
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  drop_cols
+ *
+ *  Empties DB_COLS_FILE so every process stops maintaining it, until the
+ *  next -s builds it again.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int drop_cols(void)
+{
+    if (open_cols(false) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db_cols_fd != -1 && ftruncate(db_cols_fd, 0) == -1)
+        return ERR_DB_FILE;
+
+    memset(&db_cols, 0, sizeof(db_cols));
+    return NO_ERROR;
+}
+
+/*
+ *  Paged layout
+ *
+ *  Flat files reserve a slot for every id up to MAX_STD_ID, which does not
+ *  scale to DB_PAGED_MAX_ID.  Paged files (see db.h) only hold the 4 KiB
+ *  data pages that have students in them, found through a two level
+ *  directory, so looking up any id costs at most three pread() calls.  Data
+ *  and directory pages are appended as ids that need them are added, and
+ *  every page number the directory hands out is never reused.
+ *
+ *  The directory pages read as empty records.  The scanner, and everything
+ *  built on it (print, count, export, compress, -j), reads only the data
+ *  pages, in the order of the directory, so it sees the students in id
+ *  order, see Record scanner.  Paged files have
+ *  no bitmap or index, their header alone keeps the count.  -P converts a
+ *  flat or packed database, see convert_db().
+ */
+static bool is_paged(int fd)
+{
+    return have_header(fd) && db_hdr.layout == DB_LAYOUT_PAGED;
+}
+
+/*
+ *  dir_offset
+ *      dir:  page number of the first page of a directory
+ *      e:    entry in the directory
+ *
+ *  returns:  the file offset of the page number stored in entry e
+ */
+static off_t dir_offset(uint32_t dir, uint32_t e)
+{
+    uint32_t page = dir + e / DB_DIR_FANOUT;
+    uint32_t i = e % DB_DIR_FANOUT;
+
+    return (off_t)page * DB_PAGE_SIZE + (off_t)(i / DB_DIR_SLOTS) * STUDENT_RECORD_SIZE +
+           (off_t)(1 + i % DB_DIR_SLOTS) * sizeof(uint32_t);
+}
+
+/*
+ *  alloc_page
+ *      fd:     linux file descriptor of a paged database
+ *      *page:  set to the number of the new page
+ *
+ *  Appends an empty (sparse) page to the file.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int alloc_page(int fd, uint32_t *page)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    *page = (st.st_size + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE;
+    if (ftruncate(fd, ((off_t)*page + 1) * DB_PAGE_SIZE) == -1)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  paged_lookup
+ *      fd:      linux file descriptor of a paged database
+ *      id:      student id, 0 to DB_PAGED_MAX_ID
+ *      create:  allocate the directory and data page of id if needed
+ *      *pos:    set to the file offset of the slot of id
+ *
+ *  returns:  1              the slot of id exists, *pos is set
+ *            2              create only, the data page was just allocated
+ *            0              without create, there is no page for id yet
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int paged_lookup(int fd, int id, bool create, off_t *pos)
+{
+    uint32_t n = (uint32_t)id / DB_PAGE_RECS;
+    uint32_t dir, data;
+    off_t at;
+    int rc = 1;
+
+    at = dir_offset(1, n / DB_DIR_FANOUT);
+    if (pread(fd, &dir, sizeof(dir), at) != sizeof(dir))
+        return ERR_DB_FILE;
+    if (dir == 0)
+    {
+        if (!create)
+            return 0;
+        if (alloc_page(fd, &dir) != NO_ERROR ||
+            pwrite(fd, &dir, sizeof(dir), at) != sizeof(dir))
+            return ERR_DB_FILE;
+    }
+
+    at = dir_offset(dir, n % DB_DIR_FANOUT);
+    if (pread(fd, &data, sizeof(data), at) != sizeof(data))
+        return ERR_DB_FILE;
+    if (data == 0)
+    {
+        if (!create)
+            return 0;
+        if (alloc_page(fd, &data) != NO_ERROR ||
+            pwrite(fd, &data, sizeof(data), at) != sizeof(data))
+            return ERR_DB_FILE;
+        rc = 2;
+    }
+
+    *pos = (off_t)data * DB_PAGE_SIZE + (off_t)(id % DB_PAGE_RECS) * STUDENT_RECORD_SIZE;
+    return rc;
+}
+
+static int page_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  paged_dir_pages
+ *      fd:   linux file descriptor of a paged database
+ *      *n:   set to the number of directory pages returned
+ *
+ *  returns:  malloc()ed sorted array of the page numbers of every directory
+ *            page outside the root, or NULL on failure
+ */
+static uint32_t *paged_dir_pages(int fd, int *n)
+{
+    size_t len = (size_t)DB_ROOT_PAGES * DB_PAGE_SIZE;
+    uint32_t *root = malloc(len);
+    uint32_t *dirs = malloc((size_t)DB_ROOT_PAGES * DB_DIR_FANOUT * sizeof(uint32_t));
+    ssize_t got;
+
+    *n = 0;
+    if (root == NULL || dirs == NULL ||
+        (got = pread(fd, root, len, DB_PAGE_SIZE)) < 0)
+    {
+        free(root);
+        free(dirs);
+        return NULL;
+    }
+
+    // every 16th word is the zero id of a directory entry
+    for (size_t i = 0; i < (size_t)got / sizeof(uint32_t); i++)
+    {
+        if (i % (STUDENT_RECORD_SIZE / sizeof(uint32_t)) != 0 && root[i] != 0)
+            dirs[(*n)++] = root[i];
+    }
+    free(root);
+
+    qsort(dirs, *n, sizeof(uint32_t), page_cmp);
+    return dirs;
+}
+
+/*
+ *  paged_data_pages
+ *      fd:  linux file descriptor of a paged database
+ *      *n:  set to the number of data pages returned
+ *
+ *  Walks the root and then every directory page in entry order, which is
+ *  the order of the ids the data pages hold.
+ *
+ *  returns:  malloc()ed array of the page numbers of every data page, in
+ *            id order, or NULL on failure
+ */
+static uint32_t *paged_data_pages(int fd, int *n)
+{
+    const size_t words = STUDENT_RECORD_SIZE / sizeof(uint32_t);
+    size_t len = (size_t)DB_ROOT_PAGES * DB_PAGE_SIZE;
+    uint32_t *root = malloc(len);
+    uint32_t dir[DB_PAGE_SIZE / sizeof(uint32_t)];
+    uint32_t *pages = malloc(DB_PAGE_SIZE);
+    size_t cap = DB_PAGE_SIZE / sizeof(uint32_t);
+    ssize_t got = 0;
+    bool ok;
+
+    *n = 0;
+    ok = root != NULL && pages != NULL &&
+         (got = pread(fd, root, len, DB_PAGE_SIZE)) >= 0;
+
+    // like in paged_dir_pages() every 16th word is the zero id of an entry
+    for (size_t i = 0; ok && i < (size_t)got / sizeof(uint32_t); i++)
+    {
+        if (i % words == 0 || root[i] == 0)
+            continue;
+        if (pread(fd, dir, sizeof(dir), (off_t)root[i] * DB_PAGE_SIZE) != sizeof(dir))
+        {
+            ok = false;
+            break;
+        }
+
+        for (size_t j = 0; ok && j < DB_PAGE_SIZE / sizeof(uint32_t); j++)
+        {
+            if (j % words == 0 || dir[j] == 0)
+                continue;
+            if ((size_t)*n == cap)
+            {
+                uint32_t *grown = realloc(pages, cap * 2 * sizeof(uint32_t));
+
+                if (grown == NULL)
+                {
+                    ok = false;
+                    break;
+                }
+                pages = grown;
+                cap *= 2;
+            }
+            pages[(*n)++] = dir[j];
+        }
+    }
+    free(root);
+
+    if (!ok)
+    {
+        free(pages);
+        return NULL;
+    }
+    return pages;
+}
+
+/*
+ *  open_bitmap
+ *
+ *  Opens (creating if needed) DB_MAP_FILE and reads its preamble.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure.  *mh is zeroed if
+ *            the file is new or too short to hold a preamble
+ */
+static int open_bitmap(db_map_hdr_t *mh)
+{
+    if (db_bits_fd == -1)
+    {
+        db_bits_fd = open(DB_MAP_FILE, O_RDWR | O_CREAT,
+                          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (db_bits_fd == -1)
+            return ERR_DB_FILE;
+    }
+
+    if (pread(db_bits_fd, mh, sizeof(*mh), 0) != sizeof(*mh))
+        memset(mh, 0, sizeof(*mh));
+
+    return NO_ERROR;
+}
+
+/*
+ *  write_header
+ *      fd:  linux file descriptor of the database the header belongs to
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_header(int fd)
+{
+    db_hdr.changes++;
+    if (pwrite(fd, &db_hdr, sizeof(db_hdr), 0) != sizeof(db_hdr))
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  write_bitmap
+ *
+ *  Writes the preamble and the complete bitmap to DB_MAP_FILE, tagged with
+ *  the generation of db_hdr.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int write_bitmap(void)
+{
+    db_map_hdr_t mh = {0};
+
+    memcpy(mh.magic, DB_MAP_MAGIC, sizeof(mh.magic));
+    mh.generation = db_hdr.generation;
+    mh.nbits = DB_MAP_BYTES * 8;
+
+    if (pwrite(db_bits_fd, &mh, sizeof(mh), 0) != sizeof(mh))
+        return ERR_DB_FILE;
+    if (pwrite(db_bits_fd, db_bits, sizeof(db_bits), sizeof(mh)) != sizeof(db_bits))
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  new_header
+ *      layout:  DB_LAYOUT_FLAT, DB_LAYOUT_PACKED or DB_LAYOUT_PAGED
+ *      mh:      preamble currently in DB_MAP_FILE
+ *
+ *  Starts a fresh, empty header in db_hdr.  The generation is chosen so it
+ *  can not match whatever bitmap is currently on disk.
+ */
+static void new_header(int layout, db_map_hdr_t *mh)
+{
+    unsigned int gen = mh->generation;
+
+    if (gen < db_hdr.generation)
+        gen = db_hdr.generation;
+
+    memset(&db_hdr, 0, sizeof(db_hdr));
+    memcpy(db_hdr.magic, DB_HDR_MAGIC, sizeof(db_hdr.magic));
+    db_hdr.version = DB_HDR_VERSION;
+    db_hdr.layout = layout;
+    db_hdr.generation = gen + 1;
+    memset(db_bits, 0, sizeof(db_bits));
+}
+
+/*
+ *  rebuild_header
+ *      fd:      linux file descriptor
+ *      layout:  layout of the records in the file
+ *      mh:      preamble currently in DB_MAP_FILE
+ *
+ *  Scans every record of the database to recreate the count and the bitmap,
+ *  and for packed files the index, then writes them.  The header is written
+ *  last so a crash in between leaves a header whose generation does not
+ *  match, which is simply rebuilt again on the next open.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int rebuild_header(int fd, int layout, db_map_hdr_t *mh)
+{
+    student_t student;
+    int *slots = NULL;
+    struct stat st;
+    scan_t sc;
+    off_t pos;
+    int rc;
+
+    new_header(layout, mh);
+
+    if (layout == DB_LAYOUT_PACKED &&
+        (slots = calloc(MAX_STD_ID + 1, sizeof(int))) == NULL)
+        return ERR_DB_FILE;
+
+    if (scan_begin(&sc, fd) != NO_ERROR)
+    {
+        free(slots);
+        return ERR_DB_FILE;
+    }
+
+    while ((rc = scan_next(&sc, &student, &pos)) > 0)
+    {
+        if (student.id >= MIN_STD_ID && student.id <= MAX_STD_ID)
+        {
+            bit_assign(student.id, true);
+            db_hdr.record_count++;
+            if (slots != NULL)
+                slots[student.id] = pos / STUDENT_RECORD_SIZE;
+        }
+        else if (student.id > MAX_STD_ID && layout == DB_LAYOUT_PAGED)
+        {
+            db_hdr.record_count++;
+        }
+    }
+    scan_end(&sc);
+
+    // every slot of a packed file that holds no student is a tombstone
+    if (rc == 0 && slots != NULL)
+    {
+        if (fstat(fd, &st) == -1 || write_index(slots) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        else
+            db_hdr.tombstones = st.st_size / STUDENT_RECORD_SIZE - 1 - db_hdr.record_count;
+    }
+    free(slots);
+
+    if (rc < 0 || write_bitmap() != NO_ERROR || write_header(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_hdr_fd = fd;
+    return NO_ERROR;
+}
+
+/*
+ *  migrate_packed
+ *      fd:  linux file descriptor of a header-less compressed database
+ *
+ *  Older versions of compress_db() packed records starting at slot 0.  Shift
+ *  them all up by one slot so slot 0 is free for the header.  The records
+ *  are copied from the end of the file backwards so no record is overwritten
+ *  before it has been moved.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int migrate_packed(int fd, off_t size)
+{
+    student_t buff[1024];
+    off_t end = size - size % STUDENT_RECORD_SIZE;
+
+    while (end > 0)
+    {
+        off_t start = end > (off_t)sizeof(buff) ? end - (off_t)sizeof(buff) : 0;
+        size_t len = end - start;
+
+        if (pread(fd, buff, len, start) != (ssize_t)len)
+            return ERR_DB_FILE;
+        if (pwrite(fd, buff, len, start + STUDENT_RECORD_SIZE) != (ssize_t)len)
+            return ERR_DB_FILE;
+        end = start;
+    }
+
+    if (pwrite(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE, 0) != STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  load_header
+ *      fd:  linux file descriptor
+ *
+ *  Reads the header and bitmap of the database, migrating header-less
+ *  files and rebuilding a stale bitmap (or index) as described above.  An empty file
+ *  is left alone, add_student() creates its header with the first record.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ *
+ *  console:  This function does not produce any output
+ */
+static int load_header(int fd)
+{
+    db_map_hdr_t mh;
+    struct stat st;
+    student_t slot0;
+
+    db_hdr_fd = -1;
+    memset(&db_idx, 0, sizeof(db_idx));
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (st.st_size < STUDENT_RECORD_SIZE)
+        return NO_ERROR;
+
+    if (pread(fd, &db_hdr, sizeof(db_hdr), 0) != sizeof(db_hdr))
+        return ERR_DB_FILE;
+    if (open_bitmap(&mh) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (memcmp(db_hdr.magic, DB_HDR_MAGIC, sizeof(db_hdr.magic)) == 0)
+    {
+        if (db_hdr.version != DB_HDR_VERSION)
+            return ERR_DB_FILE;
+
+        // the header of a paged file is all there is, see Paged layout
+        if (db_hdr.layout == DB_LAYOUT_PAGED)
+        {
+            db_hdr_fd = fd;
+            return NO_ERROR;
+        }
+
+        if (memcmp(mh.magic, DB_MAP_MAGIC, sizeof(mh.magic)) == 0 &&
+            mh.generation == db_hdr.generation &&
+            mh.nbits == DB_MAP_BYTES * 8 &&
+            pread(db_bits_fd, db_bits, sizeof(db_bits), sizeof(mh)) == sizeof(db_bits))
+        {
+            if (db_hdr.layout != DB_LAYOUT_PACKED)
+            {
+                db_hdr_fd = fd;
+                return NO_ERROR;
+            }
+            if (open_index() != NO_ERROR)
+                return ERR_DB_FILE;
+            if (db_idx.nbuckets != 0)
+            {
+                db_hdr_fd = fd;
+                return NO_ERROR;
+            }
+        }
+
+        return rebuild_header(fd, db_hdr.layout, &mh);
+    }
+
+    // no header yet.  Slot 0 of a flat file is always empty (ids start at
+    // MIN_STD_ID), while an older compress_db() packed a student into it,
+    // so slot 0 alone tells them apart.  The size does not: a packed file
+    // of MAX_STD_ID students is as long as a flat one
+    memcpy(&slot0, &db_hdr, sizeof(slot0));
+    memset(&db_hdr, 0, sizeof(db_hdr));
+    if (slot0.id == DELETED_STUDENT_ID)
+        return rebuild_header(fd, DB_LAYOUT_FLAT, &mh);
+
+    if (migrate_packed(fd, st.st_size) != NO_ERROR)
+        return ERR_DB_FILE;
+    return rebuild_header(fd, DB_LAYOUT_PACKED, &mh);
+}
+
+/*
+ *  Locking
+ *
+ *  Several sdbsc processes may work on the same database at once.  They
+ *  coordinate with open file description locks (fcntl() F_OFD_SETLKW) on
+ *  byte ranges of the database file:
+ *   1. add and delete lock the STUDENT_RECORD_SIZE bytes at id *
+ *      STUDENT_RECORD_SIZE, which is the slot of the student in a flat
+ *      file (in packed and paged files the range just stands for the id),
+ *      so writers of different students run in parallel
+ *   2. slot 0 is the lock of the header, bitmap and index and of the
+ *      directory of a paged file.  It is only held while they are changed,
+ *      except in packed files where the index decides where a student goes
+ *      and adds and deletes hold it throughout.  Taking it refreshes the
+ *      in-memory header, another process may have changed it
+ *   3. deleting a student tries to lock its 4 KiB page before the page is
+ *      freed, see punch_if_empty()
+ *   4. print and count lock the whole file shared, bulk loading, compress,
+ *      convert and reclaim lock it exclusively, both reload the header
+ *  A process waits for at most one lock while holding another one, slot 0
+ *  while holding its slot, so they can not deadlock.  A process that had
+ *  to wait may find that compress_db() replaced the file
+ *  meanwhile, it then reopens the new one on the same fd and tries again.
+ *  Lookups by id take no lock, they compare the file with DB_FILE before
+ *  every lookup instead, see follow_db().  With -m they lock the range of
+ *  the id shared while they read the mapping though, so that no other
+ *  process can cut the file short under it, see lookup_student().  On file
+ *  systems without OFD locks everything runs unlocked.
+ */
+static int meta_depth = 0;      // slot 0 is locked while this is > 0
+
+/*
+ *  set_lock
+ *      fd:     linux file descriptor
+ *      type:   F_RDLCK, F_WRLCK or F_UNLCK
+ *      start:  first byte of the range
+ *      len:    length of the range, 0 for the rest of the file
+ *
+ *  Sets the lock, waiting for conflicting locks of other processes.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int set_lock(int fd, short type, off_t start, off_t len)
+{
+#ifdef F_OFD_SETLKW
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    while (fcntl(fd, F_OFD_SETLKW, &fl) == -1)
+    {
+        if (errno == EINTR)
+            continue;
+        return errno == EINVAL ? NO_ERROR : ERR_DB_FILE;
+    }
+#else
+    (void)fd;
+    (void)type;
+    (void)start;
+    (void)len;
+#endif
+    return NO_ERROR;
+}
+
+/*
+ *  try_lock
+ *      fd, type, start, len:  see set_lock()
+ *
+ *  Like set_lock() but does not wait.
+ *
+ *  returns:  1 if the lock was set, 0 if another process holds a conflicting
+ *            one, ERR_DB_FILE on failure
+ */
+static int try_lock(int fd, short type, off_t start, off_t len)
+{
+#ifdef F_OFD_SETLK
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    if (fcntl(fd, F_OFD_SETLK, &fl) == -1)
+    {
+        if (errno == EAGAIN || errno == EACCES)
+            return 0;
+        return errno == EINVAL ? 1 : ERR_DB_FILE;
+    }
+#else
+    (void)fd;
+    (void)type;
+    (void)start;
+    (void)len;
+#endif
+    return 1;
+}
+
+/*
+ *  reopen_db
+ *      fd:  linux file descriptor of a database that was replaced
+ *
+ *  Opens DB_FILE again in place of fd and loads its header.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int reopen_db(int fd)
+{
+    int nfd = open(DB_FILE, O_RDWR);
+
+    if (nfd == -1)
+        return ERR_DB_FILE;
+
+    unmap_db();
+    cache_release();
+    if (dup2(nfd, fd) == -1)
+    {
+        close(nfd);
+        return ERR_DB_FILE;
+    }
+    close(nfd);
+
+    if (db_bits_fd != -1)
+        close(db_bits_fd);
+    if (db_idx_fd != -1)
+        close(db_idx_fd);
+    db_bits_fd = -1;
+    db_idx_fd = -1;
+    return load_header(fd);
+}
+
+/*
+ *  replaced_db
+ *      fd:  linux file descriptor
+ *
+ *  returns:  1 if DB_FILE is no longer the file fd has open (another
+ *            process moved a new one in place, see Replacing the database
+ *            file), 0 if it still is, ERR_DB_FILE on failure
+ */
+static int replaced_db(int fd)
+{
+    struct stat cur, st;
+
+    if (fstat(fd, &cur) == -1 || stat(DB_FILE, &st) == -1)
+        return ERR_DB_FILE;
+    return cur.st_dev != st.st_dev || cur.st_ino != st.st_ino;
+}
+
+/*
+ *  follow_db
+ *      fd:  linux file descriptor
+ *
+ *  Lookups take no lock, so they make the check of lock_range() themselves
+ *  and move on to the current DB_FILE if fd was replaced.  With the page
+ *  cache the mapped header tells when to check, see cache_valid(), which
+ *  saves the two system calls.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int follow_db(int fd)
+{
+    int rc;
+
+    if (cache_valid(fd))
+        return NO_ERROR;
+
+    rc = replaced_db(fd);
+
+    if (rc < 0)
+        return ERR_DB_FILE;
+    return rc == 0 ? NO_ERROR : reopen_db(fd);
+}
+
+/*
+ *  lock_range
+ *      fd, type, start, len:  see set_lock()
+ *
+ *  Locks the range of the current DB_FILE, reopening it if it was
+ *  replaced while we waited.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int lock_range(int fd, short type, off_t start, off_t len)
+{
+    int rc;
+
+    for (;;)
+    {
+        if (set_lock(fd, type, start, len) != NO_ERROR ||
+            (rc = replaced_db(fd)) < 0)
+            return ERR_DB_FILE;
+        if (rc == 0)
+            return NO_ERROR;
+
+        // the lock dies with the old file
+        if (reopen_db(fd) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+}
+
+static int lock_slot(int fd, int id)
+{
+    return lock_range(fd, F_WRLCK, (off_t)id * STUDENT_RECORD_SIZE, STUDENT_RECORD_SIZE);
+}
+
+static void unlock_slot(int fd, int id)
+{
+    set_lock(fd, F_UNLCK, (off_t)id * STUDENT_RECORD_SIZE, STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  lock_meta
+ *      fd:  linux file descriptor
+ *
+ *  Locks slot 0 and rereads the header, and for packed files the index
+ *  preamble, that another process may have changed.  Calls nest, only
+ *  the outermost unlock_meta() releases the lock.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int lock_meta(int fd)
+{
+    db_header_t hdr;
+
+    if (meta_depth++ > 0)
+        return NO_ERROR;
+
+    if (lock_range(fd, F_WRLCK, 0, STUDENT_RECORD_SIZE) != NO_ERROR)
+    {
+        meta_depth--;
+        return ERR_DB_FILE;
+    }
+    if (!have_header(fd))
+        return NO_ERROR;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        hdr.generation == db_hdr.generation)
+    {
+        db_hdr.record_count = hdr.record_count;
+        db_hdr.tombstones = hdr.tombstones;
+        db_hdr.changes = hdr.changes;
+        if (db_hdr.layout == DB_LAYOUT_PACKED && open_index() == NO_ERROR)
+            return NO_ERROR;
+        if (db_hdr.layout != DB_LAYOUT_PACKED)
+            return NO_ERROR;
+    }
+
+    // rebuilt by another process, start over
+    if (load_header(fd) == NO_ERROR)
+        return NO_ERROR;
+
+    meta_depth = 0;
+    set_lock(fd, F_UNLCK, 0, STUDENT_RECORD_SIZE);
+    return ERR_DB_FILE;
+}
+
+static void unlock_meta(int fd)
+{
+    if (--meta_depth == 0)
+        set_lock(fd, F_UNLCK, 0, STUDENT_RECORD_SIZE);
+}
+
+static void unlock_file(int fd, short type)
+{
+    if (type == F_WRLCK)
+        meta_depth--;
+    set_lock(fd, F_UNLCK, 0, 0);
+}
+
+/*
+ *  lock_file
+ *      fd:    linux file descriptor
+ *      type:  F_RDLCK for scans, F_WRLCK to rewrite the file
+ *
+ *  Locks the whole file and reloads the header, see Locking.  An
+ *  exclusive lock includes slot 0, so lock_meta() calls made while it is
+ *  held do not touch it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int lock_file(int fd, short type)
+{
+    if (lock_range(fd, type, 0, 0) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (type == F_WRLCK)
+        meta_depth++;
+
+    if (load_header(fd) != NO_ERROR)
+    {
+        unlock_file(fd, type);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  try_lock_file
+ *      fd:  linux file descriptor
+ *
+ *  Like lock_file(fd, F_WRLCK) but gives up instead of waiting, also when
+ *  another process replaced the file, which the next lock_range() reopens.
+ *
+ *  returns:  1 if the file was locked, 0 if another process is using it,
+ *            ERR_DB_FILE on failure
+ */
+static int try_lock_file(int fd)
+{
+    int rc = try_lock(fd, F_WRLCK, 0, 0);
+
+    if (rc <= 0)
+        return rc;
+
+    rc = replaced_db(fd);
+    rc = rc < 0 ? ERR_DB_FILE : !rc;
+    if (rc <= 0)
+    {
+        set_lock(fd, F_UNLCK, 0, 0);
+        return rc;
+    }
+
+    meta_depth++;
+    if (load_header(fd) != NO_ERROR)
+    {
+        unlock_file(fd, F_WRLCK);
+        return ERR_DB_FILE;
+    }
+    return 1;
+}
+
+/*
+ *  refresh_bits
+ *      id:  first id of the bits to reread
+ *      n:   number of ids
+ *
+ *  Rereads the bitmap bytes holding ids id to id + n - 1, which another
+ *  process may have changed.  The old bits are kept if that fails.
+ */
+static void refresh_bits(int id, int n)
+{
+    unsigned char bytes[DB_PAGE_RECS / 8 + 1];
+    int first = id / 8;
+    int len = (id + n - 1) / 8 - first + 1;
+
+    if (db_bits_fd == -1 || first + len > (int)sizeof(db_bits) ||
+        len > (int)sizeof(bytes))
+        return;
+    if (pread(db_bits_fd, bytes, len, sizeof(db_map_hdr_t) + first) == len)
+        memcpy(&db_bits[first], bytes, len);
+}
+
+/*
+ *  ensure_header
+ *      fd:  linux file descriptor
+ *
+ *  Makes sure the database has a header before it is modified, creating an
+ *  empty flat one if the file is still empty.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int ensure_header(int fd)
+{
+    db_map_hdr_t mh;
+    struct stat st;
+
+    int rc = NO_ERROR;
+
+    if (have_header(fd))
+        return NO_ERROR;
+
+    // another process may be creating it at the same time
+    if (lock_meta(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (fstat(fd, &st) == -1 || open_bitmap(&mh) != NO_ERROR)
+    {
+        rc = ERR_DB_FILE;
+    }
+    else if (st.st_size >= STUDENT_RECORD_SIZE)
+    {
+        rc = load_header(fd);
+    }
+    else
+    {
+        new_header(DB_LAYOUT_FLAT, &mh);
+        if (write_bitmap() != NO_ERROR || write_header(fd) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        else
+            db_hdr_fd = fd;
+    }
+
+    unlock_meta(fd);
+    return rc;
+}
+
+// lowest slot of a packed file that may be a tombstone, see Incremental
+// compaction
+static off_t compact_hole = 1;
+
+/*
+ *  note_student
+ *      fd:     linux file descriptor
+ *      s:      the student that was added or deleted
+ *      pos:    file offset of the student's record
+ *      added:  true if the student was added, false if deleted
+ *
+ *  Records an add or delete in the header and, unless the file is paged,
+ *  the bitmap, for packed files in the index and in the name and gpa
+ *  indexes and the columns that are in use.  A delete from a packed file
+ *  leaves a tombstone, which is counted in the header.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int note_student(int fd, const student_t *s, off_t pos, bool added)
+{
+    int id = s->id;
+    off_t off = sizeof(db_map_hdr_t) + id / 8;
+    int rc = NO_ERROR;
+    bool cached;
+
+    if (!have_header(fd))
+        return NO_ERROR;
+
+    // the count and the neighbouring bits may have changed under us
+    if (lock_meta(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    cached = cache_valid(fd);
+
+    db_hdr.record_count += added ? 1 : -1;
+
+    if (!added && db_hdr.layout == DB_LAYOUT_PACKED)
+    {
+        db_hdr.tombstones++;
+        if (pos / STUDENT_RECORD_SIZE < compact_hole)
+            compact_hole = pos / STUDENT_RECORD_SIZE;
+    }
+
+    if (db_hdr.layout != DB_LAYOUT_PAGED)
+    {
+        refresh_bits(id, 1);
+        bit_assign(id, added);
+        if (pwrite(db_bits_fd, &db_bits[id / 8], 1, off) != 1)
+            rc = ERR_DB_FILE;
+    }
+
+    if (rc == NO_ERROR && have_index(fd) &&
+        idx_put(id, added ? (int)(pos / STUDENT_RECORD_SIZE) : 0) != NO_ERROR)
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR &&
+        (names_put(s, added) != NO_ERROR || gpa_put(s, added) != NO_ERROR ||
+         cols_put(s, pos, added) != NO_ERROR))
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR)
+        rc = write_header(fd);
+
+    // this change is the one the cache knows about, see Page cache
+    if (rc == NO_ERROR && cached)
+    {
+        cache_changes = db_hdr.changes;
+        cache_write(added ? s : &EMPTY_STUDENT_RECORD, pos);
+    }
+
+    unlock_meta(fd);
+    return rc;
+}
+
+/*
+ *  Write-ahead log
+ *
+ *  With -w every add and delete is also appended to DB_WAL_FILE (see db.h),
+ *  and only the log is synced: commit_wal() writes the entries of a whole
+ *  batch, one command line operation or every request of one round of the
+ *  server, with a single write() and fdatasync().  The records themselves
+ *  are written in place as usual but not synced, not even with -m.  A
+ *  checkpoint syncs the database, bitmap and index files and empties the
+ *  log, it happens when the log holds WAL_CHECKPOINT entries, before -b,
+ *  -x and -P rewrite the file, and when the database is opened without -w.
+ *
+ *  Every logged operation is in the page cache once it was made, so the
+ *  log only has to be replayed when the machine went down before the next
+ *  checkpoint.  The boot id in the log tells.  Replaying rebuilds the
+ *  header, bitmap and index from the records (any of their writes may be
+ *  lost) and then redoes every entry, which is harmless for the operations
+ *  that did reach the disk.
+ *
+ *  Several processes may share the log.  Each batch is appended at the end
+ *  of the file under an exclusive lock of the whole log, and the log is
+ *  only ever emptied or removed right after the database was synced, which
+ *  covers the records of every batch in it.  A process whose log was
+ *  removed by another one starts a new one.
+ */
+#define WAL_CHECKPOINT  16384   // logged entries that trigger a checkpoint
+
+static bool wal_enabled = false;        // -w was given on the command line
+static int db_wal_fd = -1;              // fd of DB_WAL_FILE, -1 if not open
+static db_wal_entry_t *wal_buf = NULL;  // entries not committed yet
+static int wal_pending = 0;
+static int wal_cap = 0;
+
+static int locate_student(int fd, int id, student_t *s, off_t *pos);
+
+/*
+ *  enable_wal
+ *      enable:  true to log adds and deletes, see Write-ahead log
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  This function does not produce any output
+ */
+void enable_wal(bool enable)
+{
+    wal_enabled = enable;
+}
+
+// FNV-1a over the op and the record of e
+static unsigned int wal_check(const db_wal_entry_t *e)
+{
+    const unsigned char *p = (const unsigned char *)&e->student;
+    unsigned int h = 2166136261u ^ (unsigned int)e->op;
+
+    h *= 16777619u;
+    for (size_t i = 0; i < sizeof(e->student); i++)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// the boot id of the running kernel, empty if it can not be read
+static void wal_boot_id(char *id, size_t len)
+{
+    int bfd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+    ssize_t n = -1;
+
+    memset(id, 0, len);
+    if (bfd != -1)
+    {
+        n = read(bfd, id, len - 1);
+        close(bfd);
+    }
+    if (n <= 0)
+        memset(id, 0, len);
+}
+
+/*
+ *  lock_wal
+ *
+ *  Locks the whole log exclusively.  If another process removed the log
+ *  while we waited a new one is created, see open_wal().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int lock_wal(void)
+{
+    struct stat st;
+
+    for (;;)
+    {
+        if (set_lock(db_wal_fd, F_WRLCK, 0, 0) != NO_ERROR ||
+            fstat(db_wal_fd, &st) == -1)
+            return ERR_DB_FILE;
+        if (st.st_nlink > 0)
+            return NO_ERROR;
+
+        close(db_wal_fd);
+        db_wal_fd = open(DB_WAL_FILE, O_RDWR | O_CREAT,
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (db_wal_fd == -1)
+            return ERR_DB_FILE;
+    }
+}
+
+static void unlock_wal(void)
+{
+    set_lock(db_wal_fd, F_UNLCK, 0, 0);
+}
+
+/*
+ *  sync_db_files
+ *      fd:  linux file descriptor
+ *
+ *  Flushes the database, its mapping and its bitmap and index files.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int sync_db_files(int fd)
+{
+    if (db_map != NULL && db_map_fd == fd &&
+        msync(db_map, db_map_len, MS_SYNC) == -1)
+        return ERR_DB_FILE;
+    if (fsync(fd) == -1)
+        return ERR_DB_FILE;
+    if (db_bits_fd != -1 && fsync(db_bits_fd) == -1)
+        return ERR_DB_FILE;
+    if (db_idx_fd != -1 && fsync(db_idx_fd) == -1)
+        return ERR_DB_FILE;
+    if (db_names_fd != -1 && fsync(db_names_fd) == -1)
+        return ERR_DB_FILE;
+    if (db_gpa_fd != -1 && fsync(db_gpa_fd) == -1)
+        return ERR_DB_FILE;
+    if (db_cols_fd != -1 && fsync(db_cols_fd) == -1)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  reset_wal
+ *      fd:  linux file descriptor
+ *
+ *  Makes everything written so far durable in the database files and
+ *  starts an empty log for the current generation.  The log must be
+ *  locked.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int reset_wal(int fd)
+{
+    db_wal_hdr_t wh = {0};
+
+    if (sync_db_files(fd) != NO_ERROR || ftruncate(db_wal_fd, 0) == -1)
+        return ERR_DB_FILE;
+    if (!have_header(fd))
+        return NO_ERROR;
+
+    memcpy(wh.magic, DB_WAL_MAGIC, sizeof(wh.magic));
+    wh.generation = db_hdr.generation;
+    wal_boot_id(wh.boot_id, sizeof(wh.boot_id));
+    if (pwrite(db_wal_fd, &wh, sizeof(wh), 0) != sizeof(wh) ||
+        fdatasync(db_wal_fd) == -1)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  checkpoint_wal
+ *      fd:  linux file descriptor
+ *
+ *  Checkpoints the log, see reset_wal().  Entries that were not committed
+ *  yet are dropped, their records are synced with the rest.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int checkpoint_wal(int fd)
+{
+    int rc;
+
+    wal_pending = 0;
+    if (db_wal_fd == -1)
+        return NO_ERROR;
+
+    if (lock_wal() != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = reset_wal(fd);
+    unlock_wal();
+    return rc;
+}
+
+/*
+ *  log_student
+ *      fd:  linux file descriptor
+ *      op:  'a' for an add, 'd' for a delete
+ *      s:   the record that is added or deleted
+ *
+ *  Queues the operation for the next commit_wal(), must be called before
+ *  the record is written.  Nothing happens without -w.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int log_student(int fd, int op, const student_t *s)
+{
+    db_wal_entry_t *e;
+
+    (void)fd;
+    if (!wal_enabled || db_wal_fd == -1)
+        return NO_ERROR;
+
+    if (wal_pending == wal_cap)
+    {
+        int cap = wal_cap == 0 ? 64 : wal_cap * 2;
+        db_wal_entry_t *buf = realloc(wal_buf, cap * sizeof(*buf));
+
+        if (buf == NULL)
+            return ERR_DB_FILE;
+        wal_buf = buf;
+        wal_cap = cap;
+    }
+
+    e = &wal_buf[wal_pending++];
+    memset(e, 0, sizeof(*e));
+    e->op = op;
+    e->student = *s;
+    e->check = wal_check(e);
+    return NO_ERROR;
+}
+
+/*
+ *  commit_wal
+ *      fd:  linux file descriptor
+ *
+ *  Appends the operations queued since the last call to the log with one
+ *  write and makes them durable with one fdatasync(), then checkpoints if
+ *  the log has grown to WAL_CHECKPOINT entries.  A log that is missing or
+ *  belongs to another generation is started over first.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ *
+ *  console:  This function does not produce any output
+ */
+int commit_wal(int fd)
+{
+    size_t len = wal_pending * sizeof(db_wal_entry_t);
+    db_wal_hdr_t wh;
+    struct stat st;
+    int rc = NO_ERROR;
+
+    if (wal_pending == 0)
+        return NO_ERROR;
+    wal_pending = 0;
+
+    if (lock_wal() != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // the database a new log refers to has to be on disk first
+    if (pread(db_wal_fd, &wh, sizeof(wh), 0) != sizeof(wh) ||
+        memcmp(wh.magic, DB_WAL_MAGIC, sizeof(wh.magic)) != 0 ||
+        wh.generation != db_hdr.generation)
+        rc = reset_wal(fd);
+
+    if (rc == NO_ERROR && fstat(db_wal_fd, &st) == -1)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR &&
+        (pwrite(db_wal_fd, wal_buf, len, st.st_size) != (ssize_t)len ||
+         fdatasync(db_wal_fd) == -1))
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR &&
+        (st.st_size + (off_t)len - (off_t)sizeof(wh)) / (off_t)sizeof(db_wal_entry_t) >= WAL_CHECKPOINT)
+        rc = reset_wal(fd);
+
+    unlock_wal();
+    return rc;
+}
+
+/*
+ *  redo_student
+ *      fd:  linux file descriptor
+ *      e:   a logged operation
+ *
+ *  Makes the database agree with e: an added student is written (again)
+ *  to its slot, a deleted one is removed if it is still there.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int redo_student(int fd, const db_wal_entry_t *e)
+{
+    student_t cur;
+    struct stat st;
+    off_t pos;
+    int rc = locate_student(fd, e->student.id, &cur, &pos);
+
+    if (rc == ERR_DB_FILE)
+        return ERR_DB_FILE;
+
+    if (e->op == 'd')
+    {
+        if (rc != NO_ERROR)
+            return NO_ERROR;
+        if (pwrite(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE, pos) != STUDENT_RECORD_SIZE)
+            return ERR_DB_FILE;
+        return note_student(fd, &cur, pos, false);
+    }
+
+    if (rc == SRCH_NOT_FOUND)
+    {
+        if (have_index(fd))
+        {
+            if (fstat(fd, &st) == -1)
+                return ERR_DB_FILE;
+            pos = st.st_size - st.st_size % STUDENT_RECORD_SIZE;
+        }
+        else if (is_paged(fd))
+        {
+            if (paged_lookup(fd, e->student.id, true, &pos) < 0)
+                return ERR_DB_FILE;
+        }
+        else
+        {
+            pos = (off_t)e->student.id * STUDENT_RECORD_SIZE;
+        }
+    }
+
+    if (pwrite(fd, &e->student, STUDENT_RECORD_SIZE, pos) != STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+    if (rc == SRCH_NOT_FOUND)
+        return note_student(fd, &e->student, pos, true);
+
+    return NO_ERROR;
+}
+
+/*
+ *  read_wal
+ *      fd:       linux file descriptor
+ *      *log:     set to a malloc()ed copy of the committed entries
+ *      *replay:  set to true if they have to be replayed
+ *
+ *  Reads the locked log.  A torn batch at its end is cut off so it is never
+ *  picked up again, a log of another generation (or of an empty database)
+ *  no longer applies and counts as empty.
+ *
+ *  returns:  the number of entries in *log, or ERR_DB_FILE on failure
+ */
+static int read_wal(int fd, db_wal_entry_t **log, bool *replay)
+{
+    db_wal_hdr_t wh;
+    struct stat st;
+    char boot_id[sizeof(wh.boot_id)];
+    int n = 0;
+
+    *log = NULL;
+    *replay = false;
+
+    if (fstat(db_wal_fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (!have_header(fd) ||
+        pread(db_wal_fd, &wh, sizeof(wh), 0) != sizeof(wh) ||
+        memcmp(wh.magic, DB_WAL_MAGIC, sizeof(wh.magic)) != 0 ||
+        wh.generation != db_hdr.generation)
+        return 0;
+
+    n = (st.st_size - sizeof(wh)) / sizeof(db_wal_entry_t);
+    if (n == 0)
+        return 0;
+
+    if ((*log = malloc(n * sizeof(**log))) == NULL ||
+        pread(db_wal_fd, *log, n * sizeof(**log), sizeof(wh)) != (ssize_t)(n * sizeof(**log)))
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++)
+    {
+        if ((*log)[i].check != wal_check(&(*log)[i]))
+            n = i;
+    }
+    if ((off_t)(sizeof(wh) + n * sizeof(**log)) < st.st_size &&
+        ftruncate(db_wal_fd, sizeof(wh) + n * sizeof(**log)) == -1)
+        return ERR_DB_FILE;
+
+    wal_boot_id(boot_id, sizeof(boot_id));
+    *replay = n > 0 &&
+              (boot_id[0] == '\0' || memcmp(boot_id, wh.boot_id, sizeof(boot_id)) != 0);
+    return n;
+}
+
+/*
+ *  replay_wal
+ *      fd:  linux file descriptor
+ *
+ *  Replays the log with the whole database locked, unless another process
+ *  did so while we waited for the lock, and checkpoints it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int replay_wal(int fd)
+{
+    db_wal_entry_t *log;
+    db_map_hdr_t mh;
+    bool replay;
+    int n;
+    int rc = NO_ERROR;
+
+    // the database lock comes first, see Locking
+    if (lock_file(fd, F_WRLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (lock_wal() != NO_ERROR)
+    {
+        unlock_file(fd, F_WRLCK);
+        return ERR_DB_FILE;
+    }
+
+    n = read_wal(fd, &log, &replay);
+    if (n < 0)
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR && replay)
+    {
+        if (open_bitmap(&mh) != NO_ERROR ||
+            rebuild_header(fd, db_hdr.layout, &mh) != NO_ERROR)
+            rc = ERR_DB_FILE;
+        for (int i = 0; rc == NO_ERROR && i < n; i++)
+            rc = redo_student(fd, &log[i]);
+        if (rc == NO_ERROR)
+            rc = reset_wal(fd);
+    }
+    free(log);
+
+    unlock_wal();
+    unlock_file(fd, F_WRLCK);
+    return rc;
+}
+
+/*
+ *  recover_wal
+ *      fd:  linux file descriptor of the database that was just opened
+ *
+ *  Opens the log, replays it if the machine was restarted since it was
+ *  written and, without -w, checkpoints and removes it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int recover_wal(int fd)
+{
+    db_wal_entry_t *log;
+    bool replay;
+    int flags = O_RDWR | (wal_enabled ? O_CREAT : 0);
+    int n;
+    int rc = NO_ERROR;
+
+    wal_pending = 0;
+    db_wal_fd = open(DB_WAL_FILE, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (db_wal_fd == -1)
+        return errno == ENOENT ? NO_ERROR : ERR_DB_FILE;
+
+    if (lock_wal() != NO_ERROR)
+        return ERR_DB_FILE;
+    n = read_wal(fd, &log, &replay);
+    free(log);
+    unlock_wal();
+
+    if (n < 0 || (replay && replay_wal(fd) != NO_ERROR))
+        return ERR_DB_FILE;
+
+    if (!wal_enabled)
+    {
+        // the operations of this run would not be logged, so the log has to
+        // be made obsolete before any of them happen
+        if (lock_wal() != NO_ERROR)
+            return ERR_DB_FILE;
+        if (n > 0)
+            rc = sync_db_files(fd);
+        if (rc == NO_ERROR)
+            unlink(DB_WAL_FILE);
+        unlock_wal();
+        close(db_wal_fd);
+        db_wal_fd = -1;
+    }
+
+    return rc;
+}
+
+/*
+ *  open_database
+ *      dbFile:  name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ *
+ *  Headers of existing databases are loaded (and created for older files)
+ *  as part of opening them, see load_header(), and the write-ahead log is
+ *  recovered, see recover_wal().
+ *
+ *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *
+ *  console:  This function does not produce any output
+ */
+static int open_database(char *dbFile, bool should_truncate)
+{
+    // Set permissions: rw-rw----
+    // see sys/stat.h for constants
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    // open the file if it exists for Read and Write,
+    // create it if it does not exist
+    int flags = O_RDWR | O_CREAT;
+
+    if (should_truncate)
+        flags += O_TRUNC;
+
+    // Now open file
+    int fd = open(dbFile, flags, mode);
+
+    if (fd == -1)
+        return ERR_DB_FILE;
+
+    // read the header, upgrading files written before it existed, then
+    // replay the write-ahead log if it is needed
+    if (load_header(fd) != NO_ERROR || recover_wal(fd) != NO_ERROR)
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    return fd;
+}
+
+/*
+ *  open_db
+ *      dbFile:  name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ *
+ *  Opens the database with open_database().
+ *
+ *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *
+ *  console:  Does not produce any console I/O on success
+ *            M_ERR_DB_OPEN on error
+ *
+ */
+int open_db(char *dbFile, bool should_truncate)
+{
+    int fd = open_database(dbFile, should_truncate);
+
+    if (fd < 0)
+        printf(M_ERR_DB_OPEN);
+    return fd;
+}
+
+/*
+ *  close_db
+ *      fd:  linux file descriptor returned by open_db() or compress_db()
+ *
+ *  Commits what is left in the write-ahead log, releases the mapping, the
+ *  log, the bitmap and the index files that belong to the database and
+ *  closes it.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  This function does not produce any output
+ */
+void close_db(int fd)
+{
+    commit_wal(fd);
+    unmap_db();
+    cache_release();
+
+    if (db_wal_fd != -1)
+        close(db_wal_fd);
+    db_wal_fd = -1;
+
+    if (db_bits_fd != -1)
+        close(db_bits_fd);
+    if (db_idx_fd != -1)
+        close(db_idx_fd);
+    if (db_names_fd != -1)
+        close(db_names_fd);
+    if (db_gpa_fd != -1)
+        close(db_gpa_fd);
+    if (db_cols_fd != -1)
+        close(db_cols_fd);
+    db_bits_fd = -1;
+    db_idx_fd = -1;
+    db_names_fd = -1;
+    db_gpa_fd = -1;
+    db_cols_fd = -1;
+    db_hdr_fd = -1;
+    meta_depth = 0;
+    memset(&db_idx, 0, sizeof(db_idx));
+    memset(&db_names, 0, sizeof(db_names));
+    memset(&db_gpa, 0, sizeof(db_gpa));
+    memset(&db_cols, 0, sizeof(db_cols));
+
+    close(fd);
+}
+
+/*
+ *  student_slot
+ *      fd:     linux file descriptor
+ *      id:     the student id we are looking for
+ *      *slot:  set to the file offset the student should be at
+ *
+ *  Finds the slot of the student without reading it, see locate_student().
+ *
+ *  returns:  NO_ERROR       *slot is set
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student is not in the database
+ */
+static int student_slot(int fd, int id, off_t *slot)
+{
+    int rc;
+
+    if(id < MIN_STD_ID){
+        return SRCH_NOT_FOUND;
+    }
+
+    *slot = (off_t)id * STUDENT_RECORD_SIZE;
+
+    if(is_paged(fd)){
+        // paged files find the slot through their directory
+        if((rc = paged_lookup(fd, id, false, slot)) < 0){
+            return ERR_DB_FILE;
+        }
+        if(rc == 0){
+            return SRCH_NOT_FOUND;
+        }
+    } else if(id > MAX_STD_ID){
+        return SRCH_NOT_FOUND;
+    } else if(have_header(fd) && !bit_test(id)){
+        // the bitmap answers misses without touching the database at all,
+        // its bit is reread first in case another process just added id
+        refresh_bits(id, 1);
+        if(!bit_test(id)){
+            return SRCH_NOT_FOUND;
+        }
+    }
+
+    // compressed files tell where the student is through their index
+    if(have_index(fd)){
+        if((rc = idx_lookup(id)) == 0 && refresh_index()){
+            rc = idx_lookup(id);
+        }
+        if(rc < 0){
+            return ERR_DB_FILE;
+        }
+        if(rc == 0){
+            return SRCH_NOT_FOUND;
+        }
+        *slot = (off_t)rc * STUDENT_RECORD_SIZE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  locate_student
+ *      fd:    linux file descriptor
+ *      id:    the student id we are looking for
+ *      *s:    where the located (if found) student data will be copied
+ *      *pos:  where the file offset of the located record will be stored
+ *
+ *  add_student() stores each student at id * STUDENT_RECORD_SIZE, so the
+ *  record can normally be read directly from its slot with a single pread().
+ *  Files written by compress_db() are packed instead, and their index gives
+ *  the slot, see Packed index.  Paged files have a directory, see Paged
+ *  layout.  Ids that are not set in the occupancy bitmap
+ *  are reported as not found right away.  Should the slot turn out to hold a
+ *  different student, or a file have no header at all, the file is scanned
+ *  from the beginning instead.  With SDB_CACHE the slot is read through the
+ *  page cache, see Page cache.  A file that another process replaced is
+ *  left for the new one first, see follow_db().
+ *
+ *  returns:  NO_ERROR       student located, *s and *pos are set
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  console:  Does not produce any console I/O
+ */
+static int locate_student(int fd, int id, student_t *s, off_t *pos)
+{
+    student_t student;
+    student_t *map;
+    struct stat st;
+    scan_t sc;
+    off_t slot;
+    ssize_t bytesRead;
+    int rc;
+
+    if(id < MIN_STD_ID){
+        return SRCH_NOT_FOUND;
+    }
+
+    if(follow_db(fd) != NO_ERROR){
+        return ERR_DB_FILE;
+    }
+    map = map_db(fd, 0);
+
+    count_records_touched(1);
+    if((rc = student_slot(fd, id, &slot)) != NO_ERROR){
+        return rc;
+    }
+
+    // a slot past the end of the mapping was appended by another process
+    // after it was made, it is read from the file instead
+    if(map != NULL && slot + STUDENT_RECORD_SIZE <= (off_t)db_map_len){
+        size_t i = slot / STUDENT_RECORD_SIZE;
+        if(map[i].id == id){
+            *s = map[i];
+            *pos = slot;
+            return NO_ERROR;
+        }
+        if(map[i].id == DELETED_STUDENT_ID &&
+           db_map_len >= (size_t)MAX_STD_ID * STUDENT_RECORD_SIZE){
+            return SRCH_NOT_FOUND;
+        }
+    } else {
+        bytesRead = cache_read(fd, &student, slot);
+        if(bytesRead == -1){
+            return ERR_DB_FILE;
+        }
+        if(bytesRead == STUDENT_RECORD_SIZE){
+            if(student.id == id){
+                *s = student;
+                *pos = slot;
+                return NO_ERROR;
+            }
+            if(student.id == DELETED_STUDENT_ID){
+                if(fstat(fd, &st) == -1){
+                    return ERR_DB_FILE;
+                }
+                if(st.st_size >= (off_t)MAX_STD_ID * STUDENT_RECORD_SIZE){
+                    return SRCH_NOT_FOUND;
+                }
+            }
+        }
+    }
+
+    // the directory of a paged file is never wrong about the slot, and the
+    // slot was read from the file itself if it lies past the mapping (a
+    // data page another process allocated), so a miss here is a real one
+    if(is_paged(fd)){
+        return SRCH_NOT_FOUND;
+    }
+
+    // compressed file, fall back to scanning it
+    if(scan_begin(&sc, fd) != NO_ERROR){
+        return ERR_DB_FILE;
+    }
+
+    while((rc = scan_next(&sc, &student, &slot)) > 0){
+        if(student.id == id){
+            scan_end(&sc);
+            *s = student;
+            *pos = slot;
+            return NO_ERROR;
+        }
+    }
+    scan_end(&sc);
+
+    if(rc < 0){
+        return ERR_DB_FILE;
+    }
+
+    return SRCH_NOT_FOUND;
+}
+
+/*
+ *  lookup_student
+ *      fd, id, *s, *pos:  see locate_student()
+ *
+ *  locate_student() for callers that hold no lock.  With -m the lookup
+ *  reads the mapping, and another process that cut the file short
+ *  meanwhile (compact_db(), -z) would make that read fault.  The range of
+ *  the id is locked shared for the lookup, which any such process has to
+ *  lock exclusively first.
+ *
+ *  returns:  see locate_student()
+ */
+static int lookup_student(int fd, int id, student_t *s, off_t *pos)
+{
+    int rc;
+
+    if (!mmap_enabled || id < MIN_STD_ID)
+        return locate_student(fd, id, s, pos);
+
+    if (lock_range(fd, F_RDLCK, (off_t)id * STUDENT_RECORD_SIZE, STUDENT_RECORD_SIZE) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = locate_student(fd, id, s, pos);
+    unlock_slot(fd, id);
+    return rc;
+}
+
+/*
+ *  get_student
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking forname of the
+ *      *s:  a pointer where the located (if found) student data will be
+ *           copied
+ *
+ *  The student is looked up directly at its slot, see locate_student().
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_student(int fd, int id, student_t *s)
+{
+    off_t pos;
+
+    return lookup_student(fd, id, s, &pos);
+}
+
+/*
+ *  store_student
+ *      fd:     linux file descriptor
+ *      id:     student id (range is defined in db.h )
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer (range defined in db.h)
+ *
+ *  Adds a new student to the database.  After calculating the index for the
+ *  student, check if there is another student already at that location.  A good
+ *  way is to use something like memcmp() to ensure that the location for this
+ *  student contains all zero byes indicating the space is empty.
+ *
+ *  A compressed file has its students packed instead, there the new student
+ *  is appended after the last record, see Packed index.  In a paged file the
+ *  slot is found, or its page allocated, through the directory, see Paged
+ *  layout.  The caller holds the locks, see insert_student().
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           already exists)
+ *
+ *  console:  This function does not produce any output
+ */
+static int store_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    student_t newStudent;
+    student_t existingStudent;
+    student_t *map;
+    struct stat st;
+    off_t pos;
+    off_t need;
+    ssize_t bytesRead;
+    ssize_t bytesWritten;
+    int rc;
+
+    pos = (off_t)id * STUDENT_RECORD_SIZE;
+
+    if(ensure_header(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // the mapped file is extended to the same size the sentinel byte
+    // below would give it, or just past this record if it is larger
+    need = pos + STUDENT_RECORD_SIZE > MAX_STD_ID * STUDENT_RECORD_SIZE ?
+           pos + STUDENT_RECORD_SIZE : MAX_STD_ID * STUDENT_RECORD_SIZE;
+
+    // a compressed file has no slot set aside for id, the student is
+    // appended after the last record and entered in the index instead
+    if(have_index(fd)){
+        refresh_bits(id, 1);
+        if(bit_test(id))
+            return ERR_DB_OP;
+        if(fstat(fd, &st) == -1)
+            return ERR_DB_FILE;
+        pos = st.st_size - st.st_size % STUDENT_RECORD_SIZE;
+        need = pos + STUDENT_RECORD_SIZE;
+    }
+
+    // a paged file gets the data page of id allocated if it has none yet
+    if(is_paged(fd)){
+        if(lock_meta(fd) != NO_ERROR)
+            return ERR_DB_FILE;
+        rc = paged_lookup(fd, id, true, &pos);
+        unlock_meta(fd);
+        if(rc < 0)
+            return ERR_DB_FILE;
+        need = pos + STUDENT_RECORD_SIZE;
+    }
+
+    memset(&newStudent, 0, STUDENT_RECORD_SIZE);
+    newStudent.id = id;
+    strncpy(newStudent.fname,fname,sizeof(newStudent.fname)-1);
+    strncpy(newStudent.lname,lname,sizeof(newStudent.lname)-1);
+    newStudent.gpa = gpa;
+
+    map = map_db(fd, need);
+    if(map != NULL){
+        student_t *rec = &map[pos / STUDENT_RECORD_SIZE];
+
+        if(rec->id != 0)
+            return ERR_DB_OP;
+
+        if(log_student(fd, 'a', &newStudent) != NO_ERROR)
+            return ERR_DB_FILE;
+        *rec = newStudent;
+
+        // with -w the log makes the record durable, see Write-ahead log
+        if((!wal_enabled && sync_record(rec) != NO_ERROR) ||
+           note_student(fd, &newStudent, pos, true) != NO_ERROR)
+            return ERR_DB_FILE;
+
+        return NO_ERROR;
+    }
+
+    // reserve the MAX_STD_ID slots, only once so a tail page that -X freed
+    // is not allocated again by every add
+    if (db_hdr.layout == DB_LAYOUT_FLAT && fstat(fd, &st) == 0 &&
+        st.st_size < (off_t)MAX_STD_ID * STUDENT_RECORD_SIZE) {
+        char nullByte = 0;
+        pwrite(fd, &nullByte, 1, (off_t)MAX_STD_ID * STUDENT_RECORD_SIZE - 1);
+    }
+
+    bytesRead = cache_read(fd, &existingStudent, pos);
+    if (bytesRead == STUDENT_RECORD_SIZE && existingStudent.id != 0)
+        return ERR_DB_OP;
+
+    if(log_student(fd, 'a', &newStudent) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if(seek_db(fd,pos,SEEK_SET)==-1)
+        return ERR_DB_FILE;
+
+    bytesWritten = write(fd,&newStudent,STUDENT_RECORD_SIZE);
+    if(bytesWritten != STUDENT_RECORD_SIZE || note_student(fd, &newStudent, pos, true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  insert_student
+ *      fd:     linux file descriptor
+ *      id:     student id, already checked with validate_range()
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer, already checked with validate_range()
+ *
+ *  Adds the student with store_student() while holding the lock of its
+ *  slot, and for a packed file slot 0, see Locking.
+ *
+ *  returns:  see store_student()
+ *
+ *  console:  This function does not produce any output
+ */
+static int insert_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    bool packed;
+    int rc;
+
+    if(lock_slot(fd, id) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // the index of a packed file decides where the student goes
+    packed = have_index(fd);
+    if(packed && lock_meta(fd) != NO_ERROR){
+        unlock_slot(fd, id);
+        return ERR_DB_FILE;
+    }
+
+    rc = store_student(fd, id, fname, lname, gpa);
+    if(rc == NO_ERROR){
+        count_records_touched(1);
+    }
+
+    if(packed){
+        unlock_meta(fd);
+    }
+    unlock_slot(fd, id);
+    return rc;
+}
+
+/*
+ *  add_student
+ *      fd:     linux file descriptor
+ *      id:     student id (range is defined in db.h )
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer (range defined in db.h)
+ *
+ *  Checks the range of id and gpa and adds the student with
+ *  insert_student().
+ *
+ *  returns:  see store_student()
+ *
+ *  console:  M_STD_ADDED       on success
+ *            M_ERR_STD_RNG     id or gpa out of range
+ *            M_ERR_DB_ADD_DUP  student already exists
+ *            M_ERR_DB_WRITE    error reading or writing the database file
+ */
+int add_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    int rc;
+
+    if(validate_range(id,gpa)== EXIT_FAIL_ARGS){
+        printf(M_ERR_STD_RNG);
+        return EXIT_FAIL_DB;
+    }
+
+    rc = insert_student(fd, id, fname, lname, gpa);
+    if(rc == NO_ERROR){
+        printf(M_STD_ADDED,id);
+    } else if(rc == ERR_DB_OP){
+        printf(M_ERR_DB_ADD_DUP, id);
+    } else {
+        printf(M_ERR_DB_WRITE);
+    }
+    return rc;
+}
+
+/*
+ *  Bulk loading
+ *
+ *  bulk_load() adds a whole file of students in one process.  All lines are
+ *  parsed and validated up front, sorted by id, and then written with one
+ *  pwritev() per run of neighbouring slots instead of one lseek()+write()
+ *  per student.  Small gaps between the ids of a run are filled with empty
+ *  records so a run is only broken by a large gap or an existing student.
+ *  The header and bitmap are written once at the end followed by a single
+ *  fsync() of the database.  Compressed files get the students appended
+ *  back to back instead, paged files get them written to their data pages.
+ *  The runs are collected in a bulk_batch_t and written URING_DEPTH at a
+ *  time with uring_rw(), which with -q submits each batch at once, see
+ *  Asynchronous I/O.
+ */
+#define BULK_IOV_MAX    1024    // records (iovecs) per pwritev() call
+#define BULK_MAX_GAP    63      // empty slots a run may bridge, < one 4K page
+#define BULK_BATCH_IOVS (16 * BULK_IOV_MAX)     // records per bulk_batch_t
+
+typedef struct bulk_batch{
+    int fd;
+    int nios;
+    int niov;
+    uring_io_t ios[URING_DEPTH];
+    struct iovec iov[BULK_BATCH_IOVS];
+} bulk_batch_t;
+
+typedef struct bulk_rec{
+    student_t s;
+    int line;                   // line number in the input, for messages
+} bulk_rec_t;
+
+typedef struct bulk_set{
+    bulk_rec_t *recs;
+    size_t cap;
+    int nrecs;
+    int rejected;               // lines reported and skipped so far
+} bulk_set_t;
+
+// parses a whole input file into set, see load_students()
+typedef int (*bulk_parse_fn)(char *text, size_t len, bulk_set_t *set);
+
+static bulk_batch_t *bulk_batch(int fd)
+{
+    bulk_batch_t *b = malloc(sizeof(*b));
+
+    if (b != NULL)
+    {
+        b->fd = fd;
+        b->nios = 0;
+        b->niov = 0;
+    }
+    return b;
+}
+
+/*
+ *  bulk_flush
+ *      b:  the batch
+ *
+ *  Writes every run of the batch and empties it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int bulk_flush(bulk_batch_t *b)
+{
+    int rc = uring_rw(b->fd, b->ios, b->nios, true);
+
+    for (int i = 0; i < b->nios && rc == NO_ERROR; i++)
+    {
+        if (b->ios[i].res != (ssize_t)b->ios[i].iovcnt * STUDENT_RECORD_SIZE)
+            rc = ERR_DB_FILE;
+    }
+
+    b->nios = 0;
+    b->niov = 0;
+    return rc;
+}
+
+/*
+ *  bulk_run
+ *      b:  the batch
+ *
+ *  Makes room for one more run of up to BULK_IOV_MAX records, writing the
+ *  batch out first if it is full.  The run is added with bulk_push().
+ *
+ *  returns:  the iovecs to fill in, NULL if the batch could not be written
+ */
+static struct iovec *bulk_run(bulk_batch_t *b)
+{
+    if ((b->nios == URING_DEPTH || b->niov + BULK_IOV_MAX > BULK_BATCH_IOVS) &&
+        bulk_flush(b) != NO_ERROR)
+        return NULL;
+
+    return &b->iov[b->niov];
+}
+
+static void bulk_push(bulk_batch_t *b, off_t off, int iovcnt)
+{
+    b->ios[b->nios].iov = &b->iov[b->niov];
+    b->ios[b->nios].iovcnt = iovcnt;
+    b->ios[b->nios].off = off;
+    b->nios++;
+    b->niov += iovcnt;
+}
+
+static int bulk_cmp(const void *a, const void *b)
+{
+    const bulk_rec_t *x = a;
+    const bulk_rec_t *y = b;
+
+    if (x->s.id != y->s.id)
+        return x->s.id < y->s.id ? -1 : 1;
+    return x->line - y->line;
+}
+
+/*
+ *  bulk_field
+ *      field:  start of a field, surrounding blanks are removed in place
+ *
+ *  returns:  the trimmed field
+ */
+static char *bulk_field(char *field)
+{
+    char *end;
+
+    while (*field == ' ' || *field == '\t')
+        field++;
+
+    end = field + strlen(field);
+    while (end > field && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        *--end = '\0';
+
+    return field;
+}
+
+/*
+ *  bulk_parse_line
+ *      line:  NUL terminated line from the input file, modified in place
+ *      *s:    where the parsed student is stored
+ *
+ *  A line holds the same four values -a takes on the command line: id,
+ *  first name, last name and gpa.  They are separated by tabs if the line
+ *  has any, otherwise by commas if it has any, otherwise by blanks.
+ *
+ *  returns:  true if four fields were found and id and gpa are integers
+ */
+static bool bulk_parse_line(char *line, student_t *s)
+{
+    const char *delims = strchr(line, '\t') ? "\t" : strchr(line, ',') ? "," : " ";
+    char *field[4];
+    char *save = NULL;
+    char *tok;
+    char *end;
+    long id, gpa;
+    int n = 0;
+
+    for (tok = strtok_r(line, delims, &save); tok != NULL;
+         tok = strtok_r(NULL, delims, &save))
+    {
+        if (n == 4)
+            return false;
+        field[n++] = bulk_field(tok);
+    }
+    if (n != 4)
+        return false;
+
+    id = strtol(field[0], &end, 10);
+    if (*field[0] == '\0' || *end != '\0' || id < INT32_MIN || id > INT32_MAX)
+        return false;
+    gpa = strtol(field[3], &end, 10);
+    if (*field[3] == '\0' || *end != '\0' || gpa < INT32_MIN || gpa > INT32_MAX)
+        return false;
+
+    memset(s, 0, sizeof(*s));
+    s->id = (int)id;
+    strncpy(s->fname, field[1], sizeof(s->fname) - 1);
+    strncpy(s->lname, field[2], sizeof(s->lname) - 1);
+    s->gpa = (int)gpa;
+    return true;
+}
+
+/*
+ *  bulk_read_file
+ *      path:  file to read, "-" reads standard input
+ *      *len:  set to the number of bytes read
+ *
+ *  returns:  a malloc()ed, NUL terminated copy of the file, or NULL
+ */
+static char *bulk_read_file(char *path, size_t *len)
+{
+    int in = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    size_t cap = 1 << 20;
+    char *text;
+    ssize_t n;
+
+    if (in == -1)
+        return NULL;
+
+    *len = 0;
+    text = malloc(cap);
+    while (text != NULL && (n = read(in, text + *len, cap - *len - 1)) > 0)
+    {
+        *len += n;
+        if (cap - *len - 1 == 0)
+        {
+            char *bigger = realloc(text, cap * 2);
+            if (bigger == NULL)
+                free(text);
+            text = bigger;
+            cap *= 2;
+        }
+    }
+
+    if (text != NULL && n == -1)
+    {
+        free(text);
+        text = NULL;
+    }
+    if (in != STDIN_FILENO)
+        close(in);
+
+    if (text != NULL)
+        text[*len] = '\0';
+    return text;
+}
+
+/*
+ *  bulk_write_flat
+ *      fd:     linux file descriptor of a flat database
+ *      recs:   students to add, sorted by id and not in the database yet
+ *      nrecs:  number of students, at least 1
+ *
+ *  Writes each student to its slot, one write per run of neighbouring
+ *  slots, see Bulk loading above.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int bulk_write_flat(int fd, bulk_rec_t *recs, int nrecs)
+{
+    bulk_batch_t *b = bulk_batch(fd);
+    struct iovec *iov;
+    struct stat st;
+    int rc;
+
+    if (b == NULL)
+        return ERR_DB_FILE;
+
+    // reserve the MAX_STD_ID slots just like add_student() does
+    if (fstat(fd, &st) == 0 &&
+        st.st_size < (off_t)MAX_STD_ID * STUDENT_RECORD_SIZE)
+    {
+        char nullByte = 0;
+        if (pwrite(fd, &nullByte, 1, (off_t)MAX_STD_ID * STUDENT_RECORD_SIZE - 1) != 1)
+        {
+            free(b);
+            return ERR_DB_FILE;
+        }
+    }
+
+    for (int i = 0; i < nrecs;)
+    {
+        off_t start = (off_t)recs[i].s.id * STUDENT_RECORD_SIZE;
+        int next_id = recs[i].s.id;
+        int iovcnt = 0;
+
+        if ((iov = bulk_run(b)) == NULL)
+        {
+            free(b);
+            return ERR_DB_FILE;
+        }
+
+        while (i < nrecs && iovcnt < BULK_IOV_MAX)
+        {
+            int gap = recs[i].s.id - next_id;
+            bool free_gap = gap <= BULK_MAX_GAP && iovcnt + gap < BULK_IOV_MAX;
+
+            for (int id = next_id; free_gap && id < recs[i].s.id; id++)
+                free_gap = !bit_test(id);
+            if (!free_gap)
+                break;
+
+            for (; next_id < recs[i].s.id; next_id++)
+            {
+                iov[iovcnt].iov_base = (void *)&EMPTY_STUDENT_RECORD;
+                iov[iovcnt++].iov_len = STUDENT_RECORD_SIZE;
+            }
+            iov[iovcnt].iov_base = &recs[i].s;
+            iov[iovcnt++].iov_len = STUDENT_RECORD_SIZE;
+            next_id++;
+            i++;
+        }
+
+        bulk_push(b, start, iovcnt);
+    }
+
+    rc = bulk_flush(b);
+    free(b);
+    return rc;
+}
+
+/*
+ *  bulk_write_packed
+ *      fd:     linux file descriptor of a compressed database
+ *      recs:   students to add, not in the database yet
+ *      nrecs:  number of students, at least 1
+ *
+ *  Appends the students after the last record, BULK_IOV_MAX per write,
+ *  and enters them all in the index with a single rewrite of it.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int bulk_write_packed(int fd, bulk_rec_t *recs, int nrecs)
+{
+    bulk_batch_t *b = bulk_batch(fd);
+    db_idx_entry_t *add = malloc((size_t)nrecs * sizeof(*add));
+    struct iovec *iov;
+    struct stat st;
+    off_t end;
+    int rc = NO_ERROR;
+
+    if (b == NULL || add == NULL || fstat(fd, &st) == -1)
+    {
+        free(b);
+        free(add);
+        return ERR_DB_FILE;
+    }
+    end = st.st_size - st.st_size % STUDENT_RECORD_SIZE;
+
+    for (int i = 0; i < nrecs && rc == NO_ERROR;)
+    {
+        int iovcnt = 0;
+
+        if ((iov = bulk_run(b)) == NULL)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        for (; i < nrecs && iovcnt < BULK_IOV_MAX; i++)
+        {
+            add[i].id = recs[i].s.id;
+            add[i].slot = end / STUDENT_RECORD_SIZE + iovcnt;
+            iov[iovcnt].iov_base = &recs[i].s;
+            iov[iovcnt++].iov_len = STUDENT_RECORD_SIZE;
+        }
+
+        bulk_push(b, end, iovcnt);
+        end += (off_t)iovcnt * STUDENT_RECORD_SIZE;
+    }
+
+    if (rc == NO_ERROR)
+        rc = bulk_flush(b);
+    if (rc == NO_ERROR)
+        rc = idx_merge(add, nrecs);
+    free(b);
+    free(add);
+    return rc;
+}
+
+/*
+ *  bulk_in_db
+ *      fd:  linux file descriptor
+ *      id:  student id, in range for the database
+ *
+ *  returns:  true if student id is already in the database
+ */
+static bool bulk_in_db(int fd, int id)
+{
+    student_t s;
+    off_t pos;
+
+    if (is_paged(fd))
+        return locate_student(fd, id, &s, &pos) == NO_ERROR;
+    return bit_test(id);
+}
+
+/*
+ *  bulk_write_paged
+ *      fd:     linux file descriptor of a paged database
+ *      recs:   students to add, sorted by id and not in the database yet
+ *      nrecs:  number of students, at least 1
+ *
+ *  Writes each student to its slot, allocating the data pages that are
+ *  missing first.  The students of one page share a single directory
+ *  lookup.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure
+ */
+static int bulk_write_paged(int fd, bulk_rec_t *recs, int nrecs)
+{
+    bulk_batch_t *b = bulk_batch(fd);
+    struct iovec *iov;
+    off_t page = 0;
+    int page_no = -1;
+    int rc;
+
+    if (b == NULL)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < nrecs; i++)
+    {
+        int id = recs[i].s.id;
+
+        if (id / DB_PAGE_RECS != page_no)
+        {
+            off_t pos;
+
+            if (paged_lookup(fd, id, true, &pos) < 0)
+            {
+                free(b);
+                return ERR_DB_FILE;
+            }
+            page = pos - (off_t)(id % DB_PAGE_RECS) * STUDENT_RECORD_SIZE;
+            page_no = id / DB_PAGE_RECS;
+        }
+
+        if ((iov = bulk_run(b)) == NULL)
+        {
+            free(b);
+            return ERR_DB_FILE;
+        }
+        iov->iov_base = &recs[i].s;
+        iov->iov_len = STUDENT_RECORD_SIZE;
+        bulk_push(b, page + (off_t)(id % DB_PAGE_RECS) * STUDENT_RECORD_SIZE, 1);
+    }
+
+    rc = bulk_flush(b);
+    free(b);
+    return rc;
+}
+
+/*
+ *  bulk_add
+ *      set:   students parsed so far
+ *      s:     student to add to it
+ *      line:  line (or record) number of s in the input
+ *
+ *  Checks the ranges of s and adds it to set, see load_students().
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if out of memory
+ *
+ *  console:  M_ERR_BULK_RNG  id or gpa out of allowable range
+ */
+static int bulk_add(bulk_set_t *set, const student_t *s, int line)
+{
+    if (validate_range(s->id, s->gpa) != NO_ERROR)
+    {
+        printf(M_ERR_BULK_RNG, line);
+        set->rejected++;
+        return NO_ERROR;
+    }
+
+    if ((size_t)set->nrecs == set->cap)
+    {
+        size_t cap = set->cap ? set->cap * 2 : 4096;
+        bulk_rec_t *bigger = realloc(set->recs, cap * sizeof(*bigger));
+
+        if (bigger == NULL)
+            return ERR_DB_FILE;
+        set->recs = bigger;
+        set->cap = cap;
+    }
+    set->recs[set->nrecs].s = *s;
+    set->recs[set->nrecs].line = line;
+    set->nrecs++;
+    return NO_ERROR;
+}
+
+/*
+ *  bulk_parse_text
+ *      text:  NUL terminated input, modified in place
+ *      len:   length of text
+ *      set:   where the students are added
+ *
+ *  Parses the input of -b, one student per line, see bulk_parse_line().
+ *  Blank lines and lines starting with # are ignored, as is an unparsable
+ *  first line so a CSV header row can be left in place.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if out of memory
+ *
+ *  console:  M_ERR_BULK_PARSE  a line could not be parsed
+ *            M_ERR_BULK_RNG    id or gpa on a line out of allowable range
+ */
+static int bulk_parse_text(char *text, size_t len, bulk_set_t *set)
+{
+    int line_no = 0;
+    bool first = true;
+    char *line, *next;
+
+    (void)len;
+    for (line = text; line != NULL && *line != '\0'; line = next)
+    {
+        student_t s;
+        char *p;
+
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        line_no++;
+
+        for (p = line; *p == ' ' || *p == '\t' || *p == '\r'; p++)
+            ;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        if (!bulk_parse_line(line, &s))
+        {
+            if (!first)
+            {
+                printf(M_ERR_BULK_PARSE, line_no);
+                set->rejected++;
+            }
+            first = false;
+            continue;
+        }
+        first = false;
+
+        if (bulk_add(set, &s, line_no) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  load_students
+ *      fd:     linux file descriptor
+ *      path:   file of students, "-" for standard input
+ *      parse:  parser for the format of the file, bulk_parse_text() for -b
+ *
+ *  Adds every valid student in the file to the database.  Students that
+ *  could not be parsed, are out of range, already in the database or
+ *  appear more than once in the file are reported and skipped, the others
+ *  are still added.
+ *
+ *  returns:  <number>       number of students added, if none were rejected
+ *            ERR_DB_OP      one or more lines were rejected
+ *            ERR_DB_FILE    database or input file I/O issue
+ *
+ *  console:  M_BULK_LOADED     on completion
+ *            M_ERR_BULK_OPEN   the input file could not be read
+ *            M_ERR_BULK_PARSE  a line could not be parsed
+ *            M_ERR_BULK_RNG    id or gpa on a line out of allowable range
+ *            M_ERR_DB_ADD_DUP  student already exists
+ *            M_ERR_DB_READ     error reading the database file
+ *            M_ERR_DB_WRITE    error writing to the database file
+ */
+static int load_students(int fd, char *path, bulk_parse_fn parse)
+{
+    bulk_set_t set = {0};
+    bulk_rec_t *recs;
+    size_t len;
+    int nrecs, kept, rejected, rc;
+    char *text;
+
+    text = bulk_read_file(path, &len);
+    if (text == NULL)
+    {
+        printf(M_ERR_BULK_OPEN, path);
+        return ERR_DB_FILE;
+    }
+
+    rc = parse(text, len, &set);
+    free(text);
+    if (rc != NO_ERROR)
+    {
+        free(set.recs);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    recs = set.recs;
+    nrecs = set.nrecs;
+    rejected = set.rejected;
+
+    if (ensure_header(fd) != NO_ERROR)
+    {
+        free(recs);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // sort by id, ties keep file order so the first occurrence wins, then
+    // drop duplicates within the file and students already in the database
+    qsort(recs, nrecs, sizeof(*recs), bulk_cmp);
+    kept = 0;
+    for (int i = 0; i < nrecs; i++)
+    {
+        int id = recs[i].s.id;
+
+        if ((kept > 0 && recs[kept - 1].s.id == id) || bulk_in_db(fd, id))
+        {
+            printf(M_ERR_DB_ADD_DUP, id);
+            rejected++;
+            continue;
+        }
+        recs[kept++] = recs[i];
+    }
+    nrecs = kept;
+
+    if (nrecs > 0)
+    {
+        // the name and gpa indexes and the columns are rebuilt by the next
+        // query that needs them, see Name index
+        if (drop_names() != NO_ERROR || drop_gpa() != NO_ERROR ||
+            drop_cols() != NO_ERROR)
+            rc = ERR_DB_FILE;
+        else if (is_paged(fd))
+            rc = bulk_write_paged(fd, recs, nrecs);
+        else if (have_index(fd))
+            rc = bulk_write_packed(fd, recs, nrecs);
+        else
+            rc = bulk_write_flat(fd, recs, nrecs);
+
+        if (rc != NO_ERROR)
+        {
+            free(recs);
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+    }
+
+    for (int i = 0; i < nrecs && !is_paged(fd); i++)
+        bit_assign(recs[i].s.id, true);
+    db_hdr.record_count += nrecs;
+    count_records_touched(nrecs);
+    free(recs);
+
+    if (write_bitmap() != NO_ERROR || fsync(db_bits_fd) == -1 ||
+        write_header(fd) != NO_ERROR || fsync(fd) == -1)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_BULK_LOADED, nrecs, rejected);
+    return rejected > 0 ? ERR_DB_OP : nrecs;
+}
+
+/*
+ *  load_locked
+ *      fd:     linux file descriptor
+ *      path:   file of students, "-" for standard input
+ *      parse:  parser for its format
+ *
+ *  Runs load_students() with the whole file locked, see Locking.
+ *
+ *  returns:  see load_students()
+ *
+ *  console:  see load_students()
+ */
+static int load_locked(int fd, char *path, bulk_parse_fn parse)
+{
+    int rc;
+
+    if (lock_file(fd, F_WRLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // the students are synced with the database instead of being logged,
+    // so a replay must never reach back past them
+    if (checkpoint_wal(fd) != NO_ERROR)
+    {
+        unlock_file(fd, F_WRLCK);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    rc = load_students(fd, path, parse);
+    unlock_file(fd, F_WRLCK);
+    return rc;
+}
+
+/*
+ *  bulk_load
+ *      fd:    linux file descriptor
+ *      path:  file with one student per line, "-" for standard input
+ *
+ *  Adds the students of a -b file, see bulk_parse_text() for its format.
+ *
+ *  returns:  see load_students()
+ *
+ *  console:  see load_students()
+ */
+int bulk_load(int fd, char *path)
+{
+    return load_locked(fd, path, bulk_parse_text);
+}
+
+/*
+ *  Export and import
+ *
+ *  -e writes every student to standard output as CSV, JSON Lines or raw
+ *  64 byte student_t records (host byte order, like the server protocol),
+ *  and -i adds the students of such a file the way -b does.  Instead of
+ *  two printf() calls per student like print_db(), export formats the
+ *  records itself into an EXPORT_BUF_SIZE buffer that is handed to
+ *  fwrite() whenever it fills up.  stdio passes a write that large straight
+ *  to write(), so that is one system call per buffer.
+ *
+ *  CSV starts with a header row and quotes the names that hold a comma, a
+ *  quote or a line break.  JSON Lines have one object per student with the
+ *  keys id, fname, lname and gpa.  In both gpa is the 3 digit int -a takes,
+ *  so what is exported imports back unchanged.
+ */
+#define EXPORT_BUF_SIZE     (1 << 20)
+#define EXPORT_REC_MAX      512     // most bytes one student is exported as
+
+#define FMT_CSV             0
+#define FMT_JSONL           1
+#define FMT_BIN             2
+
+static const char *const export_formats[] = { "csv", "jsonl", "bin" };
+
+// the FMT_* number of a format name, -1 if it is not one
+static int export_format(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(export_formats) / sizeof(export_formats[0])); i++)
+    {
+        if (strcmp(name, export_formats[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static char *put_int(char *p, int v)
+{
+    char digits[12];
+    unsigned int u = v < 0 ? -(unsigned int)v : (unsigned int)v;
+    int n = 0;
+
+    do
+    {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+
+    if (v < 0)
+        *p++ = '-';
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+static char *put_csv_name(char *p, const char *name, size_t max)
+{
+    size_t len = strnlen(name, max);
+    bool quote = false;
+
+    for (size_t i = 0; i < len && !quote; i++)
+        quote = name[i] == ',' || name[i] == '"' || name[i] == '\n' || name[i] == '\r';
+
+    if (!quote)
+    {
+        memcpy(p, name, len);
+        return p + len;
+    }
+
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++)
+    {
+        if (name[i] == '"')
+            *p++ = '"';
+        *p++ = name[i];
+    }
+    *p++ = '"';
+    return p;
+}
+
+static char *put_json_name(char *p, const char *name, size_t max)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t len = strnlen(name, max);
+
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = name[i];
+
+        if (c == '"' || c == '\\')
+        {
+            *p++ = '\\';
+            *p++ = c;
+        }
+        else if (c < 0x20)
+        {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 0xF];
+            p += 6;
+        }
+        else
+        {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+/*
+ *  export_record
+ *      p:    where to format the student, at least EXPORT_REC_MAX bytes
+ *      s:    the student
+ *      fmt:  FMT_CSV, FMT_JSONL or FMT_BIN
+ *
+ *  returns:  the end of what was written
+ */
+static char *export_record(char *p, const student_t *s, int fmt)
+{
+    switch (fmt)
+    {
+    case FMT_CSV:
+        p = put_int(p, s->id);
+        *p++ = ',';
+        p = put_csv_name(p, s->fname, sizeof(s->fname));
+        *p++ = ',';
+        p = put_csv_name(p, s->lname, sizeof(s->lname));
+        *p++ = ',';
+        p = put_int(p, s->gpa);
+        *p++ = '\n';
+        break;
+
+    case FMT_JSONL:
+        memcpy(p, "{\"id\":", 6);
+        p = put_int(p + 6, s->id);
+        memcpy(p, ",\"fname\":", 9);
+        p = put_json_name(p + 9, s->fname, sizeof(s->fname));
+        memcpy(p, ",\"lname\":", 9);
+        p = put_json_name(p + 9, s->lname, sizeof(s->lname));
+        memcpy(p, ",\"gpa\":", 7);
+        p = put_int(p + 7, s->gpa);
+        memcpy(p, "}\n", 2);
+        p += 2;
+        break;
+
+    default:
+        memcpy(p, s, STUDENT_RECORD_SIZE);
+        p += STUDENT_RECORD_SIZE;
+    }
+    return p;
+}
+
+/*
+ *  export_students
+ *      fd:   linux file descriptor
+ *      fmt:  FMT_CSV, FMT_JSONL or FMT_BIN
+ *
+ *  Writes every live record to standard output in file order, see Export
+ *  and import.  The caller holds the whole file locked, see export_db().
+ *
+ *  returns:  number of students written, ERR_DB_FILE if the database
+ *            could not be read or ERR_DB_OP if the output failed
+ */
+static int export_students(int fd, int fmt)
+{
+    char *buf = malloc(EXPORT_BUF_SIZE);
+    char *p = buf;
+    student_t student;
+    off_t pos;
+    scan_t sc;
+    int count = 0;
+    int rc;
+
+    if (buf == NULL || scan_begin(&sc, fd) != NO_ERROR)
+    {
+        free(buf);
+        return ERR_DB_FILE;
+    }
+
+    if (fmt == FMT_CSV)
+    {
+        memcpy(p, "id,first_name,last_name,gpa\n", 28);
+        p += 28;
+    }
+
+    // whatever was printed before must come out first
+    fflush(stdout);
+    while ((rc = scan_next(&sc, &student, &pos)) > 0)
+    {
+        if (EXPORT_BUF_SIZE - (p - buf) < EXPORT_REC_MAX)
+        {
+            if (fwrite(buf, 1, p - buf, stdout) != (size_t)(p - buf))
+            {
+                rc = ERR_DB_OP;
+                break;
+            }
+            p = buf;
+        }
+        p = export_record(p, &student, fmt);
+        count++;
+    }
+    scan_end(&sc);
+
+    if (rc == 0 && fwrite(buf, 1, p - buf, stdout) != (size_t)(p - buf))
+        rc = ERR_DB_OP;
+    if (rc == 0 && fflush(stdout) == EOF)
+        rc = ERR_DB_OP;
+    free(buf);
+
+    return rc == 0 ? count : rc;
+}
+
+/*
+ *  export_db
+ *      fd:      linux file descriptor
+ *      format:  "csv", "jsonl" or "bin"
+ *
+ *  Writes every student to standard output in format with
+ *  export_students(), holding a shared lock on the whole file, see Locking.
+ *
+ *  returns:  <number>       number of students written
+ *            ERR_DB_OP      format is not known
+ *            ERR_DB_FILE    database file I/O issue, or the output failed
+ *
+ *  console:  the students
+ *            M_ERR_FORMAT   format is not known
+ *            M_ERR_DB_READ  error reading the database file
+ */
+int export_db(int fd, char *format)
+{
+    int fmt = export_format(format);
+    int rc;
+
+    if (fmt < 0)
+    {
+        printf(M_ERR_FORMAT, format);
+        return ERR_DB_OP;
+    }
+
+    if (lock_file(fd, F_RDLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = export_students(fd, fmt);
+    unlock_file(fd, F_RDLCK);
+
+    // nothing more can be said on an output that failed
+    if (rc == ERR_DB_FILE)
+        printf(M_ERR_DB_READ);
+    return rc < 0 ? ERR_DB_FILE : rc;
+}
+
+// a whole field that is a decimal int
+static bool parse_int(const char *field, int *v)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(field, &end, 10);
+    if (end == field || *end != '\0' || errno != 0 || n < INT32_MIN || n > INT32_MAX)
+        return false;
+    *v = (int)n;
+    return true;
+}
+
+/*
+ *  csv_record
+ *      *p:     position in the text, moved past the record
+ *      field:  set to the first 4 fields of the record, unquoted in place
+ *
+ *  Splits one CSV record, which ends at a line break that is not quoted.
+ *
+ *  returns:  the number of fields of the record
+ */
+static int csv_record(char **p, char *field[4])
+{
+    char *in = *p;
+    int n = 0;
+
+    for (;;)
+    {
+        char *start = in;
+        char *out = in;
+        char sep;
+
+        if (*in == '"')
+        {
+            for (in++; *in != '\0'; *out++ = *in++)
+            {
+                if (*in == '"' && in[1] != '"')
+                    break;
+                if (*in == '"')
+                    in++;
+            }
+            if (*in == '"')
+                in++;
+        }
+        while (*in != '\0' && *in != ',' && *in != '\n')
+            *out++ = *in++;
+
+        sep = *in;
+        if (sep == '\n' && out > start && out[-1] == '\r')
+            out--;
+        *out = '\0';
+        if (n < 4)
+            field[n] = start;
+        n++;
+
+        if (sep == '\0')
+            break;
+        in++;
+        if (sep == '\n')
+            break;
+    }
+
+    *p = in;
+    return n;
+}
+
+/*
+ *  csv_parse_text
+ *      text:  NUL terminated CSV, modified in place
+ *      len:   length of text
+ *      set:   where the students are added
+ *
+ *  Parses the CSV -e csv writes, see Export and import.  An unparsable
+ *  first record (the header row) and empty lines are skipped.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if out of memory
+ *
+ *  console:  M_ERR_BULK_PARSE  a record could not be parsed
+ *            M_ERR_BULK_RNG    id or gpa of a record out of allowable range
+ */
+static int csv_parse_text(char *text, size_t len, bulk_set_t *set)
+{
+    char *p = text;
+    int rec_no = 0;
+
+    while (p < text + len)
+    {
+        char *field[4];
+        student_t s = {0};
+        int n = csv_record(&p, field);
+
+        rec_no++;
+        if (n == 1 && field[0][0] == '\0')
+            continue;
+
+        if (n != 4 || !parse_int(field[0], &s.id) || !parse_int(field[3], &s.gpa))
+        {
+            if (rec_no > 1)
+            {
+                printf(M_ERR_BULK_PARSE, rec_no);
+                set->rejected++;
+            }
+            continue;
+        }
+        strncpy(s.fname, field[1], sizeof(s.fname) - 1);
+        strncpy(s.lname, field[2], sizeof(s.lname) - 1);
+
+        if (bulk_add(set, &s, rec_no) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+static char *json_space(char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        p++;
+    return p;
+}
+
+/*
+ *  json_string
+ *      p:     a JSON string, starting at its opening quote
+ *      out:   where its value is stored, cut to size - 1 bytes, or NULL
+ *      size:  size of out
+ *
+ *  \u escapes of characters outside ASCII are stored as UTF-8.
+ *
+ *  returns:  the end of the string, NULL if it is not a valid one
+ */
+static char *json_string(char *p, char *out, size_t size)
+{
+    size_t n = 0;
+
+    if (*p++ != '"')
+        return NULL;
+
+    while (*p != '"')
+    {
+        char utf8[3];
+        int nbytes = 1;
+
+        if (*p == '\0')
+            return NULL;
+
+        utf8[0] = *p++;
+        if (utf8[0] == '\\')
+        {
+            char c = *p++;
+            unsigned int u = 0;
+
+            switch (c)
+            {
+            case 'b': utf8[0] = '\b'; break;
+            case 'f': utf8[0] = '\f'; break;
+            case 'n': utf8[0] = '\n'; break;
+            case 'r': utf8[0] = '\r'; break;
+            case 't': utf8[0] = '\t'; break;
+            case '"': case '\\': case '/': utf8[0] = c; break;
+            case 'u':
+                for (int i = 0; i < 4; i++, p++)
+                {
+                    char h = *p;
+
+                    if (h >= '0' && h <= '9')
+                        u = u * 16 + (h - '0');
+                    else if ((h | 0x20) >= 'a' && (h | 0x20) <= 'f')
+                        u = u * 16 + ((h | 0x20) - 'a' + 10);
+                    else
+                        return NULL;
+                }
+                if (u < 0x80)
+                {
+                    utf8[0] = u;
+                }
+                else if (u < 0x800)
+                {
+                    utf8[0] = 0xC0 | (u >> 6);
+                    utf8[1] = 0x80 | (u & 0x3F);
+                    nbytes = 2;
+                }
+                else
+                {
+                    utf8[0] = 0xE0 | (u >> 12);
+                    utf8[1] = 0x80 | ((u >> 6) & 0x3F);
+                    utf8[2] = 0x80 | (u & 0x3F);
+                    nbytes = 3;
+                }
+                break;
+            default:
+                return NULL;
+            }
+        }
+
+        for (int i = 0; i < nbytes; i++)
+        {
+            if (out != NULL && n + 1 < size)
+                out[n++] = utf8[i];
+        }
+    }
+
+    if (out != NULL)
+        out[n] = '\0';
+    return p + 1;
+}
+
+// a JSON integer, returns its end or NULL
+static char *json_int(char *p, int *v)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(p, &end, 10);
+    if (end == p || errno != 0 || n < INT32_MIN || n > INT32_MAX)
+        return NULL;
+    *v = (int)n;
+    return end;
+}
+
+/*
+ *  json_parse_line
+ *      line:  NUL terminated line
+ *      *s:    where the parsed student is stored
+ *
+ *  A line is one JSON object with the keys id, fname, lname and gpa, in any
+ *  order.  Other keys with a string or integer value are ignored.
+ *
+ *  returns:  true if all four keys were found
+ */
+static bool json_parse_line(char *line, student_t *s)
+{
+    int found = 0;      // bit per key
+    char *p = json_space(line);
+
+    memset(s, 0, sizeof(*s));
+    if (*p++ != '{')
+        return false;
+
+    for (;;)
+    {
+        char key[8];
+        int dummy;
+
+        p = json_string(json_space(p), key, sizeof(key));
+        if (p == NULL)
+            return false;
+        p = json_space(p);
+        if (*p++ != ':')
+            return false;
+        p = json_space(p);
+
+        if (strcmp(key, "id") == 0)
+        {
+            p = json_int(p, &s->id);
+            found |= 1;
+        }
+        else if (strcmp(key, "fname") == 0)
+        {
+            p = json_string(p, s->fname, sizeof(s->fname));
+            found |= 2;
+        }
+        else if (strcmp(key, "lname") == 0)
+        {
+            p = json_string(p, s->lname, sizeof(s->lname));
+            found |= 4;
+        }
+        else if (strcmp(key, "gpa") == 0)
+        {
+            p = json_int(p, &s->gpa);
+            found |= 8;
+        }
+        else
+        {
+            p = *p == '"' ? json_string(p, NULL, 0) : json_int(p, &dummy);
+        }
+        if (p == NULL)
+            return false;
+
+        p = json_space(p);
+        if (*p == '}')
+            break;
+        if (*p++ != ',')
+            return false;
+    }
+
+    return *json_space(p + 1) == '\0' && found == 15;
+}
+
+/*
+ *  jsonl_parse_text
+ *      text:  NUL terminated JSON Lines, modified in place
+ *      len:   length of text
+ *      set:   where the students are added
+ *
+ *  Parses the JSON Lines -e jsonl writes, see json_parse_line().  Empty
+ *  lines are skipped.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if out of memory
+ *
+ *  console:  M_ERR_BULK_PARSE  a line could not be parsed
+ *            M_ERR_BULK_RNG    id or gpa on a line out of allowable range
+ */
+static int jsonl_parse_text(char *text, size_t len, bulk_set_t *set)
+{
+    int line_no = 0;
+    char *line, *next;
+
+    (void)len;
+    for (line = text; line != NULL && *line != '\0'; line = next)
+    {
+        student_t s;
+
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        line_no++;
+
+        if (*json_space(line) == '\0')
+            continue;
+
+        if (!json_parse_line(line, &s))
+        {
+            printf(M_ERR_BULK_PARSE, line_no);
+            set->rejected++;
+            continue;
+        }
+
+        if (bulk_add(set, &s, line_no) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  bin_parse_text
+ *      text:  student_t records as -e bin writes them
+ *      len:   length of text
+ *      set:   where the students are added
+ *
+ *  A partial record at the end is reported and skipped.  The names of every
+ *  record are cut to the length add_student() stores.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if out of memory
+ *
+ *  console:  M_ERR_BULK_PARSE  the file ends in a partial record
+ *            M_ERR_BULK_RNG    id or gpa of a record out of allowable range
+ */
+static int bin_parse_text(char *text, size_t len, bulk_set_t *set)
+{
+    size_t nrecs = len / STUDENT_RECORD_SIZE;
+
+    for (size_t i = 0; i < nrecs; i++)
+    {
+        student_t s;
+
+        memcpy(&s, text + i * STUDENT_RECORD_SIZE, sizeof(s));
+        s.fname[sizeof(s.fname) - 1] = '\0';
+        s.lname[sizeof(s.lname) - 1] = '\0';
+        if (bulk_add(set, &s, (int)i + 1) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    if (len % STUDENT_RECORD_SIZE != 0)
+    {
+        printf(M_ERR_BULK_PARSE, (int)nrecs + 1);
+        set->rejected++;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  import_db
+ *      fd:      linux file descriptor
+ *      format:  "csv", "jsonl" or "bin"
+ *      path:    file written by -e format, "-" for standard input
+ *
+ *  Adds the students of the file like bulk_load() does, with the whole
+ *  file locked.  Records are numbered like lines in the messages.
+ *
+ *  returns:  see load_students(), ERR_DB_OP if format is not known
+ *
+ *  console:  see load_students()
+ *            M_ERR_FORMAT  format is not known
+ */
+int import_db(int fd, char *format, char *path)
+{
+    static const bulk_parse_fn parsers[] = { csv_parse_text, jsonl_parse_text, bin_parse_text };
+    int fmt = export_format(format);
+
+    if (fmt < 0)
+    {
+        printf(M_ERR_FORMAT, format);
+        return ERR_DB_OP;
+    }
+
+    return load_locked(fd, path, parsers[fmt]);
+}
+
+/*
+ *  Hole punching
+ *
+ *  A deleted record is overwritten with EMPTY_STUDENT_RECORD, which keeps
+ *  its file system block allocated.  Once every record of a 4 KiB page is
+ *  empty the page is handed back with fallocate(FALLOC_FL_PUNCH_HOLE |
+ *  FALLOC_FL_KEEP_SIZE): the file keeps its size and every record keeps its
+ *  offset, the page simply reads back as zeros from then on.  del_student()
+ *  does this for the page of the record it deletes, reclaim_db() (-X) for
+ *  every empty page that is still allocated, for example after deletes made
+ *  with an older sdbsc.  Neither copies any live data.
+ *
+ *  Page 0 holds the header and is never punched, neither are the directory
+ *  pages of a paged file.  Where the file system
+ *  can not punch holes (or on systems without fallocate) nothing is freed
+ *  and the records simply stay as they are.
+ */
+#define PUNCH_PAGE          4096
+#define PUNCH_PAGE_RECS     (PUNCH_PAGE / STUDENT_RECORD_SIZE)
+#define RECLAIM_CHUNK       (256 * PUNCH_PAGE)  // 1 MiB read at a time by -X
+
+/*
+ *  page_in_use
+ *      page:  page number in the file
+ *      recs:  the records of the page, or NULL to ask the bitmap.  Only
+ *             flat files with a header can be answered from the bitmap
+ *      n:     number of records in recs, less than a page at the end of
+ *             the file
+ *
+ *  returns:  true if the page holds the header or any live student
+ */
+static bool page_in_use(off_t page, const student_t *recs, int n)
+{
+    if (page == 0)
+        return true;
+
+    if (recs == NULL)
+    {
+        int first = (int)(page * PUNCH_PAGE_RECS);
+
+        for (int id = first; id < first + PUNCH_PAGE_RECS && id <= MAX_STD_ID; id++)
+        {
+            if (bit_test(id))
+                return true;
+        }
+        return false;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (recs[i].id != DELETED_STUDENT_ID)
+            return true;
+    }
+    return false;
+}
+
+/*
+ *  punch_page
+ *      fd:    linux file descriptor
+ *      page:  page number in the file
+ *
+ *  returns:  1 if the page was freed, 0 if the file system can not punch
+ *            holes, ERR_DB_FILE on other errors
+ */
+static int punch_page(int fd, off_t page)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  page * PUNCH_PAGE, PUNCH_PAGE) == 0)
+        return 1;
+    if (errno == EOPNOTSUPP || errno == ENOSYS)
+        return 0;
+    return ERR_DB_FILE;
+#else
+    (void)fd;
+    (void)page;
+    return 0;
+#endif
+}
+
+/*
+ *  bits_answer_pages
+ *      fd:  linux file descriptor
+ *
+ *  returns:  true if page_in_use() can be answered from the bitmap
+ */
+static bool bits_answer_pages(int fd)
+{
+    return have_header(fd) && db_hdr.layout == DB_LAYOUT_FLAT;
+}
+
+/*
+ *  punch_if_empty
+ *      fd:   linux file descriptor
+ *      id:   the student that was just deleted
+ *      pos:  file offset of its record
+ *
+ *  Frees the page holding pos if no live student is left in it.  The page
+ *  (of ids, which is the page itself unless the file is packed) is locked
+ *  meanwhile so no other process can add a student to it, see Locking.  A
+ *  packed file already has slot 0 locked, which keeps out every writer.
+ *  If another process is busy in the page it is not freed.
+ *
+ *  returns:  1 if the page was freed, 0 if not, ERR_DB_FILE on errors
+ */
+static int punch_if_empty(int fd, int id, off_t pos)
+{
+    student_t recs[PUNCH_PAGE_RECS];
+    off_t page = pos / PUNCH_PAGE;
+    off_t ids = (off_t)(id - id % PUNCH_PAGE_RECS) * STUDENT_RECORD_SIZE;
+    bool lock = !have_index(fd);
+    ssize_t got;
+    int rc;
+
+    // waiting here could deadlock with a delete of a neighbour, which holds
+    // its slot and wants the page too, so a busy page is left for -X
+    if (lock && (rc = try_lock(fd, F_WRLCK, ids, PUNCH_PAGE)) <= 0)
+        return rc;
+
+    if (bits_answer_pages(fd))
+    {
+        refresh_bits(page * PUNCH_PAGE_RECS, PUNCH_PAGE_RECS);
+        rc = page_in_use(page, NULL, 0) ? 0 : punch_page(fd, page);
+    }
+    else if ((got = pread(fd, recs, PUNCH_PAGE, page * PUNCH_PAGE)) < 0)
+    {
+        rc = ERR_DB_FILE;
+    }
+    else
+    {
+        rc = page_in_use(page, recs, got / STUDENT_RECORD_SIZE) ? 0 : punch_page(fd, page);
+    }
+
+    if (lock)
+        set_lock(fd, F_UNLCK, ids, PUNCH_PAGE);
+    return rc;
+}
+
+/*
+ *  reclaim_pages
+ *      fd:  linux file descriptor
+ *
+ *  Frees every empty page of the database that still has storage, see Hole
+ *  punching above.  Only the extents SEEK_DATA reports are looked at, so
+ *  the pages already freed (which includes every page that never held a
+ *  student) cost nothing, and flat files are checked against the bitmap
+ *  without reading any records.
+ *
+ *  returns:  <number>       number of pages freed
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_RECLAIMED  on success
+ *            M_ERR_DB_READ   error reading or seeking the database file
+ *            M_ERR_DB_WRITE  error freeing a page
+ */
+static int reclaim_pages(int fd)
+{
+    student_t *buf = NULL;
+    uint32_t *dirs = NULL;
+    int ndirs = 0;
+    struct stat st;
+    off_t data = 0, hole;
+    int freed = 0;
+    int rc;
+
+    if (fstat(fd, &st) == -1)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // the directory pages of a paged file read as empty records too
+    if ((!bits_answer_pages(fd) && (buf = malloc(RECLAIM_CHUNK)) == NULL) ||
+        (is_paged(fd) && (dirs = paged_dir_pages(fd, &ndirs)) == NULL))
+    {
+        free(buf);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    while (data < st.st_size)
+    {
+        off_t pos = data;
+
+        hole = st.st_size;
+#ifdef SEEK_DATA
+        data = seek_db(fd, pos, SEEK_DATA);
+        if (data == -1)
+        {
+            // ENXIO means only holes are left, anything else means the
+            // filesystem can't tell us so the rest is treated as data
+            if (errno == ENXIO)
+                break;
+            data = pos;
+        }
+        else if ((hole = seek_db(fd, data, SEEK_HOLE)) == -1 || hole > st.st_size)
+        {
+            hole = st.st_size;
+        }
+#endif
+        data -= data % PUNCH_PAGE;
+
+        while (data < hole)
+        {
+            off_t len = hole - data < RECLAIM_CHUNK ? hole - data : RECLAIM_CHUNK;
+            int nrecs = (int)(len / STUDENT_RECORD_SIZE);
+            ssize_t got;
+
+            if (buf != NULL)
+            {
+                got = pread(fd, buf, len, data);
+                if (got < 0)
+                {
+                    free(buf);
+                    free(dirs);
+                    printf(M_ERR_DB_READ);
+                    return ERR_DB_FILE;
+                }
+                nrecs = (int)(got / STUDENT_RECORD_SIZE);
+            }
+
+            for (int i = 0; i < nrecs; i += PUNCH_PAGE_RECS)
+            {
+                off_t page = data / PUNCH_PAGE + i / PUNCH_PAGE_RECS;
+                int n = nrecs - i < PUNCH_PAGE_RECS ? nrecs - i : PUNCH_PAGE_RECS;
+
+                uint32_t key = (uint32_t)page;
+
+                if (dirs != NULL && (page <= DB_ROOT_PAGES ||
+                    bsearch(&key, dirs, ndirs, sizeof(key), page_cmp) != NULL))
+                    continue;
+                if (page_in_use(page, buf != NULL ? &buf[i] : NULL, n))
+                    continue;
+                if ((rc = punch_page(fd, page)) < 0)
+                {
+                    free(buf);
+                    free(dirs);
+                    printf(M_ERR_DB_WRITE);
+                    return ERR_DB_FILE;
+                }
+                freed += rc;
+            }
+            data += len;
+        }
+    }
+
+    free(buf);
+    free(dirs);
+    printf(M_DB_RECLAIMED, freed);
+    return freed;
+}
+
+/*
+ *  reclaim_db
+ *      fd:  linux file descriptor
+ *
+ *  Runs reclaim_pages() with the whole file locked, see Locking.
+ *
+ *  returns:  see reclaim_pages()
+ *
+ *  console:  see reclaim_pages()
+ */
+int reclaim_db(int fd)
+{
+    int rc;
+
+    if (lock_file(fd, F_WRLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = reclaim_pages(fd);
+    unlock_file(fd, F_WRLCK);
+    return rc;
+}
+
+/*
+ *  remove_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ *
+ *  Removes a student to the database.  Use the locate_student() function to
+ *  locate the student to be deleted. If there is a student at that location
+ *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
+ *  that location.
+ *
+ *  If that leaves its whole page empty the page is freed, see Hole punching.
+ *  The caller holds the locks, see delete_student().
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student not in database
+ *
+ *  console:  This function does not produce any output
+ */
+static int remove_student(int fd, int id)
+{
+    student_t student;
+    student_t *map;
+    off_t pos;
+    ssize_t bytesWritten;
+    int result = locate_student(fd,id,&student,&pos);
+
+    if (result != NO_ERROR)
+        return result;
+
+    if(log_student(fd, 'd', &student) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    map = map_db(fd, 0);
+    if(map != NULL && pos + STUDENT_RECORD_SIZE <= (off_t)db_map_len){
+        student_t *rec = &map[pos / STUDENT_RECORD_SIZE];
+        *rec = EMPTY_STUDENT_RECORD;
+        if((!wal_enabled && sync_record(rec) != NO_ERROR) ||
+           note_student(fd, &student, pos, false) != NO_ERROR)
+            return ERR_DB_FILE;
+        punch_if_empty(fd, id, pos);
+        return NO_ERROR;
+    }
+
+    // write the empty record back where locate_student() found it, for a
+    // compressed file that is not id * STUDENT_RECORD_SIZE
+    bytesWritten = pwrite(fd,&EMPTY_STUDENT_RECORD,STUDENT_RECORD_SIZE,pos);
+    if(bytesWritten != STUDENT_RECORD_SIZE || note_student(fd, &student, pos, false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // the delete is done either way, a page that can not be freed now is
+    // left for -X
+    punch_if_empty(fd, id, pos);
+    return NO_ERROR;
+    //return NOT_IMPLEMENTED_YET;
+}
+
+/*
+ *  delete_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ *
+ *  Deletes the student with remove_student() while holding the lock of
+ *  its slot, and for a packed file slot 0, see Locking.
+ *
+ *  returns:  see remove_student()
+ *
+ *  console:  This function does not produce any output
+ */
+static int delete_student(int fd, int id)
+{
+    bool packed;
+    int rc;
+
+    if(lock_slot(fd, id) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    packed = have_index(fd);
+    if(packed && lock_meta(fd) != NO_ERROR){
+        unlock_slot(fd, id);
+        return ERR_DB_FILE;
+    }
+
+    rc = remove_student(fd, id);
+    if(rc == NO_ERROR){
+        count_records_touched(1);
+    }
+
+    if(packed){
+        unlock_meta(fd);
+    }
+    unlock_slot(fd, id);
+    return rc;
+}
+
+/*
+ *  del_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ *
+ *  Deletes the student with delete_student().
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue, or the student is not
+ *                           in the database
+ *
+ *  console:  M_STD_DEL_MSG      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
+ *            M_ERR_DB_WRITE     error reading or writing the database file
+ */
+int del_student(int fd, int id)
+{
+    int rc = delete_student(fd, id);
+
+    if(rc == NO_ERROR){
+        printf(M_STD_DEL_MSG,id);
+    } else if(rc == SRCH_NOT_FOUND){
+        printf(M_STD_NOT_FND_MSG,id);
+        rc = ERR_DB_FILE;
+    } else {
+        printf(M_ERR_DB_WRITE);
+    }
+    return rc;
+}
+
+/*
+ *  count_records
+ *      fd:     linux file descriptor
+ *
+ *  Counts the number of records in the database.  Start by reading the
+ *  database at the beginning, and continue reading individual records
+ *  until you it EOF.  EOF is when the read() syscall returns 0. Check
+ *  if a slot is empty or previously deleted by investigating if all of
+ *  the bytes in the record read are zeros - I would suggest using memory
+ *  compare memcmp() for this. Create a counter variable and initialize it
+ *  to zero, every time a non-zero record is read increment the counter.
+ *
+ *  Databases with a header (see load_header()) already keep the count, so
+ *  they are not read at all.  Otherwise only the parts of the file that hold
+ *  data are read, see scan_next(), on several threads with -j.
+ *
+ *  returns:  <number>       returns the number of records in db on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  This function does not produce any output
+ */
+static int count_records(int fd)
+{
+    int record_count = 0;
+    pscan_t *parts;
+    scan_t sc;
+    int rc;
+
+    if(have_header(fd)){
+        record_count = db_hdr.record_count;
+    } else if(scan_threads > 1){
+        if((rc = parallel_scan(fd, PSCAN_COUNT, &parts)) < 0)
+            return ERR_DB_FILE;
+        for(int i = 0; i < rc; i++){
+            record_count += parts[i].count;
+        }
+        pscan_free(parts, rc);
+    } else {
+        if(scan_begin(&sc, fd) != NO_ERROR)
+            return ERR_DB_FILE;
+
+        // only the live mask of each block is needed, not the records
+        while((rc = scan_block(&sc)) > 0){
+            record_count += sc.live;
+        }
+        scan_end(&sc);
+
+        if (rc < 0)
+            return ERR_DB_FILE;
+    }
+
+    return record_count;
+}
+
+/*
+ *  count_locked
+ *      fd:     linux file descriptor
+ *
+ *  Counts the records with count_records() while holding a shared lock on
+ *  the whole file, so adds and deletes in progress are waited for.
+ *
+ *  returns:  see count_records()
+ *
+ *  console:  This function does not produce any output
+ */
+static int count_locked(int fd)
+{
+    int rc;
+
+    if(lock_file(fd, F_RDLCK) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = count_records(fd);
+    unlock_file(fd, F_RDLCK);
+    return rc;
+}
+
+/*
+ *  count_db_records
+ *      fd:     linux file descriptor
+ *
+ *  Counts the records with count_locked().
+ *
+ *  returns:  see count_records()
+ *
+ *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
+ *            M_DB_EMPTY       on success if the record count in db is zero
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ */
+int count_db_records(int fd)
+{
+    int rc = count_locked(fd);
+
+    if(rc < 0){
+        printf(M_ERR_DB_READ);
+    } else if(rc == 0){
+        printf(M_DB_EMPTY);
+    } else {
+        printf(M_DB_RECORD_CNT, rc);
+    }
+    return rc;
+}
+
+/*
+ *  print_records
+ *      fd:     linux file descriptor
+ *
+ *  Prints all records in the database.  Start by reading the
+ *  database at the beginning, and continue reading individual records
+ *  until you it EOF.  EOF is when the read() syscall returns 0. Check
+ *  if a slot is empty or previously deleted by investigating if all of
+ *  the bytes in the record read are zeros - I would suggest using memory
+ *  compare memcmp() for this. Be careful as the database might be empty.
+ *  on the first real row encountered print the header for the required output:
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *                  "FIRST_NAME", "LAST_NAME", "GPA");
+ *
+ *  then for each valid record encountered print the required output:
+ *
+ *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
+ *                    student.lname, calculated_gpa_from_student);
+ *
+ *  The code above assumes you are reading student records into a local
+ *  variable named student that is of type student_t. Also dont forget that
+ *  the GPA in the student structure is an int, to convert it into a real
+ *  gpa divide by 100.0 and store in a float variable.
+ *
+ *  The records are read in large blocks and only the parts of the file that
+ *  hold students are read at all, see scan_next().  With -j the lines are
+ *  formatted by several threads, see parallel_scan().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *
+ */
+static int print_records(int fd)
+{
+    student_t student;
+    int header = 0;
+    float newGPA;
+    pscan_t *parts;
+    scan_t sc;
+    off_t pos;
+    int rc;
+
+    if(scan_threads > 1){
+        if((rc = parallel_scan(fd, PSCAN_PRINT, &parts)) < 0){
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        for(int i = 0; i < rc; i++){
+            if(parts[i].count > 0 && !header){
+                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+                header = 1;
+            }
+            fwrite(parts[i].text, 1, parts[i].text_len, stdout);
+        }
+        pscan_free(parts, rc);
+
+        if (!header) {
+            printf(M_DB_EMPTY);
+        }
+        return NO_ERROR;
+    }
+
+    if(scan_begin(&sc, fd) != NO_ERROR){
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    while((rc = scan_next(&sc, &student, &pos)) > 0){
+        if(!header){
+           printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+           header = 1;
+        }
+        newGPA = student.gpa/100.0;
+        printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, newGPA);
+    }
+    scan_end(&sc);
+
+    if(rc < 0){
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (!header) {
+        printf(M_DB_EMPTY);
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  print_db
+ *      fd:     linux file descriptor
+ *
+ *  Prints the records with print_records() while holding a shared lock on
+ *  the whole file, see Locking.
+ *
+ *  returns:  see print_records()
+ *
+ *  console:  see print_records()
+ */
+int print_db(int fd)
+{
+    int rc;
+
+    if(lock_file(fd, F_RDLCK) != NO_ERROR){
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = print_records(fd);
+    unlock_file(fd, F_RDLCK);
+    return rc;
+}
+
+static int id_cmp(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  name_candidates
+ *      key:   student whose lname is looked up
+ *      *ids:  set to the ids in the probe sequence of its hash, sorted,
+ *             free() them
+ *
+ *  returns:  the number of ids, ERR_DB_FILE on failure
+ */
+static int name_candidates(const student_t *key, int **ids)
+{
+    db_name_entry_t run[IDX_PROBE_RUN];
+    uint32_t h = name_hash(key);
+    uint32_t b = idx_home((int)h, db_names.nbuckets);
+    int *found = NULL;
+    int n = 0, cap = 0;
+
+    for (;;)
+    {
+        uint32_t nrun = db_names.nbuckets - b < IDX_PROBE_RUN ? db_names.nbuckets - b : IDX_PROBE_RUN;
+        ssize_t len = (ssize_t)nrun * sizeof(db_name_entry_t);
+        bool done = false;
+
+        if (pread(db_names_fd, run, len, idx_offset(b)) != len)
+        {
+            free(found);
+            return ERR_DB_FILE;
+        }
+
+        for (uint32_t i = 0; i < nrun && !done; i++)
+        {
+            if (run[i].hash == 0)
+                done = true;
+            else if (run[i].hash != h || run[i].id == 0)
+                continue;
+            else
+            {
+                if (n == cap)
+                {
+                    int *grown;
+
+                    cap = cap == 0 ? 16 : cap * 2;
+                    grown = realloc(found, cap * sizeof(int));
+                    if (grown == NULL)
+                    {
+                        free(found);
+                        return ERR_DB_FILE;
+                    }
+                    found = grown;
+                }
+                found[n++] = run[i].id;
+            }
+        }
+        if (done)
+            break;
+        b = (b + nrun) & (db_names.nbuckets - 1);
+    }
+
+    qsort(found, n, sizeof(int), id_cmp);
+    *ids = found;
+    return n;
+}
+
+/*
+ *  print_by_name
+ *      fd:   linux file descriptor
+ *      key:  lname to look up, and fname unless it is empty
+ *
+ *  Prints the students with that name using the name index, building it
+ *  first if it is not in use, see Name index.  The caller holds the whole
+ *  file locked, see find_by_name().
+ *
+ *  returns:  <number>        number of students printed
+ *            SRCH_NOT_FOUND  no student has that name
+ *            ERR_DB_FILE     database file I/O issue
+ */
+static int print_by_name(int fd, const student_t *key)
+{
+    student_t student;
+    off_t pos;
+    int *ids = NULL;
+    int printed = 0;
+    int n;
+
+    if (!have_header(fd))
+        return SRCH_NOT_FOUND;
+
+    if (open_names(false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // several -n may find the index missing, only the first one builds it
+    if (db_names.nbuckets == 0)
+    {
+        int rc = ERR_DB_FILE;
+
+        if (open_names(true) == NO_ERROR &&
+            set_lock(db_names_fd, F_WRLCK, 0, 0) == NO_ERROR)
+        {
+            rc = open_names(false);
+            if (rc == NO_ERROR && db_names.nbuckets == 0)
+                rc = build_names(fd);
+            set_lock(db_names_fd, F_UNLCK, 0, 0);
+        }
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    n = name_candidates(key, &ids);
+    if (n < 0)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++)
+    {
+        int rc = locate_student(fd, ids[i], &student, &pos);
+
+        if (rc == ERR_DB_FILE)
+        {
+            free(ids);
+            return ERR_DB_FILE;
+        }
+        if (rc != NO_ERROR ||
+            strncmp(student.lname, key->lname, sizeof(key->lname)) != 0 ||
+            (key->fname[0] != '\0' &&
+             strncmp(student.fname, key->fname, sizeof(key->fname)) != 0))
+            continue;
+
+        if (printed++ == 0)
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname,
+               student.gpa / 100.0);
+    }
+    free(ids);
+
+    return printed > 0 ? printed : SRCH_NOT_FOUND;
+}
+
+/*
+ *  find_by_name
+ *      fd:     linux file descriptor
+ *      lname:  last name of the students to find
+ *      fname:  first name, or NULL or "" to match any
+ *
+ *  Prints every student with that name, in id order, with print_by_name()
+ *  while holding a shared lock on the whole file, see Locking.  Names are
+ *  matched exactly, after being cut to the length add_student() stores.
+ *
+ *  returns:  <number>        number of students printed
+ *            SRCH_NOT_FOUND  no student has that name
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  the students, in the print_student() format
+ *            M_STD_NAME_NOT_FND  no student has that name
+ *            M_ERR_DB_READ       error reading the database file
+ */
+int find_by_name(int fd, char *lname, char *fname)
+{
+    student_t key = {0};
+    int rc;
+
+    strncpy(key.lname, lname, sizeof(key.lname) - 1);
+    if (fname != NULL)
+        strncpy(key.fname, fname, sizeof(key.fname) - 1);
+
+    if (lock_file(fd, F_RDLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = print_by_name(fd, &key);
+    unlock_file(fd, F_RDLCK);
+
+    if (rc == SRCH_NOT_FOUND)
+    {
+        if (key.fname[0] != '\0')
+            printf(M_STD_NAME_NOT_FND, key.fname, " ", key.lname);
+        else
+            printf(M_STD_NAME_NOT_FND, "", "", key.lname);
+    }
+    else if (rc == ERR_DB_FILE)
+    {
+        printf(M_ERR_DB_READ);
+    }
+    return rc;
+}
+
+/*
+ *  get_students
+ *      fd:   linux file descriptor
+ *      ids:  the students to look up
+ *      n:    number of ids
+ *      out:  set to the students, an id of DELETED_STUDENT_ID for the ones
+ *            that were not found
+ *
+ *  Looks up every student like get_student() does, but finds all the slots
+ *  first and reads them with one uring_rw(), see Asynchronous I/O.  A slot
+ *  that does not hold the student after all is looked up again with
+ *  lookup_student(), and so is every student when the mapped backend or
+ *  the page cache already has the records in memory.
+ *
+ *  returns:  the number of students found, ERR_DB_FILE on failure
+ */
+static int get_students(int fd, const int *ids, int n, student_t *out)
+{
+    uring_io_t *ios = malloc((size_t)n * sizeof(*ios));
+    struct iovec *iov = malloc((size_t)n * sizeof(*iov));
+    int *which = malloc((size_t)n * sizeof(int));     // the id each read is for
+    bool direct;
+    int nios = 0, found = 0;
+    int rc = NO_ERROR;
+    off_t pos;
+
+    if (ios == NULL || iov == NULL || which == NULL || follow_db(fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    direct = have_header(fd) && map_db(fd, 0) == NULL && !cache_valid(fd);
+
+    for (int i = 0; i < n && rc == NO_ERROR; i++)
+    {
+        out[i] = EMPTY_STUDENT_RECORD;
+        rc = direct ? student_slot(fd, ids[i], &pos) : lookup_student(fd, ids[i], &out[i], &pos);
+
+        if (rc == NO_ERROR && direct)
+        {
+            iov[nios].iov_base = &out[i];
+            iov[nios].iov_len = STUDENT_RECORD_SIZE;
+            ios[nios].iov = &iov[nios];
+            ios[nios].iovcnt = 1;
+            ios[nios].off = pos;
+            which[nios++] = i;
+        }
+        else if (rc == NO_ERROR)
+        {
+            found++;
+        }
+        if (rc == SRCH_NOT_FOUND)
+            rc = NO_ERROR;
+    }
+
+    if (rc == NO_ERROR && nios > 0)
+    {
+        count_records_touched(nios);
+        rc = uring_rw(fd, ios, nios, false);
+    }
+
+    for (int k = 0; k < nios && rc == NO_ERROR; k++)
+    {
+        int i = which[k];
+
+        if (ios[k].res == STUDENT_RECORD_SIZE && out[i].id == ids[i])
+        {
+            found++;
+            continue;
+        }
+
+        rc = lookup_student(fd, ids[i], &out[i], &pos);
+        if (rc == NO_ERROR)
+            found++;
+        else
+            out[i] = EMPTY_STUDENT_RECORD;
+        if (rc == SRCH_NOT_FOUND)
+            rc = NO_ERROR;
+    }
+
+    free(ios);
+    free(iov);
+    free(which);
+    return rc == NO_ERROR ? found : ERR_DB_FILE;
+}
+
+/*
+ *  find_students
+ *      fd:   linux file descriptor
+ *      ids:  the students to look up
+ *      n:    number of ids, at least 1
+ *
+ *  Looks up all the students at once with get_students() and prints the
+ *  ones found, in the order of ids, followed by a message for each one
+ *  that was not.
+ *
+ *  returns:  NO_ERROR        every student was found
+ *            SRCH_NOT_FOUND  some were not
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  the students, in the print_student() format
+ *            M_STD_NOT_FND_MSG  for every student that was not found
+ *            M_ERR_DB_READ      error reading the database file
+ */
+int find_students(int fd, int *ids, int n)
+{
+    student_t *students = malloc((size_t)n * sizeof(student_t));
+    int found = students == NULL ? ERR_DB_FILE : get_students(fd, ids, n, students);
+
+    if (found < 0)
+    {
+        free(students);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0, printed = 0; i < n; i++)
+    {
+        if (students[i].id == DELETED_STUDENT_ID)
+            continue;
+        if (printed++ == 0)
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        printf(STUDENT_PRINT_FMT_STRING, students[i].id, students[i].fname,
+               students[i].lname, students[i].gpa / 100.0);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (students[i].id == DELETED_STUDENT_ID)
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+    }
+    free(students);
+    return found == n ? NO_ERROR : SRCH_NOT_FOUND;
+}
+
+/*
+ *  print_by_gpa
+ *      fd:     linux file descriptor
+ *      lo:     lowest gpa to print
+ *      hi:     highest gpa to print
+ *      desc:   true to go from hi down to lo, false from lo up to hi
+ *      limit:  most students to print
+ *
+ *  Prints the students with a gpa from lo to hi using the gpa index,
+ *  building it first if it is not in use, see GPA index.  Students with the
+ *  same gpa are printed in id order.  The caller holds the whole file
+ *  locked, see find_gpa_range().
+ *
+ *  returns:  number of students printed, ERR_DB_FILE on failure
+ */
+static int print_by_gpa(int fd, int lo, int hi, bool desc, int limit)
+{
+    db_gpa_list_t lists[MAX_STD_GPA + 1];
+    db_gpa_block_t blk;
+    student_t student;
+    off_t pos;
+    int *ids = NULL;
+    int cap = 0;
+    int printed = 0;
+    int rc = NO_ERROR;
+
+    if (!have_header(fd))
+        return 0;
+
+    if (open_gpa(false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // several queries may find the index missing, only the first one
+    // builds it
+    if (db_gpa.nblocks == 0)
+    {
+        rc = ERR_DB_FILE;
+        if (open_gpa(true) == NO_ERROR &&
+            set_lock(db_gpa_fd, F_WRLCK, 0, 0) == NO_ERROR)
+        {
+            rc = open_gpa(false);
+            if (rc == NO_ERROR && db_gpa.nblocks == 0)
+                rc = build_gpa(fd);
+            set_lock(db_gpa_fd, F_UNLCK, 0, 0);
+        }
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    if (pread(db_gpa_fd, lists, sizeof(lists), gpa_list_offset(0)) != sizeof(lists))
+        return ERR_DB_FILE;
+
+    for (int k = 0; k <= hi - lo && printed < limit && rc == NO_ERROR; k++)
+    {
+        int g = desc ? hi - k : lo + k;
+        int n = 0;
+
+        if (lists[g].count <= 0)
+            continue;
+        if (lists[g].count > cap)
+        {
+            int *grown = realloc(ids, lists[g].count * sizeof(int));
+
+            if (grown == NULL)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            ids = grown;
+            cap = lists[g].count;
+        }
+
+        for (int b = lists[g].head; b != 0 && n < lists[g].count; b = blk.next)
+        {
+            if (read_gpa_block(b, &blk) != NO_ERROR)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            for (int i = 0; i < blk.n && n < lists[g].count; i++)
+                ids[n++] = blk.ids[i];
+        }
+        qsort(ids, n, sizeof(int), id_cmp);
+
+        for (int i = 0; i < n && printed < limit && rc == NO_ERROR; i++)
+        {
+            int found = locate_student(fd, ids[i], &student, &pos);
+
+            if (found == ERR_DB_FILE)
+                rc = ERR_DB_FILE;
+            if (found != NO_ERROR || student.gpa != g)
+                continue;
+
+            if (printed++ == 0)
+                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname,
+                   student.gpa / 100.0);
+        }
+    }
+
+    free(ids);
+    return rc == NO_ERROR ? printed : ERR_DB_FILE;
+}
+
+/*
+ *  find_gpa_range
+ *      fd:   linux file descriptor
+ *      min:  lowest gpa, as a 3 digit int
+ *      max:  highest gpa
+ *
+ *  Prints every student with a gpa from min to max, lowest gpa first, with
+ *  print_by_gpa() while holding a shared lock on the whole file, see
+ *  Locking.
+ *
+ *  returns:  <number>        number of students printed
+ *            SRCH_NOT_FOUND  no student has a gpa in the range
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  the students, in the print_student() format
+ *            M_GPA_NOT_FND   no student has a gpa in the range
+ *            M_ERR_DB_READ   error reading the database file
+ */
+int find_gpa_range(int fd, int min, int max)
+{
+    int rc;
+
+    if (lock_file(fd, F_RDLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = print_by_gpa(fd, min, max, false, DB_PAGED_MAX_ID);
+    unlock_file(fd, F_RDLCK);
+
+    if (rc == 0)
+    {
+        printf(M_GPA_NOT_FND, min / 100.0, max / 100.0);
+        return SRCH_NOT_FOUND;
+    }
+    if (rc < 0)
+        printf(M_ERR_DB_READ);
+    return rc;
+}
+
+/*
+ *  find_top_gpa
+ *      fd:  linux file descriptor
+ *      k:   number of students to print
+ *
+ *  Prints the k students with the highest gpa, highest first and ties in
+ *  id order, like find_gpa_range().
+ *
+ *  returns:  number of students printed, ERR_DB_FILE on failure
+ *
+ *  console:  the students, in the print_student() format
+ *            M_DB_EMPTY      the database has no students
+ *            M_ERR_DB_READ   error reading the database file
+ */
+int find_top_gpa(int fd, int k)
+{
+    int rc;
+
+    if (lock_file(fd, F_RDLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = print_by_gpa(fd, MIN_STD_GPA, MAX_STD_GPA, true, k);
+    unlock_file(fd, F_RDLCK);
+
+    if (rc == 0)
+        printf(M_DB_EMPTY);
+    else if (rc < 0)
+        printf(M_ERR_DB_READ);
+    return rc;
+}
+
+/*
+ *  print_stats
+ *      fd:  linux file descriptor
+ *
+ *  Sums up the students from the columns, building them first if they are
+ *  not in use, see Column sidecar.  The caller holds the whole file
+ *  locked, see stats_db().
+ *
+ *  returns:  number of students, ERR_DB_FILE on failure
+ */
+static int print_stats(int fd)
+{
+    static cols_stats_fn cols_stats = NULL;
+    cols_stats_t st = { .min = MAX_STD_GPA, .max = MIN_STD_GPA };
+    size_t seg_bytes = 2 * DB_COLS_SEG_SLOTS * sizeof(int);
+    int *buf;
+    struct stat sb;
+    off_t nsegs;
+    int rc = NO_ERROR;
+
+    if (!have_header(fd))
+        return 0;
+
+    if (open_cols(false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // several -s may find the columns missing, only the first one builds
+    // them
+    if (!have_cols())
+    {
+        rc = ERR_DB_FILE;
+        if (open_cols(true) == NO_ERROR &&
+            set_lock(db_cols_fd, F_WRLCK, 0, 0) == NO_ERROR)
+        {
+            rc = open_cols(false);
+            if (rc == NO_ERROR && !have_cols())
+                rc = build_cols(fd);
+            set_lock(db_cols_fd, F_UNLCK, 0, 0);
+        }
+        if (rc != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    if (cols_stats == NULL)
+        cols_stats = pick_cols_stats();
+
+    if (fstat(db_cols_fd, &sb) == -1)
+        return ERR_DB_FILE;
+    nsegs = sb.st_size > DB_COLS_SEGS ?
+            (sb.st_size - DB_COLS_SEGS + seg_bytes - 1) / seg_bytes : 0;
+
+    buf = malloc(COLS_READ_SEGS * seg_bytes);
+    if (buf == NULL)
+        return ERR_DB_FILE;
+
+    for (off_t seg = 0; seg < nsegs && rc == NO_ERROR; seg += COLS_READ_SEGS)
+    {
+        size_t want = (nsegs - seg < COLS_READ_SEGS ? nsegs - seg : COLS_READ_SEGS) * seg_bytes;
+        ssize_t got = pread(db_cols_fd, buf, want, cols_seg_offset(seg));
+
+        if (got < 0)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        // the last segment may end early, the rest of it is empty
+        memset((char *)buf + got, 0, want - got);
+        for (size_t k = 0; k < want / seg_bytes; k++)
+        {
+            int *ids = &buf[k * 2 * DB_COLS_SEG_SLOTS];
+
+            cols_stats(ids, ids + DB_COLS_SEG_SLOTS, DB_COLS_SEG_SLOTS, &st);
+        }
+    }
+    free(buf);
+
+    if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+    if (st.count == 0)
+        return 0;
+
+    st.ge[0] = st.count;
+    printf(M_DB_STATS, (int)st.count, (double)st.sum / st.count / 100.0,
+           st.min / 100.0, st.max / 100.0);
+    for (int b = 0; b < STATS_BUCKETS; b++)
+    {
+        uint64_t n = st.ge[b] - (b + 1 < STATS_BUCKETS ? st.ge[b + 1] : 0);
+
+        printf(M_DB_STATS_HIST, 50 * b / 100.0,
+               (b + 1 < STATS_BUCKETS ? 50 * b + 49 : MAX_STD_GPA) / 100.0, (int)n);
+    }
+    return (int)st.count;
+}
+
+/*
+ *  stats_db
+ *      fd:  linux file descriptor
+ *
+ *  Prints the number of students, their average, lowest and highest gpa
+ *  and how many have a gpa in each histogram bucket, with print_stats()
+ *  while holding a shared lock on the whole file, see Locking.
+ *
+ *  returns:  number of students, ERR_DB_FILE on failure
+ *
+ *  console:  M_DB_STATS and a M_DB_STATS_HIST line per bucket
+ *            M_DB_EMPTY      the database has no students
+ *            M_ERR_DB_READ   error reading the database file
+ */
+int stats_db(int fd)
+{
+    int rc;
+
+    if (lock_file(fd, F_RDLCK) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = print_stats(fd);
+    unlock_file(fd, F_RDLCK);
+
+    if (rc == 0)
+        printf(M_DB_EMPTY);
+    else if (rc < 0)
+        printf(M_ERR_DB_READ);
+    return rc;
+}
+
+/*
+ *  print_student
+ *      *s:   a pointer to a student_t structure that should
+ *            contain a valid student to be printed
  *
  *  Start by ensuring that provided student pointer is valid.  To do this
  *  make sure it is not NULL and that s->id is not zero.  After ensuring
@@ -381,10 +7604,399 @@ void print_student(student_t *s)
         return;
     }
 
-    newGPA = s->gpa/100.0;
-    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME","LAST_NAME","GPA");
-    printf(STUDENT_PRINT_FMT_STRING,s->id,s->fname,s->lname,newGPA);
-
+    newGPA = s->gpa/100.0;
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME","LAST_NAME","GPA");
+    printf(STUDENT_PRINT_FMT_STRING,s->id,s->fname,s->lname,newGPA);
+
+}
+
+/*
+ *  Replacing the database file
+ *
+ *  compress_db() and rewrite_paged() write the new database to a file of
+ *  its own and switch over to it only once it is complete:
+ *   1. the new file is an anonymous O_TMPFILE in the directory of DB_FILE,
+ *      so a crash while it is written leaves nothing behind.  File systems
+ *      without O_TMPFILE get TMP_DB_FILE instead
+ *   2. once written it is made durable with fdatasync(), linked in as
+ *      TMP_DB_FILE and renamed over DB_FILE, which replaces the old file
+ *      atomically (link() can not replace a file)
+ *   3. the directory is synced, so the rename itself survives a crash
+ *  After a crash DB_FILE is therefore either the old file or the whole new
+ *  one.  A TMP_DB_FILE left by a crash between the link and the rename is
+ *  removed by the next replacement.  Sidecar files written for the new
+ *  file carry its generation, next to the old file they are stale and get
+ *  rebuilt.
+ */
+static bool replacement_named = false;  // the new file is TMP_DB_FILE
+
+/*
+ *  open_replacement
+ *
+ *  Creates the file the new database is written to, see Replacing the
+ *  database file.
+ *
+ *  returns:  its file descriptor, -1 on failure
+ */
+static int open_replacement(void)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    int temp;
+
+    replacement_named = false;
+#ifdef O_TMPFILE
+    temp = open(".", O_TMPFILE | O_RDWR, mode);
+    if (temp != -1)
+        return temp;
+#endif
+
+    replacement_named = true;
+    return open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC, mode);
+}
+
+// closes a new file that is not going to be used
+static void discard_replacement(int temp)
+{
+    close(temp);
+    if (replacement_named)
+        unlink(TMP_DB_FILE);
+}
+
+/*
+ *  publish_replacement
+ *      fd:    linux file descriptor of the old database
+ *      temp:  file descriptor from open_replacement(), closed either way
+ *
+ *  Syncs the new file and moves it in place of DB_FILE, see Replacing the
+ *  database file.  The change count in the header of the old file is then
+ *  moved, which tells processes caching its pages to look for the new
+ *  file, see Page cache.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_FILE on failure.  DB_FILE is
+ *            still the old file if it fails before the rename
+ */
+static int publish_replacement(int fd, int temp)
+{
+    db_header_t old;
+    char path[32];
+    int dir;
+    int rc = NO_ERROR;
+
+    if (fdatasync(temp) == -1)
+        rc = ERR_DB_FILE;
+
+    // an anonymous file gets a name through its /proc link
+    if (rc == NO_ERROR && !replacement_named)
+    {
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", temp);
+        unlink(TMP_DB_FILE);
+        if (linkat(AT_FDCWD, path, AT_FDCWD, TMP_DB_FILE, AT_SYMLINK_FOLLOW) == -1)
+            rc = ERR_DB_FILE;
+    }
+    close(temp);
+
+    if (rc == NO_ERROR && rename(TMP_DB_FILE, DB_FILE) == -1)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+    {
+        unlink(TMP_DB_FILE);
+        return rc;
+    }
+
+    if (pread(fd, &old, sizeof(old), 0) == sizeof(old) &&
+        memcmp(old.magic, DB_HDR_MAGIC, sizeof(old.magic)) == 0)
+    {
+        old.changes++;
+        pwrite(fd, &old, sizeof(old), 0);
+    }
+
+    dir = open(".", O_RDONLY | O_DIRECTORY);
+    if (dir == -1 || fsync(dir) == -1)
+        rc = ERR_DB_FILE;
+    if (dir != -1)
+        close(dir);
+    return rc;
+}
+
+/*
+ *  copy_live
+ *      fd:    linux file descriptor of the database
+ *      temp:  file the live records are appended to
+ *      bits:  occupancy bitmap, the bit of every copied student is set
+ *      slots: slots[id] is set to the slot of every copied student in temp,
+ *             counting from slot 1
+ *
+ *  Appends every live record of the database to temp, in file order.  The
+ *  live records of each scanned block are written with a single write(), or
+ *  with -j those of each thread's range, see parallel_scan().
+ *
+ *  returns:  <number>       number of records copied
+ *            ERR_DB_FILE    error reading the database
+ *            ERR_DB_OP      error writing to temp
+ */
+static int copy_live(int fd, int temp, unsigned char *bits, int *slots)
+{
+    int record_count = 0;
+    student_t *out;
+    pscan_t *parts;
+    scan_t sc;
+    int rc;
+
+    if(scan_threads > 1){
+        if((rc = parallel_scan(fd, PSCAN_COPY, &parts)) < 0){
+            return ERR_DB_FILE;
+        }
+        for(int i = 0; i < rc; i++){
+            size_t len = (size_t)parts[i].count * STUDENT_RECORD_SIZE;
+
+            if(len > 0 && write(temp, parts[i].recs, len) != (ssize_t)len){
+                pscan_free(parts, rc);
+                return ERR_DB_OP;
+            }
+            for(int j = 0; j < parts[i].count; j++){
+                int id = parts[i].recs[j].id;
+                if(id >= MIN_STD_ID && id <= MAX_STD_ID){
+                    bits[id / 8] |= (unsigned char)(1 << (id % 8));
+                    slots[id] = record_count + j + 1;
+                }
+            }
+            record_count += parts[i].count;
+        }
+        pscan_free(parts, rc);
+        return record_count;
+    }
+
+    out = malloc((size_t)SCAN_BLOCK_RECS * STUDENT_RECORD_SIZE);
+    if(out == NULL || scan_begin(&sc, fd) != NO_ERROR){
+        free(out);
+        return ERR_DB_FILE;
+    }
+
+    while((rc = scan_block(&sc)) > 0){
+        int n = 0;
+
+        for(int i = 0; i < sc.nrecs; i++){
+            if((sc.mask[i / 64] >> (i % 64)) & 1){
+                out[n] = sc.blk[i];
+                if(out[n].id >= MIN_STD_ID && out[n].id <= MAX_STD_ID){
+                    bits[out[n].id / 8] |= (unsigned char)(1 << (out[n].id % 8));
+                    slots[out[n].id] = record_count + n + 1;
+                }
+                n++;
+            }
+        }
+
+        if(n > 0 && write(temp, out, (size_t)n * STUDENT_RECORD_SIZE) != (ssize_t)n * STUDENT_RECORD_SIZE){
+            rc = ERR_DB_OP;
+            break;
+        }
+        record_count += n;
+    }
+    scan_end(&sc);
+    free(out);
+
+    return rc < 0 ? rc : record_count;
+}
+
+/*
+ *  flush_paged
+ *      temp:     paged file being written
+ *      page_no:  number of the data page, id / DB_PAGE_RECS
+ *      page:     the students of that page, empty slots zeroed
+ *
+ *  Writes a data page to temp, merging it with the students already there
+ *  if the page was written before.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_OP on failure
+ */
+static int flush_paged(int temp, int page_no, student_t *page)
+{
+    student_t old[DB_PAGE_RECS];
+    off_t at;
+    int rc;
+
+    rc = paged_lookup(temp, page_no * DB_PAGE_RECS, true, &at);
+    if (rc < 0)
+        return ERR_DB_OP;
+
+    if (rc == 1)
+    {
+        if (pread(temp, old, DB_PAGE_SIZE, at) != DB_PAGE_SIZE)
+            return ERR_DB_OP;
+        for (int i = 0; i < DB_PAGE_RECS; i++)
+        {
+            if (page[i].id == DELETED_STUDENT_ID)
+                page[i] = old[i];
+        }
+    }
+
+    if (pwrite(temp, page, DB_PAGE_SIZE, at) != DB_PAGE_SIZE)
+        return ERR_DB_OP;
+
+    return NO_ERROR;
+}
+
+/*
+ *  copy_paged
+ *      fd:    linux file descriptor of the database
+ *      temp:  empty file to write the paged database to
+ *
+ *  Writes every live record of the database to temp in the paged layout,
+ *  except for the header.  Neighbouring students of the same data page
+ *  are gathered and written with a single pwrite(), and data pages that
+ *  hold no students are simply not written.
+ *
+ *  returns:  <number>       number of records copied
+ *            ERR_DB_FILE    error reading the database
+ *            ERR_DB_OP      error writing to temp
+ */
+static int copy_paged(int fd, int temp)
+{
+    student_t page[DB_PAGE_RECS];
+    student_t student;
+    int page_no = -1;
+    int record_count = 0;
+    scan_t sc;
+    off_t pos;
+    int rc;
+
+    // the header page and the root directory, read back as zeros
+    if (ftruncate(temp, (off_t)(1 + DB_ROOT_PAGES) * DB_PAGE_SIZE) == -1)
+        return ERR_DB_OP;
+
+    if (scan_begin(&sc, fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    while ((rc = scan_next(&sc, &student, &pos)) > 0)
+    {
+        if (student.id < MIN_STD_ID)
+            continue;
+
+        if (student.id / DB_PAGE_RECS != page_no)
+        {
+            if (page_no >= 0 && (rc = flush_paged(temp, page_no, page)) < 0)
+                break;
+            memset(page, 0, sizeof(page));
+            page_no = student.id / DB_PAGE_RECS;
+        }
+
+        page[student.id % DB_PAGE_RECS] = student;
+        record_count++;
+    }
+    scan_end(&sc);
+
+    if (rc == 0 && page_no >= 0)
+        rc = flush_paged(temp, page_no, page);
+
+    return rc < 0 ? rc : record_count;
+}
+
+/*
+ *  rewrite_paged
+ *      fd:    linux file descriptor of the database
+ *      done:  message printed on success
+ *
+ *  Replaces the database with a paged copy of its live records, the same
+ *  way compress_db() replaces it with a packed one.
+ *
+ *  returns:  <number>       the fd of the new database file
+ *            ERR_DB_FILE    database file I/O issue, fd has been closed
+ *
+ *  console:  done           on success
+ *            M_ERR_DB_OPEN, M_ERR_DB_CREATE, M_ERR_DB_READ, M_ERR_DB_WRITE
+ *                           as for compress_db()
+ */
+static int rewrite_paged(int fd, const char *done)
+{
+    db_map_hdr_t mh;
+    int record_count;
+    int temp;
+
+    temp = open_replacement();
+    if(temp == -1 || open_bitmap(&mh) != NO_ERROR){
+        if(temp != -1){
+            discard_replacement(temp);
+        }
+        printf(M_ERR_DB_OPEN);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    record_count = copy_paged(fd, temp);
+    if (record_count < 0) {
+        discard_replacement(temp);
+        printf(record_count == ERR_DB_OP ? M_ERR_DB_WRITE : M_ERR_DB_READ);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    new_header(DB_LAYOUT_PAGED, &mh);
+    db_hdr.record_count = record_count;
+
+    // paged files do not use the bitmap, it is still tagged so the next
+    // new_header() (after -z) never hands out this generation again and
+    // the name and gpa indexes of this file can not pass for its own
+    if (carry_names() != NO_ERROR || carry_gpa() != NO_ERROR ||
+        write_header(temp) != NO_ERROR || write_bitmap() != NO_ERROR) {
+        discard_replacement(temp);
+        printf(M_ERR_DB_WRITE);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    // the old file stays locked until the new one is in place, so every
+    // process that waited for it sees the new one, see Locking
+    if (publish_replacement(fd, temp) != NO_ERROR) {
+        close_db(fd);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    close_db(fd);
+
+    // open_db() prints M_ERR_DB_OPEN itself if this fails
+    fd = open_db(DB_FILE, false);
+    if (fd < 0) {
+        return ERR_DB_FILE;
+    }
+    printf("%s", done);
+    return fd;
+}
+
+/*
+ *  convert_db
+ *      fd:  linux file descriptor
+ *
+ *  Converts a flat or packed database to the paged layout, after which ids
+ *  up to DB_PAGED_MAX_ID can be added, see Paged layout.  Converting a
+ *  paged database compacts it like compress_db() does.
+ *
+ *  returns:  <number>       the fd of the converted database file
+ *            ERR_DB_FILE    database file I/O issue, fd has been closed
+ *
+ *  console:  M_DB_CONVERTED_OK  on success
+ *            see rewrite_paged() for the errors
+ */
+int convert_db(int fd)
+{
+    // the lock is only released by closing fd once the new file is in
+    // place, see Locking
+    if(lock_file(fd, F_WRLCK) != NO_ERROR){
+        printf(M_ERR_DB_READ);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    // the log can not follow the records into the new file, the name and
+    // gpa indexes do, see carry_names() and carry_gpa().  The columns are
+    // built again by the next -s
+    if(checkpoint_wal(fd) != NO_ERROR || open_names(false) != NO_ERROR ||
+       open_gpa(false) != NO_ERROR || drop_cols() != NO_ERROR){
+        printf(M_ERR_DB_WRITE);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    return rewrite_paged(fd, M_DB_CONVERTED_OK);
 }
 
 /*
@@ -420,7 +8032,7 @@ void print_student(student_t *s)
  *  of the new compressed file from this function
  *
  *  returns:  <number>       returns the fd of the compressed database file
- *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_FILE    database file I/O issue, fd has been closed
  *
  *
  *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
@@ -437,57 +8049,336 @@ void print_student(student_t *s)
  */
 int compress_db(int fd)
 {
-    student_t student;
+    unsigned char bits[DB_MAP_BYTES] = {0};
+    int *slots;
+    db_map_hdr_t mh;
+    int record_count;
     int temp;
-    ssize_t bytesRead;
-    off_t newPos = 0;
 
-    temp = open(TMP_DB_FILE,O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP);
-    if(temp == -1){
-        printf(M_ERR_DB_OPEN);
+    // the lock is only released by closing fd once the new file is in
+    // place, see Locking
+    if(lock_file(fd, F_WRLCK) != NO_ERROR){
+        printf(M_ERR_DB_READ);
+        close_db(fd);
         return ERR_DB_FILE;
     }
-    if(lseek(fd,0,SEEK_SET)==-1){
-        close(temp);
-        unlink(TMP_DB_FILE);
-        printf(M_ERR_DB_READ);
+
+    // the log can not follow the records into the new file, the name and
+    // gpa indexes do, see carry_names() and carry_gpa().  The columns are
+    // built again by the next -s
+    if(checkpoint_wal(fd) != NO_ERROR || open_names(false) != NO_ERROR ||
+       open_gpa(false) != NO_ERROR || drop_cols() != NO_ERROR){
+        printf(M_ERR_DB_WRITE);
+        close_db(fd);
         return ERR_DB_FILE;
     }
 
-    while((bytesRead = read(fd,&student,STUDENT_RECORD_SIZE)) == STUDENT_RECORD_SIZE){
-        if(student.id != DELETED_STUDENT_ID){
-            if(write(temp, &student, STUDENT_RECORD_SIZE)!= STUDENT_RECORD_SIZE){
-                close(temp);
-                unlink(TMP_DB_FILE);
-                printf(M_ERR_DB_WRITE);
-                return ERR_DB_FILE;
-            }
+    // a paged file stays paged, only its empty data pages are dropped
+    if(is_paged(fd)){
+        return rewrite_paged(fd, M_DB_COMPRESSED_OK);
+    }
+
+    slots = calloc(MAX_STD_ID + 1, sizeof(int));
+    temp = open_replacement();
+    if(temp == -1 || slots == NULL || open_bitmap(&mh) != NO_ERROR){
+        if(temp != -1){
+            discard_replacement(temp);
         }
+        free(slots);
+        printf(M_ERR_DB_OPEN);
+        close_db(fd);
+        return ERR_DB_FILE;
     }
 
-    if (bytesRead == -1) {
-        close(temp);
-        unlink(TMP_DB_FILE);
-        printf(M_ERR_DB_READ);
+    // slot 0 is reserved for the header, which is filled in once all the
+    // records have been copied and counted
+    if(write(temp, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE){
+        discard_replacement(temp);
+        free(slots);
+        printf(M_ERR_DB_WRITE);
+        close_db(fd);
         return ERR_DB_FILE;
     }
 
-    close(fd);
-    close(temp);
+    record_count = copy_live(fd, temp, bits, slots);
+    if (record_count < 0) {
+        discard_replacement(temp);
+        free(slots);
+        printf(record_count == ERR_DB_OP ? M_ERR_DB_WRITE : M_ERR_DB_READ);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    new_header(DB_LAYOUT_PACKED, &mh);
+    memcpy(db_bits, bits, sizeof(db_bits));
+    db_hdr.record_count = record_count;
+    count_records_touched(record_count);
+
+    // the index lets get/add/del address the packed records directly
+    if (write_index(slots) != NO_ERROR || carry_names() != NO_ERROR ||
+        carry_gpa() != NO_ERROR || write_header(temp) != NO_ERROR ||
+        write_bitmap() != NO_ERROR) {
+        discard_replacement(temp);
+        free(slots);
+        printf(M_ERR_DB_WRITE);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+    free(slots);
 
-    if (rename(TMP_DB_FILE, DB_FILE) == -1) {
+    // the old file stays locked until the new one is in place, so every
+    // process that waited for it sees the new one, see Locking
+    if (publish_replacement(fd, temp) != NO_ERROR) {
+        close_db(fd);
         printf(M_ERR_DB_CREATE);
         return ERR_DB_FILE;
     }
-    fd = open(DB_FILE, O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-    if (fd == -1) {
-        printf(M_ERR_DB_OPEN);
+    close_db(fd);
+
+    // open_db() prints M_ERR_DB_OPEN itself if this fails
+    fd = open_db(DB_FILE, false);
+    if (fd < 0) {
         return ERR_DB_FILE;
     }
     printf(M_DB_COMPRESSED_OK);
     return fd;
 }
 
+/*
+ *  Incremental compaction
+ *
+ *  A delete from a packed file leaves a tombstone, a slot holding
+ *  EMPTY_STUDENT_RECORD that is never used again because new students are
+ *  appended at the end, see Packed index.  The header counts them.  Flat
+ *  and paged files keep every student in a slot of its own id, which the
+ *  id simply takes again, and hand empty pages back by hole punching, so
+ *  they have no tombstones.
+ *
+ *  compress_db() gets rid of them by rewriting the whole file with the
+ *  file locked throughout, which a long-lived process (-S or -r) can not
+ *  afford between two requests.  Once more than compact_ratio of the slots
+ *  are tombstones, compact_db() instead works on the file from its end: the
+ *  last records are moved into the lowest tombstones and the file is cut
+ *  short behind them, one region of COMPACT_REGION_RECS slots at a time
+ *  until the time budget of the call is used up.  Later calls go on until
+ *  no tombstone is left.  Each call holds the whole file exclusively for
+ *  at most about its budget and does nothing if another process is using
+ *  the file, which includes a -m lookup reading its mapping, see
+ *  lookup_student().  The moved records are synced before their old slots are cut
+ *  off, and a lookup that still had the old slot from the index finds the
+ *  student by scanning, see locate_student().
+ */
+#define COMPACT_RATIO       0.25                // default, see SDB_COMPACT
+#define COMPACT_REGION_RECS PUNCH_PAGE_RECS     // slots compacted at a time
+
+static double compact_ratio = COMPACT_RATIO;
+static bool compact_running = false;    // started and not done yet
+static unsigned int compact_gen = 0;    // generation compact_hole belongs to
+
+/*
+ *  set_compact_ratio
+ *      ratio:  share of the slots of a packed file that have to be
+ *              tombstones before compact_db() starts, 0 to never start
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  This function does not produce any output
+ */
+void set_compact_ratio(double ratio)
+{
+    compact_ratio = ratio;
+}
+
+/*
+ *  find_holes
+ *      fd:     linux file descriptor
+ *      holes:  set to the slots of the tombstones found, lowest first
+ *      n:      most tombstones to find
+ *      limit:  first slot not to look at
+ *
+ *  Looks for tombstones from compact_hole on.
+ *
+ *  returns:  the number of tombstones found, ERR_DB_FILE on read errors
+ */
+static int find_holes(int fd, off_t *holes, int n, off_t limit)
+{
+    student_t recs[COMPACT_REGION_RECS];
+    off_t slot = compact_hole;
+    int found = 0;
+
+    while (found < n && slot < limit)
+    {
+        int nrecs = limit - slot < COMPACT_REGION_RECS ? (int)(limit - slot) : COMPACT_REGION_RECS;
+
+        if (pread(fd, recs, (size_t)nrecs * STUDENT_RECORD_SIZE,
+                  slot * STUDENT_RECORD_SIZE) != (ssize_t)nrecs * STUDENT_RECORD_SIZE)
+            return ERR_DB_FILE;
+
+        for (int i = 0; i < nrecs && found < n; i++)
+        {
+            if (recs[i].id == DELETED_STUDENT_ID)
+                holes[found++] = slot + i;
+        }
+        slot += nrecs;
+    }
+
+    return found;
+}
+
+/*
+ *  compact_region
+ *      fd:  linux file descriptor, locked exclusively
+ *
+ *  Walks the last region of the file down from its end.  Tombstones are
+ *  cut off, live records are moved into the lowest tombstone below them,
+ *  until one is found that has none below it.
+ *
+ *  returns:  1 if the file was shortened, 0 if it has no tombstone below its
+ *            last record, ERR_DB_FILE on failure
+ */
+static int compact_region(int fd)
+{
+    student_t tail[COMPACT_REGION_RECS];
+    off_t holes[COMPACT_REGION_RECS];
+    int from[COMPACT_REGION_RECS];
+    struct stat st;
+    off_t end, start, cut;
+    int nrecs, nholes, moved = 0;
+    int i;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    end = st.st_size / STUDENT_RECORD_SIZE;
+    if (end <= 1)
+        return 0;
+    start = (end - 1) / COMPACT_REGION_RECS * COMPACT_REGION_RECS;
+    if (start < 1)
+        start = 1;
+    nrecs = (int)(end - start);
+
+    if (pread(fd, tail, (size_t)nrecs * STUDENT_RECORD_SIZE,
+              start * STUDENT_RECORD_SIZE) != (ssize_t)nrecs * STUDENT_RECORD_SIZE ||
+        (nholes = find_holes(fd, holes, nrecs, end)) < 0)
+        return ERR_DB_FILE;
+
+    // a hole that was just filled must not be cut off as a tombstone
+    for (i = nrecs - 1; i >= 0; i--)
+    {
+        if (moved > 0 && start + i <= holes[moved - 1])
+            break;
+        if (tail[i].id == DELETED_STUDENT_ID)
+            continue;
+        if (moved == nholes || holes[moved] >= start + i)
+            break;
+
+        if (pwrite(fd, &tail[i], STUDENT_RECORD_SIZE,
+                   holes[moved] * STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+            return ERR_DB_FILE;
+        from[moved++] = i;
+    }
+    cut = start + i + 1;
+
+    if (cut == end)
+        return 0;
+
+    // the copies have to be on disk before the originals are cut off
+    if (moved > 0 && fdatasync(fd) == -1)
+        return ERR_DB_FILE;
+
+    for (int m = 0; m < moved; m++)
+    {
+        const student_t *s = &tail[from[m]];
+
+        if (idx_put(s->id, (int)holes[m]) != NO_ERROR ||
+            cols_put(s, holes[m] * STUDENT_RECORD_SIZE, true) != NO_ERROR ||
+            cols_put(s, (start + from[m]) * STUDENT_RECORD_SIZE, false) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    // a mapping must not reach past the end of the file
+    unmap_db();
+    if (ftruncate(fd, cut * STUDENT_RECORD_SIZE) == -1)
+        return ERR_DB_FILE;
+
+    // every slot cut off was a tombstone or filled one
+    db_hdr.tombstones -= end - cut;
+    if (db_hdr.tombstones < 0)
+        db_hdr.tombstones = 0;
+    if (moved > 0)
+        compact_hole = holes[moved - 1] + 1;
+    return 1;
+}
+
+/*
+ *  compact_db
+ *      fd:         linux file descriptor
+ *      budget_us:  time to spend, in microseconds
+ *
+ *  Compacts the file region by region for about budget_us if it has too
+ *  many tombstones or compaction was started before, see Incremental
+ *  compaction.  Called by long-lived processes between operations.
+ *
+ *  returns:  1 if there is more to do, 0 if not or another process is
+ *            using the file, ERR_DB_FILE on failure
+ *
+ *  console:  This function does not produce any output
+ */
+int compact_db(int fd, long budget_us)
+{
+    double deadline;
+    int rc;
+
+    if (!have_index(fd))
+        return 0;
+    if (!compact_running &&
+        (compact_ratio <= 0 || db_hdr.tombstones <= 0 ||
+         db_hdr.tombstones <= compact_ratio * (db_hdr.tombstones + db_hdr.record_count)))
+        return 0;
+
+    // the moves must not overtake adds and deletes still waiting for the log
+    if (commit_wal(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if ((rc = try_lock_file(fd)) <= 0)
+        return rc;
+
+    if (compact_gen != db_hdr.generation)
+    {
+        compact_gen = db_hdr.generation;
+        compact_hole = 1;
+    }
+
+    deadline = clock_us(CLOCK_MONOTONIC) + budget_us;
+    rc = have_index(fd) ? 1 : 0;
+    while (rc > 0 && db_hdr.tombstones > 0 && clock_us(CLOCK_MONOTONIC) < deadline)
+    {
+        rc = compact_region(fd);
+
+        // another process may have left tombstones below compact_hole
+        if (rc == 0 && compact_hole > 1)
+        {
+            compact_hole = 1;
+            rc = compact_region(fd);
+        }
+    }
+
+    if (rc == 0)
+        db_hdr.tombstones = 0;
+    compact_running = rc > 0 && db_hdr.tombstones > 0;
+
+    if (have_index(fd) && write_header(fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    unlock_file(fd, F_WRLCK);
+
+    if (rc < 0)
+    {
+        compact_running = false;
+        return ERR_DB_FILE;
+    }
+    return compact_running ? 1 : 0;
+}
+
 /*
  *  validate_range
  *      id:  proposed student id
@@ -497,6 +8388,9 @@ int compress_db(int fd)
  *  as per the specifications.  It checks if the values are within the
  *  inclusive range using constents in db.h
  *
+ *  Once the open database has been converted to the paged layout (see -P)
+ *  ids up to DB_PAGED_MAX_ID are allowed instead of MAX_STD_ID.
+ *
  *  returns:    NO_ERROR       on success, both ID and GPA are in range
  *              EXIT_FAIL_ARGS if either ID or GPA is out of range
  *
@@ -505,8 +8399,10 @@ int compress_db(int fd)
  */
 int validate_range(int id, int gpa)
 {
+    int max_id = (db_hdr_fd != -1 && db_hdr.layout == DB_LAYOUT_PAGED) ?
+                 DB_PAGED_MAX_ID : MAX_STD_ID;
 
-    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+    if ((id < MIN_STD_ID) || (id > max_id))
         return EXIT_FAIL_ARGS;
 
     if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
@@ -516,214 +8412,307 @@ int validate_range(int id, int gpa)
 }
 
 /*
- *  usage
- *      exename:  the name of the executable from argv[0]
+ *  Library interface
+ *
+ *  libsdb.a holds everything above, sdbsc itself is the command line in
+ *  cli.c.  Other programs use it through the db_t handle declared in
+ *  sdb.h, which wraps the functions above without any console output:
+ *  every db_* function returns NO_ERROR or one of the error codes of
+ *  sdbsc.h instead.  Notes:
+ *   1. the engine keeps the state of the open database (header, bitmap,
+ *      index and sidecar files, mapping, log) in globals, so a process can
+ *      have one handle open at a time, on DB_FILE in its working directory
+ *   2. a cursor holds a shared lock on the whole file, like -p, until it
+ *      is closed.  The handle has one cursor at most, and adds, deletes and
+ *      counts wait for it to be closed (they return ERR_DB_OP)
+ *   3. with DB_OPEN_WAL db_add() and db_del() commit the log once per call
+ *      and the batch calls once per batch, see Write-ahead log
+ */
+struct db{
+    int fd;
+    bool cursor_open;
+};
+
+struct db_cursor{
+    db_t *db;
+    scan_t sc;
+};
+
+static db_t *open_handle = NULL;    // the handle db_open() returned
+
+/*
+ *  db_open
+ *      dbp:    set to the handle
+ *      flags:  DB_OPEN_TRUNCATE, DB_OPEN_MMAP and DB_OPEN_WAL or'ed together
+ *
+ *  returns:  NO_ERROR on success
+ *            ERR_DB_OP      a handle is already open
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int db_open(db_t **dbp, int flags)
+{
+    db_t *db;
+
+    if (open_handle != NULL)
+        return ERR_DB_OP;
+
+    db = calloc(1, sizeof(*db));
+    if (db == NULL)
+        return ERR_DB_FILE;
+
+    enable_mmap((flags & DB_OPEN_MMAP) != 0);
+    enable_wal((flags & DB_OPEN_WAL) != 0);
+    db->fd = open_database(DB_FILE, (flags & DB_OPEN_TRUNCATE) != 0);
+    if (db->fd < 0)
+    {
+        free(db);
+        return ERR_DB_FILE;
+    }
+
+    open_handle = db;
+    *dbp = db;
+    return NO_ERROR;
+}
+
+/*
+ *  db_close
+ *      db:  handle from db_open(), its cursor must be closed
  *
- *  Prints this programs expected usage
+ *  Commits the log and closes the database, the handle is freed either way.
  *
- *  returns:    nothing, this is a void function
+ *  returns:  NO_ERROR on success, ERR_DB_FILE if the log could not be
+ *            committed
+ */
+int db_close(db_t *db)
+{
+    int rc = commit_wal(db->fd);
+
+    close_db(db->fd);
+    enable_mmap(false);
+    enable_wal(false);
+    open_handle = NULL;
+    free(db);
+    return rc;
+}
+
+/*
+ *  db_get
+ *      db:  handle from db_open()
+ *      id:  the student id to look up
+ *      *s:  where the student is copied
  *
- *  console:  This function prints the usage information
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE, see get_student()
+ */
+int db_get(db_t *db, int id, student_t *s)
+{
+    return get_student(db->fd, id, s);
+}
+
+// adds s without committing the log
+static int db_insert(db_t *db, const student_t *s)
+{
+    student_t copy = *s;
+
+    if (validate_range(copy.id, copy.gpa) != NO_ERROR)
+        return ERR_DB_OP;
+
+    // the names do not have to be terminated
+    copy.fname[sizeof(copy.fname) - 1] = '\0';
+    copy.lname[sizeof(copy.lname) - 1] = '\0';
+    return insert_student(db->fd, copy.id, copy.fname, copy.lname, copy.gpa);
+}
+
+/*
+ *  db_add
+ *      db:  handle from db_open()
+ *      s:   the student to add
  *
+ *  returns:  NO_ERROR on success
+ *            ERR_DB_OP      id or gpa out of range, the student already
+ *                           exists or a cursor is open
+ *            ERR_DB_FILE    database file I/O issue
  */
-void usage(char *exename)
+int db_add(db_t *db, const student_t *s)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
-    printf("\t-h:  prints help\n");
-    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
-    printf("\t-c:  counts the records in the database\n");
-    printf("\t-d id:  deletes a student\n");
-    printf("\t-f id:  finds and prints a student in the database\n");
-    printf("\t-p:  prints all records in the student database\n");
-    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
-    printf("\t-z:  zero db file (remove all records)\n");
+    int rc;
+
+    if (db->cursor_open)
+        return ERR_DB_OP;
+
+    rc = db_insert(db, s);
+    if (commit_wal(db->fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
 }
 
-// Welcome to main()
-int main(int argc, char *argv[])
+/*
+ *  db_del
+ *      db:  handle from db_open()
+ *      id:  the student to delete
+ *
+ *  returns:  NO_ERROR on success
+ *            SRCH_NOT_FOUND the student is not in the database
+ *            ERR_DB_OP      a cursor is open
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int db_del(db_t *db, int id)
 {
-    char opt;      // user selected option
-    int fd;        // file descriptor of database files
-    int rc;        // return code from various operations
-    int exit_code; // exit code to shell
-    int id;        // userid from argv[2]
-    int gpa;       // gpa from argv[5]
+    int rc;
 
-    // space for a student structure which we will get back from
-    // some of the functions we will be writing such as get_student(),
-    // and print_student().
-    student_t student = {0};
+    if (db->cursor_open)
+        return ERR_DB_OP;
 
-    // This function must have at least one arg, and the arg must start
-    // with a dash
-    if ((argc < 2) || (*argv[1] != '-'))
-    {
-        usage(argv[0]);
-        exit(1);
-    }
+    rc = delete_student(db->fd, id);
+    if (commit_wal(db->fd) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
 
-    // The option is the first character after the dash for example
-    //-h -a -c -d -f -p -x -z
-    opt = (char)*(argv[1] + 1); // get the option flag
+/*
+ *  db_add_batch
+ *      db:       handle from db_open()
+ *      s:        the students to add
+ *      n:        number of students
+ *      results:  set to the db_add() return code of each student, or NULL
+ *
+ *  Adds the students one by one and commits the log once at the end.
+ *
+ *  returns:  the number of students added
+ *            ERR_DB_OP      a cursor is open
+ *            ERR_DB_FILE    the log could not be committed
+ */
+int db_add_batch(db_t *db, const student_t *s, int n, int *results)
+{
+    int added = 0;
 
-    // handle the help flag and then exit normally
-    if (opt == 'h')
-    {
-        usage(argv[0]);
-        exit(EXIT_OK);
-    }
+    if (db->cursor_open)
+        return ERR_DB_OP;
 
-    // now lets open the file and continue if there is no error
-    // note we are not truncating the file using the second
-    // parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0)
+    for (int i = 0; i < n; i++)
     {
-        exit(EXIT_FAIL_DB);
+        int rc = db_insert(db, &s[i]);
+
+        if (rc == NO_ERROR)
+            added++;
+        if (results != NULL)
+            results[i] = rc;
     }
 
-    // set rc to the return code of the operation to ensure the program
-    // use that to determine the proper exit_code.  Look at the header
-    // sdbsc.h for expected values.
+    return commit_wal(db->fd) == NO_ERROR ? added : ERR_DB_FILE;
+}
 
-    exit_code = EXIT_OK;
-    switch (opt)
-    {
-    case 'a':
-        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
-        // prog_name     -a      id  first_name last_name     gpa
-        //-------------------------------------------------------
-        // example:  prog_name -a 1 John Doe 341
-        if (argc != 6)
-        {
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-            break;
-        }
+/*
+ *  db_del_batch
+ *      db:       handle from db_open()
+ *      ids:      the students to delete
+ *      n:        number of ids
+ *      results:  set to the db_del() return code of each id, or NULL
+ *
+ *  Deletes the students one by one and commits the log once at the end.
+ *
+ *  returns:  the number of students deleted
+ *            ERR_DB_OP      a cursor is open
+ *            ERR_DB_FILE    the log could not be committed
+ */
+int db_del_batch(db_t *db, const int *ids, int n, int *results)
+{
+    int deleted = 0;
 
-        // convert id and gpa to ints from argv.  For this assignment assume
-        // they are valid numbers
-        id = atoi(argv[2]);
-        gpa = atoi(argv[5]);
+    if (db->cursor_open)
+        return ERR_DB_OP;
 
-        exit_code = validate_range(id, gpa);
-        if (exit_code == EXIT_FAIL_ARGS)
-        {
-            printf(M_ERR_STD_RNG);
-            break;
-        }
+    for (int i = 0; i < n; i++)
+    {
+        int rc = delete_student(db->fd, ids[i]);
 
-        rc = add_student(fd, id, argv[3], argv[4], gpa);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
+        if (rc == NO_ERROR)
+            deleted++;
+        if (results != NULL)
+            results[i] = rc;
+    }
 
-        break;
+    return commit_wal(db->fd) == NO_ERROR ? deleted : ERR_DB_FILE;
+}
 
-    case 'c':
-        //    arv[0] arv[1]
-        // prog_name     -c
-        //-----------------
-        // example:  prog_name -c
-        rc = count_db_records(fd);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
-        break;
+/*
+ *  db_count
+ *      db:  handle from db_open()
+ *
+ *  returns:  the number of students, ERR_DB_OP if a cursor is open or
+ *            ERR_DB_FILE on a database file I/O issue
+ */
+int db_count(db_t *db)
+{
+    if (db->cursor_open)
+        return ERR_DB_OP;
+    return count_locked(db->fd);
+}
 
-    case 'd':
-        //   arv[0]  arv[1]  arv[2]
-        // prog_name     -d      id
-        //-------------------------
-        // example:  prog_name -d 100
-        if (argc != 3)
-        {
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-            break;
-        }
-        id = atoi(argv[2]);
-        rc = del_student(fd, id);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
+/*
+ *  db_cursor_open
+ *      db:  handle from db_open()
+ *      cp:  set to the cursor
+ *
+ *  Starts a walk over every student in file order, see Record scanner.
+ *
+ *  returns:  NO_ERROR on success
+ *            ERR_DB_OP      the handle already has a cursor
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int db_cursor_open(db_t *db, db_cursor_t **cp)
+{
+    db_cursor_t *c;
 
-        break;
+    if (db->cursor_open)
+        return ERR_DB_OP;
 
-    case 'f':
-        //    arv[0] arv[1]  arv[2]
-        // prog_name     -f      id
-        //-------------------------
-        // example:  prog_name -f 100
-        if (argc != 3)
-        {
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-            break;
-        }
-        id = atoi(argv[2]);
-        rc = get_student(fd, id, &student);
+    c = malloc(sizeof(*c));
+    if (c == NULL)
+        return ERR_DB_FILE;
 
-        switch (rc)
-        {
-        case NO_ERROR:
-            print_student(&student);
-            break;
-        case SRCH_NOT_FOUND:
-            printf(M_STD_NOT_FND_MSG, id);
-            exit_code = EXIT_FAIL_DB;
-            break;
-        default:
-            printf(M_ERR_DB_READ);
-            exit_code = EXIT_FAIL_DB;
-            break;
-        }
-        break;
+    if (lock_file(db->fd, F_RDLCK) != NO_ERROR)
+    {
+        free(c);
+        return ERR_DB_FILE;
+    }
+    if (scan_begin(&c->sc, db->fd) != NO_ERROR)
+    {
+        unlock_file(db->fd, F_RDLCK);
+        free(c);
+        return ERR_DB_FILE;
+    }
 
-    case 'p':
-        //    arv[0] arv[1]
-        // prog_name     -p
-        //-----------------
-        // example:  prog_name -p
-        rc = print_db(fd);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
-        break;
+    c->db = db;
+    db->cursor_open = true;
+    *cp = c;
+    return NO_ERROR;
+}
 
-    case 'x':
-        //    arv[0] arv[1]
-        // prog_name     -x
-        //-----------------
-        // example:  prog_name -x
-
-        // remember compress_db returns a fd of the compressed database.
-        // we close it after this switch statement
-        fd = compress_db(fd);
-        if (fd < 0)
-            exit_code = EXIT_FAIL_DB;
-        break;
+/*
+ *  db_cursor_next
+ *      c:   cursor from db_cursor_open()
+ *      *s:  where the next student is copied
+ *
+ *  returns:  1 if a student was copied, 0 at the end or ERR_DB_FILE on a
+ *            database file I/O issue
+ */
+int db_cursor_next(db_cursor_t *c, student_t *s)
+{
+    off_t pos;
 
-    case 'z':
-        //    arv[0] arv[1]
-        // prog_name     -x
-        //-----------------
-        // example:  prog_name -x
-        // HINT:  close the db file, we already have fd
-        //       and reopen db indicating truncate=true
-        close(fd);
-        fd = open_db(DB_FILE, true);
-        if (fd < 0)
-        {
-            exit_code = EXIT_FAIL_DB;
-            break;
-        }
-        printf(M_DB_ZERO_OK);
-        exit_code = EXIT_OK;
-        break;
-    default:
-        usage(argv[0]);
-        exit_code = EXIT_FAIL_ARGS;
-    }
+    return scan_next(&c->sc, s, &pos);
+}
 
-    // dont forget to close the file before exiting, and setting the
-    // proper exit code - see the header file for expected values
-    close(fd);
-    exit(exit_code);
+/*
+ *  db_cursor_close
+ *      c:  cursor from db_cursor_open()
+ *
+ *  Ends the walk and releases its lock.
+ */
+void db_cursor_close(db_cursor_t *c)
+{
+    scan_end(&c->sc);
+    unlock_file(c->db->fd, F_RDLCK);
+    c->db->cursor_open = false;
+    free(c);
 }
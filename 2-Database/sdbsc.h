@@ -1,19 +1,85 @@
 #ifndef __SDB_H__
+    #define __SDB_H__
 
 #include "db.h" //get student record type
 
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+void close_db(int fd);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
+int bulk_load(int fd, char *path);
+int export_db(int fd, char *format);
+int import_db(int fd, char *format, char *path);
 int get_student(int fd, int id, student_t *s);
+int find_students(int fd, int *ids, int n);
+int find_by_name(int fd, char *lname, char *fname);
+int find_gpa_range(int fd, int min, int max);
+int find_top_gpa(int fd, int k);
+int stats_db(int fd);
 int del_student(int fd, int id);
 int compress_db(int fd);
+int reclaim_db(int fd);
+int convert_db(int fd);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
 int count_db_records(int fd);
 int print_db(int fd);
 void usage(char *);
 
+//memory-mapped backend (see -m)
+void enable_mmap(bool enable);
+void unmap_db(void);
+
+//io_uring for batches of reads and writes (see -q)
+void enable_uring(bool enable);
+
+//page cache (see SDB_CACHE)
+int set_page_cache(size_t bytes);
+void page_cache_counts(long *hits, long *misses, long *evictions);
+
+//write-ahead log (see -w)
+void enable_wal(bool enable);
+int commit_wal(int fd);
+
+//parallel scans (see -j)
+int set_scan_threads(int n);
+
+//incremental compaction of packed files (see SDB_COMPACT)
+#define COMPACT_STEP_US 1000    //time budget of one call from -S and -r
+void set_compact_ratio(double ratio);
+int compact_db(int fd, long budget_us);
+
+//operation statistics (see SDB_STATS)
+void enable_stats(bool enable);
+void stats_begin(void);
+void stats_end(int op);
+void print_stats_line(void);
+
+//server mode (see -S and -u).  A client sends one sdb_request_t per
+//operation over the Unix domain socket and gets back an sdb_reply_t
+//followed by len bytes of console output.  Both are sent in host byte
+//order.  op is the option letter ('a', 'c', 'd', 'e', 'f', 'g', 'n', 'p',
+//'s', 't', 'x', 'X', 'P' or 'z'), student carries the id and, for 'a', the
+//names and gpa.  For 'n' it carries the names to look up, fname empty to
+//match any, for 'g' the lowest gpa in id and the highest in gpa, for 't' k
+//in id and for 'e' the format name in fname
+typedef struct sdb_request{
+    int op;
+    student_t student;
+} sdb_request_t;
+
+typedef struct sdb_reply{
+    int exit_code;
+    unsigned int len;
+} sdb_reply_t;
+
+int run_request(int *fd, sdb_request_t *req);
+int serve_db(int *fd, char *path);
+int send_request(char *path, sdb_request_t *req);
+
+//script mode (see -r)
+int run_script(int *fd, char *path, char *server_path, bool timed);
+
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
 // ERR_DB_FILE is returned if there is are any issues with the database file itself
@@ -38,20 +104,42 @@ void usage(char *);
 
 //Output messages
 #define M_ERR_STD_RNG     "Cant add student, either ID or GPA out of allowable range!\n"
+#define M_ERR_GPA_RNG     "Cant search students, either GPA range or count out of allowable range!\n"
 #define M_ERR_DB_CREATE   "Error creating DB file, exiting!\n"
 #define M_ERR_DB_OPEN     "Error opening DB file, exiting!\n"
 #define M_ERR_DB_READ     "Error reading DB file, exiting!\n"
 #define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
 #define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
 #define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
+#define M_ERR_BULK_OPEN   "Error opening bulk load file %s, exiting!\n"
+#define M_ERR_BULK_PARSE  "Cant parse student on line %d, skipping it.\n"
+#define M_ERR_BULK_RNG    "Cant add student on line %d, either ID or GPA out of allowable range!\n"
+#define M_ERR_FORMAT      "Unknown format %s, use csv, jsonl or bin.\n"
+#define M_ERR_SCRIPT_OPEN "Error opening script %s, exiting!\n"
+#define M_ERR_SCRIPT_LINE "Cant run line %d of script.\n"
+#define M_ERR_SRV_SOCKET  "Error opening server socket %s, exiting!\n"
+#define M_ERR_SRV_RUNNING "A server is already listening on %s, exiting!\n"
+#define M_ERR_SRV_CONNECT "Error connecting to server at %s, exiting!\n"
+#define M_ERR_SRV_REQ     "Unknown request %d, ignoring it.\n"
 
 #define M_STD_ADDED       "Student %d added to database.\n"
 #define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
 #define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
+#define M_STD_NAME_NOT_FND "No student named %s%s%s was found in database.\n"
+#define M_GPA_NOT_FND     "No student with a GPA from %.2f to %.2f was found in database.\n"
 #define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
+#define M_DB_CONVERTED_OK "Database converted to the paged layout!\n"
+#define M_DB_RECLAIMED    "%d empty page(s) freed.\n"
 #define M_DB_ZERO_OK      "All database records removed!\n"
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
+#define M_DB_STATS        "%d student(s), average GPA %.2f, lowest %.2f, highest %.2f.\n"
+#define M_DB_STATS_HIST   "GPA %.2f to %.2f: %d\n"
+#define M_BULK_LOADED     "%d student(s) added to database, %d rejected.\n"
+#define M_SCRIPT_TIMING   "%d -%c operation(s) in %.3f ms, %.1f us each.\n"
+#define M_SCRIPT_TOTAL    "%d operation(s) in %.3f ms.\n"
+#define M_SRV_STARTED     "Serving database on %s.\n"
+#define M_SRV_STOPPED     "Server on %s stopped.\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
 
 //useful format strings for print students
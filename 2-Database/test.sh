@@ -192,4 +192,764 @@ setup_file() {
         echo "Failed Output:  $output"
         return 1
     }
-}
\ No newline at end of file
+}
+
+@test "Memory-mapped backend prints the same records" {
+    run ./sdbsc -p
+    expected_output="$output"
+
+    run ./sdbsc -m -p
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expected_output" ] || {
+        echo "Failed Output:  $output"
+        echo "Expected: $expected_output"
+        return 1
+    }
+}
+
+@test "Bulk load students from a file" {
+    run ./sdbsc -z
+    [ "$status" -eq 0 ]
+
+    printf '%s\n' "id,fname,lname,gpa" "1,john,doe,345" "3,jane,doe,390" \
+                  "3,jane,again,390" "600,bad,gpa,600" > bulk_test.csv
+    run ./sdbsc -b bulk_test.csv
+    rm -f bulk_test.csv
+    [ "$status" -eq 1 ]  || {
+        echo "Expecting status of 1, got:  $status"
+        return 1
+    }
+    [ "${lines[0]}" = "Cant add student on line 5, either ID or GPA out of allowable range!" ] &&
+    [ "${lines[1]}" = "Cant add student with ID=3, already exists in db." ] &&
+    [ "${lines[2]}" = "2 student(s) added to database, 2 rejected." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Parallel scan prints the same records" {
+    run ./sdbsc -p
+    expected_output="$output"
+
+    run ./sdbsc -j 4 -p
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expected_output" ] || {
+        echo "Failed Output:  $output"
+        echo "Expected: $expected_output"
+        return 1
+    }
+}
+
+@test "Server answers client requests" {
+    run ./sdbsc -p
+    expected_output="$output"
+
+    ./sdbsc -S ./test.sock > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./test.sock ] && break
+        sleep 0.1
+    done
+
+    run ./sdbsc -u ./test.sock -p
+    print_status=$status
+    print_output="$output"
+
+    run ./sdbsc -u ./test.sock -f 2
+    kill $server
+    wait $server || true
+
+    [ "$print_status" -eq 0 ] && [ "$print_output" = "$expected_output" ] || {
+        echo "Failed Output:  $print_output"
+        echo "Expected: $expected_output"
+        return 1
+    }
+    [ "$status" -eq 1 ] && [ "${lines[0]}" = "Student 2 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ ! -e ./test.sock ]
+}
+
+@test "Add, find and delete students after compress" {
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -a 3 jane again 390
+    [ "$status" -eq 1 ] && [ "${lines[0]}" = "Cant add student with ID=3, already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -a 2 jim doe 285
+    [ "$status" -eq 0 ] && [ "${lines[0]}" = "Student 2 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -d 1
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -f 2
+    [ "$status" -eq 0 ] && [ "${lines[1]}" = "2      jim                      doe                              2.85" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 3
+    [ "$status" -eq 0 ] && [ "${lines[1]}" = "3      jane                     doe                              3.90" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run stat --format="%s" ./student.db
+    [ "${lines[0]}" = "256" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Reclaim the pages of deleted students" {
+    seq 64 127 | sed 's/$/,page,student,300/' > reclaim_test.csv
+    run ./sdbsc -b reclaim_test.csv
+    rm -f reclaim_test.csv
+    [ "$status" -eq 0 ]
+
+    for id in $(seq 64 127); do
+        ./sdbsc -d $id > /dev/null
+    done
+
+    run ./sdbsc -X
+    [ "$status" -eq 0 ] && [[ "${lines[0]}" =~ ^[0-9]+\ empty\ page\(s\)\ freed\.$ ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 3
+    [ "$status" -eq 0 ]
+}
+
+@test "Convert to the paged layout and add large ids" {
+    run ./sdbsc -P
+    [ "$status" -eq 0 ] && [ "${lines[0]}" = "Database converted to the paged layout!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -a 2000000000 big id 350
+    [ "$status" -eq 0 ] && [ "${lines[0]}" = "Student 2000000000 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -a 2147483648 too big 350
+    [ "$status" -ne 0 ]
+
+    run ./sdbsc -f 2000000000
+    [ "$status" -eq 0 ] && [ "${lines[1]}" = "2000000000 big                      id                               3.50" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run diff <(./sdbsc -p) <(./sdbsc -j 3 -p)
+    [ "$status" -eq 0 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Write-ahead log is replayed after a restart" {
+    run ./sdbsc -w -a 70 wal student 310
+    [ "$status" -eq 0 ] && [ "${lines[0]}" = "Student 70 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -w -d 2
+    [ "$status" -eq 0 ]
+
+    # pretend the machine went down before the records reached the disk:
+    # the add of student 70 is lost from student.db and the log is from
+    # another boot
+    perl -e 'open(my $f, "+<", "student.db") or die; local $/; my $d = <$f>;
+        my $i = -1;
+        do { $i = index($d, pack("l a4", 70, "wal\0"), $i + 1) } while ($i >= 0 && $i % 64 != 0);
+        die "student 70 not found" if $i < 0;
+        seek($f, $i, 0); print $f "\0" x 64; close($f) or die'
+    printf 'x' | dd of=student.db.wal bs=1 seek=12 conv=notrunc 2>/dev/null
+    run ./sdbsc -w -f 70
+    [ "$status" -eq 0 ] && [ "${lines[1]}" = "70     wal                      student                          3.10" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    [ ! -e student.db.wal ]
+}
+
+@test "Concurrent writers keep every student exactly once" {
+    for id in $(seq 100 119); do
+        ./sdbsc -a $id some student 250 > /dev/null &
+    done
+    for i in 1 2 3 4 5; do
+        ./sdbsc -a 200 same student 250 > /dev/null &
+    done
+    wait
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 24 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run bash -c "./sdbsc -p | grep -c '^200 '"
+    [ "${lines[0]}" = "1" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Find students by name through the name index" {
+    run ./sdbsc -n student same
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 2 ] &&
+    [ "${lines[1]}" = "200    same                     student                          2.50" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # the index is kept current by add, delete and compress
+    ./sdbsc -a 201 other student 300 > /dev/null
+    ./sdbsc -d 200 > /dev/null
+    ./sdbsc -x > /dev/null
+
+    run ./sdbsc -n student
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 23 ] &&
+    [ "${lines[22]}" = "201    other                    student                          3.00" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -n student same
+    [ "$status" -eq 1 ] && [ "${lines[0]}" = "No student named same student was found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "GPA range and top students through the gpa index" {
+    run ./sdbsc -g 249 251
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 21 ] &&
+    [ "${lines[1]}" = "100    some                     student                          2.50" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    ./sdbsc -a 301 top student 495 > /dev/null
+    ./sdbsc -d 105 > /dev/null
+    ./sdbsc -x > /dev/null
+
+    run ./sdbsc -g 249 251
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 20 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -t 1
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 2 ] &&
+    [ "${lines[1]}" = "301    top                      student                          4.95" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -g 400 300
+    [ "$status" -eq 2 ]
+}
+
+@test "Statistics from the id and gpa columns" {
+    count=$(./sdbsc -c | sed 's/[^0-9]//g')
+
+    run ./sdbsc -s
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 11 ] &&
+    [[ "${lines[0]}" == "$count student(s), average GPA "* ]] &&
+    [ "${lines[10]}" = "GPA 4.50 to 5.00: 1" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # the columns are kept current by add and delete
+    ./sdbsc -a 302 low student 0 > /dev/null
+    run ./sdbsc -s
+    [[ "${lines[0]}" == *"lowest 0.00, highest 4.95." ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    ./sdbsc -d 302 > /dev/null
+    run ./sdbsc -s
+    [[ "${lines[0]}" == "$count student(s), "* ]] &&
+    [ "${lines[1]}" = "GPA 0.00 to 0.49: 0" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Export and import every format" {
+    # the layout may change the order, so the listings are compared sorted
+    ./sdbsc -p | sort > "$BATS_TMPDIR/print"
+
+    for fmt in csv jsonl bin; do
+        ./sdbsc -e $fmt > "$BATS_TMPDIR/export.$fmt"
+        # earlier tests added ids only the paged layout takes
+        ./sdbsc -z > /dev/null
+        ./sdbsc -P > /dev/null
+        run ./sdbsc -i $fmt "$BATS_TMPDIR/export.$fmt"
+        [ "$status" -eq 0 ] &&
+        [[ "$output" == *" student(s) added to database, 0 rejected." ]] || {
+            echo "Failed Output ($fmt):  $output"
+            return 1
+        }
+
+        run bash -c "./sdbsc -p | sort | cmp - '$BATS_TMPDIR/print'"
+        [ "$status" -eq 0 ] || {
+            echo "Failed Output ($fmt):  $output"
+            return 1
+        }
+    done
+
+    run ./sdbsc -e xml
+    [ "$status" -eq 2 ] && [ "$output" = "Unknown format xml, use csv, jsonl or bin." ]
+
+    run ./sdbsc -i xml "$BATS_TMPDIR/export.csv"
+    [ "$status" -eq 2 ] && [ "$output" = "Unknown format xml, use csv, jsonl or bin." ]
+}
+
+@test "Run a script of operations in one process" {
+    count=$(./sdbsc -c)
+
+    run ./sdbsc -r - <<'SCRIPT'
+# add, find and delete two students
+-a 310 script "one student" 310
+-a 311 script two 311
+-f 310
+
+-q
+-d 310
+-d 311
+SCRIPT
+
+    # the output of each operation, the exit code of the first that failed
+    [ "$status" -eq 2 ] && [ "${#lines[@]}" -eq 7 ] &&
+    [ "${lines[0]}" = "Student 310 added to database." ] &&
+    [ "${lines[3]}" = "310    script                   one student                      3.10" ] &&
+    [ "${lines[4]}" = "Cant run line 6 of script." ] &&
+    [ "${lines[6]}" = "Student 311 was deleted from database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -r - -T <<< "-c"
+    [ "$status" -eq 0 ] && [ "${lines[0]}" = "$count" ] &&
+    [[ "${lines[1]}" == "1 -c operation(s) in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Use the database through libsdb" {
+    cat > "$BATS_TMPDIR/libsdb_test.c" <<'PROGRAM'
+#include <stdio.h>
+#include "sdb.h"
+
+int main(void)
+{
+    student_t add[3] = {{320, "lib", "libsdb", 320}, {321, "lib", "libsdb", 321},
+                        {320, "dup", "libsdb", 100}};
+    int ids[2] = {320, 321};
+    int results[3], found = 0, count, n;
+    db_cursor_t *c;
+    student_t s;
+    db_t *db;
+
+    if (db_open(&db, 0) != NO_ERROR)
+        return 1;
+    count = db_count(db);
+    n = db_add_batch(db, add, 3, results);
+    printf("%d added: %d %d %d\n", n, results[0], results[1], results[2]);
+
+    db_cursor_open(db, &c);
+    printf("add while walking: %d\n", db_add(db, &add[2]));
+    while (db_cursor_next(c, &s) > 0)
+        found += s.id == 320 || s.id == 321;
+    db_cursor_close(c);
+    printf("%d walked, %d counted\n", found, db_count(db) - count);
+
+    printf("get: %d, ", db_get(db, 321, &s));
+    n = db_del_batch(db, ids, 2, NULL);
+    printf("%d deleted, get: %d\n", n, db_get(db, 321, &s));
+    return db_close(db) == NO_ERROR ? 0 : 1;
+}
+PROGRAM
+    gcc -o "$BATS_TMPDIR/libsdb_test" -I. "$BATS_TMPDIR/libsdb_test.c" libsdb.a -pthread
+
+    count=$(./sdbsc -c)
+    run "$BATS_TMPDIR/libsdb_test"
+    [ "$status" -eq 0 ] &&
+    [ "${lines[0]}" = "2 added: 0 0 -2" ] &&
+    [ "${lines[1]}" = "add while walking: -2" ] &&
+    [ "${lines[2]}" = "2 walked, 2 counted" ] &&
+    [ "${lines[3]}" = "get: 0, 2 deleted, get: -3" ] &&
+    [ "$(./sdbsc -c)" = "$count" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Benchmark report" {
+    run ./sdbbench -d sparse -n 1000
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 7 ] &&
+    [ "${lines[0]}" = "dist,records,op,ops,seconds,ops_per_s,p50_us,p99_us,io_syscalls" ] &&
+    [[ "${lines[1]}" == "sparse,1000,add,1000,"* ]] &&
+    [[ "${lines[5]}" == "sparse,1000,del,500,"* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # a report compares with an earlier one
+    printf '%s\n' "${lines[@]}" > "$BATS_TMPDIR/baseline.csv"
+    run ./sdbbench -d sparse -n 1000 -b "$BATS_TMPDIR/baseline.csv"
+    [ "$status" -eq 0 ] && [[ "${lines[0]}" == *",baseline_ops_per_s,change_pct" ]] &&
+    [[ "${lines[6]}" =~ ^sparse,1000,compress,1,.*,[0-9]+,[-+][0-9.]+$ ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Operation statistics with SDB_STATS" {
+    run ./sdbsc -c
+    [ "${#lines[@]}" -eq 1 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # one line of JSON on stderr, counting every operation of a script
+    run bash -c "printf -- '-f 1\n-f 2\n-f 3\n-c\n' | SDB_STATS=1 ./sdbsc -r - 2>&1 > /dev/null"
+    [ "${#lines[@]}" -eq 1 ] &&
+    [[ "${lines[0]}" == '{"sdb_stats":{"c":{"ops":1,'* ]] &&
+    [[ "${lines[0]}" == *'"f":{"ops":3,'*'"records":3,'*'"hist_us":{'* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Compress replaces the file without leaving a temporary one" {
+    ./sdbsc -p > "$BATS_TMPDIR/before"
+
+    # a temporary file left by a crash is cleaned up too
+    echo stale > .tmp_student.db
+    run ./sdbsc -x
+    [ "$status" -eq 0 ] && [ "$output" = "Database successfully compressed!" ] &&
+    [ ! -e .tmp_student.db ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run bash -c "./sdbsc -p | cmp - '$BATS_TMPDIR/before'"
+    [ "$status" -eq 0 ]
+}
+
+@test "Long-lived processes compact a packed file in the background" {
+    ./sdbsc -z
+    printf -- '-a %d compact student 300\n' $(seq 1 300) | ./sdbsc -r - > /dev/null
+    ./sdbsc -x
+
+    # deleting every other student leaves 150 tombstones in the packed file,
+    # which the script moves the live records into
+    run bash -c "{ printf -- '-d %d\n' \$(seq 2 2 300); printf -- '-f %d\n' \$(seq 1 2 299); } | SDB_COMPACT=0.01 ./sdbsc -r - | grep -c ' compact '"
+    [ "$status" -eq 0 ] && [ "$output" = "150" ] &&
+    [ "$(stat -c %s student.db)" -eq $((151 * 64)) ] &&
+    [ "$(./sdbsc -c)" = "Database contains 150 student record(s)." ] &&
+    [ "$(./sdbsc -n student | grep -c ' compact ')" -eq 150 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Page cache serves repeated lookups from memory" {
+    ./sdbsc -z
+    ./sdbsc -a 1 cached student 300
+
+    run bash -c "printf -- '-f 1\n-f 1\n-f 1\n-d 1\n-f 1\n' | SDB_STATS=1 SDB_CACHE=64 ./sdbsc -r - 2>&1"
+    [ "$status" -eq 1 ] && [ "${#lines[@]}" -eq 9 ] &&
+    [ "${lines[5]}" = "1      cached                   student                          3.00" ] &&
+    [ "${lines[7]}" = "Student 1 was not found in database." ] &&
+    [[ "${lines[8]}" == *'"page_cache":{"hits":3,"misses":1,"evictions":0}}}' ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Multi-get finds several students in one batch" {
+    ./sdbsc -z
+    ./sdbsc -a 1 first student 300
+    ./sdbsc -a 2 second student 310
+    ./sdbsc -a 3 third student 320
+
+    run ./sdbsc -q -F 3,99,1
+    [ "$status" -eq 1 ] && [ "${#lines[@]}" -eq 4 ] &&
+    [ "${lines[1]}" = "3      third                    student                          3.20" ] &&
+    [ "${lines[2]}" = "1      first                    student                          3.00" ] &&
+    [ "${lines[3]}" = "Student 99 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Mapped server sees students added by another process" {
+    ./sdbsc -z
+    ./sdbsc -a 1 first student 300
+    ./sdbsc -P
+
+    ./sdbsc -m -S ./test.sock > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./test.sock ] && break
+        sleep 0.1
+    done
+    ./sdbsc -u ./test.sock -f 1
+
+    # a new data page grows the file past the server's mapping
+    ./sdbsc -a 9000000 second student 310
+    run ./sdbsc -u ./test.sock -f 9000000
+    find_status=$status
+    find_output="$output"
+
+    run ./sdbsc -u ./test.sock -p
+    kill $server
+    wait $server || true
+
+    [ "$find_status" -eq 0 ] &&
+    [ "${find_output##*$'\n'}" = "9000000 second                   student                          3.10" ] || {
+        echo "Failed Output:  $find_output"
+        return 1
+    }
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 3 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Server is not held up by a client that stalls part way through a request" {
+    ./sdbsc -z
+    ./sdbsc -a 1 first student 300
+
+    ./sdbsc -S ./test.sock > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./test.sock ] && break
+        sleep 0.1
+    done
+
+    # sends the first bytes of a request and then nothing for a while
+    perl -MIO::Socket::UNIX -e '$s = IO::Socket::UNIX->new(Peer => "./test.sock") or exit 1;
+        syswrite($s, "\0" x 10); sleep 3' &
+    stalled=$!
+    sleep 0.2
+
+    run timeout 2 ./sdbsc -u ./test.sock -f 1
+    kill $stalled $server
+    wait $stalled $server || true
+
+    [ "$status" -eq 0 ] &&
+    [ "${lines[1]}" = "1      first                    student                          3.00" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Server finds students appended to a packed file by another process" {
+    ./sdbsc -z
+    for id in 1 2 3; do
+        ./sdbsc -a $id first student 300
+    done
+    ./sdbsc -x
+
+    ./sdbsc -S ./test.sock > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./test.sock ] && break
+        sleep 0.1
+    done
+    ./sdbsc -u ./test.sock -f 1
+
+    # enough appends to grow the index table and the file
+    for id in $(seq 10 90); do
+        ./sdbsc -a $id later student 310 > /dev/null
+    done
+    run ./sdbsc -u ./test.sock -f 80
+    find_status=$status
+    find_output="$output"
+
+    run ./sdbsc -u ./test.sock -p
+    kill $server
+    wait $server || true
+
+    [ "$find_status" -eq 0 ] &&
+    [ "${find_output##*$'\n'}" = "80     later                    student                          3.10" ] || {
+        echo "Failed Output:  $find_output"
+        return 1
+    }
+    [ "$status" -eq 0 ] && [ "${#lines[@]}" -eq 85 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Server follows the database file when another process replaces it" {
+    ./sdbsc -z
+    ./sdbsc -a 1 first student 300
+    ./sdbsc -a 2 second student 310
+
+    ./sdbsc -S ./test.sock > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./test.sock ] && break
+        sleep 0.1
+    done
+    ./sdbsc -u ./test.sock -f 1
+
+    # -x moves a new file in place of the one the server has open
+    ./sdbsc -x
+    ./sdbsc -d 1
+    ./sdbsc -a 3 third student 320
+    run ./sdbsc -u ./test.sock -f 1
+    deleted_status=$status
+    deleted_output="$output"
+
+    run ./sdbsc -u ./test.sock -f 3
+    kill $server
+    wait $server || true
+
+    [ "$deleted_status" -eq 1 ] &&
+    [ "$deleted_output" = "Student 1 was not found in database." ] || {
+        echo "Failed Output:  $deleted_output"
+        return 1
+    }
+    [ "$status" -eq 0 ] &&
+    [ "${lines[1]}" = "3      third                    student                          3.20" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Page cache follows the database file when another process replaces it" {
+    ./sdbsc -z
+    ./sdbsc -a 1 first student 300
+    ./sdbsc -a 2 second student 310
+
+    SDB_CACHE=64 ./sdbsc -S ./test.sock > /dev/null &
+    server=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S ./test.sock ] && break
+        sleep 0.1
+    done
+    ./sdbsc -u ./test.sock -f 1
+
+    ./sdbsc -x
+    ./sdbsc -d 1
+    run ./sdbsc -u ./test.sock -f 1
+    kill $server
+    wait $server || true
+
+    [ "$status" -eq 1 ] && [ "$output" = "Student 1 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Full database packed by an older compress is migrated" {
+    # MAX_STD_ID students packed from slot 0 on, no header, which makes the
+    # file exactly as long as a flat one
+    rm -f student.db student.db.*
+    perl -e 'print pack("l Z24 Z32 l", $_, "legacy", "student", 300) for 1 .. 100000' > student.db
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ] && [ "$output" = "Database contains 100000 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 100000
+    [ "$status" -eq 0 ] &&
+    [ "${lines[1]}" = "100000 legacy                   student                          3.00" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Paged database lists students in id order" {
+    ./sdbsc -z
+    ./sdbsc -a 1 first student 300
+    ./sdbsc -P
+    # every new data page is allocated after the ones before it
+    for id in 5000000 10 3000 200; do
+        ./sdbsc -a $id later student 310
+    done
+
+    expected_output="ID     FIRST_NAME               LAST_NAME                        GPA
+1      first                    student                          3.00
+10     later                    student                          3.10
+200    later                    student                          3.10
+3000   later                    student                          3.10
+5000000 later                    student                          3.10"
+
+    run ./sdbsc -p
+    [ "$status" -eq 0 ] && [ "$output" = "$expected_output" ] || {
+        echo "Failed Output:  $output"
+        echo "Expected: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -e csv
+    [ "$status" -eq 0 ] && [ "$(echo "$output" | cut -d, -f1 | tr '\n' ' ')" = "id 1 10 200 3000 5000000 " ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    ./sdbsc -x
+    run ./sdbsc -p
+    [ "$status" -eq 0 ] && [ "$output" = "$expected_output" ] || {
+        echo "Failed Output:  $output"
+        echo "Expected: $expected_output"
+        return 1
+    }
+}